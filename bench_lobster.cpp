@@ -0,0 +1,846 @@
+/*
+  Benchmark program for Lobster Index
+
+  Runs YCSB style workloads against the indexes of this library
+  and reports throughput and latency percentiles.
+
+  https://github.com/siara-in/sqlite_micro_logger
+
+  Copyright @ 2019 Arundale Ramanathan, Siara Logics (cc)
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <fstream>
+
+#include "lobster.h"
+#include "basix.h"
+#include "sqlite.h"
+#include "sqlite_cursor.h"
+#include "logger.h"
+#include "sharded_logger.h"
+#include "test_data.h"
+
+// Compares loading with the system libsqlite3 (-x), which is then
+// to be linked with -lsqlite3. 0 to build without it
+#ifndef BENCH_SQLITE3
+#define BENCH_SQLITE3 1
+#endif
+#if BENCH_SQLITE3 == 1
+#include <sqlite3.h>
+#endif
+
+// Rows inserted with libsqlite3 per transaction
+#define BENCH_SQLITE3_BATCH 10000
+
+using namespace std;
+
+#define OP_READ 0
+#define OP_UPDATE 1
+#define OP_INSERT 2
+#define OP_SCAN 3
+#define OP_RMW 4
+#define OP_DELETE 5
+#define OP_COUNT 6
+
+const char *op_names[] = {"read", "update", "insert", "scan", "read-modify-write", "delete"};
+
+// Percent of each op in a workload, as in the YCSB core workloads
+struct bench_workload {
+  char name;
+  int op_pct[OP_COUNT];
+  bool is_latest; // reads favour records inserted last
+};
+
+const bench_workload workloads[] = {
+  {'A', {50, 50, 0, 0, 0}, false},
+  {'B', {95, 5, 0, 0, 0}, false},
+  {'C', {100, 0, 0, 0, 0}, false},
+  {'D', {95, 0, 5, 0, 0}, true},
+  {'E', {0, 0, 5, 95, 0}, false},
+  {'F', {50, 0, 0, 0, 50}, false}
+};
+
+struct bench_config {
+  string engine;
+  string workload;
+  long record_count;
+  long op_count;
+  int key_len;
+  int value_len;
+  int thread_count;
+  int page_size;
+  int cache_kb;
+  int shard_count;
+  int scan_len;
+  unsigned long seed;
+  int key_dist; // one of KD_*, or -1 for that of each workload
+  string trace_in;
+  string trace_out;
+};
+
+const char *key_dist_names[] = {"uniform", "zipf", "hotspot", "latest", "seq"};
+
+// Index being benchmarked, taking byte string keys and values
+class bench_store {
+  public:
+    virtual ~bench_store() {}
+    virtual void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) = 0;
+    virtual bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) = 0;
+    // False if not supported
+    virtual bool del(const uint8_t *key, int key_len) {
+      return false;
+    }
+    // Reads up to count records from key on. False if not supported
+    virtual bool scan(const uint8_t *key, int key_len, int count) {
+      return false;
+    }
+    // True if it can be used by many threads at once
+    virtual bool is_thread_safe() {
+      return false;
+    }
+};
+
+class lobster_store : public bench_store {
+  protected:
+    lobster idx;
+  public:
+    lobster_store(const bench_config& cfg, const char *fname)
+        : idx(cfg.page_size, cfg.page_size, cfg.cache_kb, fname) {
+    }
+    void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) {
+      idx.put(key, key_len, val, val_len);
+    }
+    bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) {
+      return idx.get(key, key_len, in_size_out_val_len, val);
+    }
+};
+
+class basix_store : public bench_store {
+  protected:
+    basix idx;
+  public:
+    basix_store(const bench_config& cfg, const char *fname)
+        : idx(cfg.page_size, cfg.page_size, cfg.cache_kb, fname) {
+    }
+    void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) {
+      idx.put(key, key_len, val, val_len);
+    }
+    bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) {
+      return idx.get(key, key_len, in_size_out_val_len, val);
+    }
+};
+
+class sqlite_store : public bench_store {
+  protected:
+    sqlite idx;
+    string filename;
+    sqlite_cursor *cursor; // opened on first scan and kept for the rest
+    bool is_changed; // by puts since the last scan
+  public:
+    sqlite_store(const bench_config& cfg, const char *fname)
+        : idx(2, 1, "key, value", "imain", cfg.page_size, cfg.page_size, cfg.cache_kb, fname), filename(fname) {
+      cursor = NULL;
+      is_changed = false;
+    }
+    ~sqlite_store() {
+      if (cursor != NULL)
+        delete cursor;
+    }
+    void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) {
+      idx.put(key, key_len, val, val_len);
+      is_changed = true;
+    }
+    bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) {
+      return idx.get(key, key_len, in_size_out_val_len, val);
+    }
+    // Scans the file, so pages changed since the last scan are
+    // written out first
+    bool scan(const uint8_t *key, int key_len, int count) {
+      if (is_changed || cursor == NULL) {
+        idx.flush();
+        is_changed = false;
+      }
+      if (cursor == NULL)
+        cursor = new sqlite_cursor(filename.c_str());
+      if (!cursor->seek(key, key_len))
+        return false;
+      while (count-- && cursor->next()) {
+        int value_len;
+        cursor->get_value(value_len);
+      }
+      return true;
+    }
+};
+
+// logger takes its cache size as a packed value. When only its low
+// byte is set, it gives the cache of idx0, idx1 and the hot tier each
+// in units of 16 mb, and a quarter of that for each rotated segment.
+// cache_kb is turned into that unit, at least 1 and at most 255 so
+// that it does not spill into the other fields.
+size_t logger_cache_units(int cache_kb) {
+  long units = cache_kb / 1024 / 16;
+  return units < 1 ? 1 : (units > 255 ? 255 : units);
+}
+
+class logger_store : public bench_store {
+  protected:
+    logger idx;
+  public:
+    logger_store(const bench_config& cfg, const char *fname)
+        : idx(fname, logger_cache_units(cfg.cache_kb)) {
+    }
+    void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) {
+      idx.put(key, key_len, val, val_len);
+    }
+    bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) {
+      return idx.get(key, key_len, in_size_out_val_len, val);
+    }
+    bool del(const uint8_t *key, int key_len) {
+      return idx.del(key, key_len);
+    }
+    // Goes over all tiers merged, which also copies out and sorts
+    // idx0 on each scan
+    bool scan(const uint8_t *key, int key_len, int count) {
+      tier_merger *it = idx.iterate(key, key_len);
+      while (count-- && it->next()) {
+        int value_len;
+        it->get_value(value_len);
+      }
+      delete it;
+      return true;
+    }
+};
+
+class sharded_logger_store : public bench_store {
+  protected:
+    sharded_logger idx;
+  public:
+    sharded_logger_store(const bench_config& cfg, const char *fname)
+        : idx(fname, logger_cache_units(cfg.cache_kb), cfg.shard_count) {
+    }
+    void put(const uint8_t *key, int key_len, const uint8_t *val, int val_len) {
+      idx.put(key, key_len, val, val_len);
+    }
+    bool get(const uint8_t *key, int key_len, int *in_size_out_val_len, uint8_t *val) {
+      return idx.get(key, key_len, in_size_out_val_len, val);
+    }
+    bool del(const uint8_t *key, int key_len) {
+      return idx.del(key, key_len);
+    }
+    // Holds up puts to all shards till done
+    bool scan(const uint8_t *key, int key_len, int count) {
+      idx.scan(key, key_len, [&count](const uint8_t *k, int k_len, const uint8_t *v, int v_len) {
+        return --count > 0;
+      });
+      return true;
+    }
+    bool is_thread_safe() {
+      return true;
+    }
+};
+
+// Removes files left by an earlier run of given engine
+void remove_bench_files(const string& prefix) {
+  string cmd = "rm -f " + prefix + "*";
+  if (system(cmd.c_str()) != 0)
+    cout << "Could not remove " << prefix << "*" << endl;
+}
+
+bench_store *open_store(const bench_config& cfg) {
+  string fname = "bench_" + cfg.engine;
+  remove_bench_files(fname);
+  if (cfg.engine == "lobster")
+    return new lobster_store(cfg, (fname + ".db").c_str());
+  if (cfg.engine == "basix")
+    return new basix_store(cfg, (fname + ".db").c_str());
+  if (cfg.engine == "sqlite")
+    return new sqlite_store(cfg, (fname + ".db").c_str());
+  if (cfg.engine == "logger")
+    return new logger_store(cfg, fname.c_str());
+  if (cfg.engine == "slogger")
+    return new sharded_logger_store(cfg, fname.c_str());
+  return NULL;
+}
+
+// Key of record number n, a prefix and digits of a hash of n as in
+// YCSB, so that records inserted in order go all over the tree
+int make_key(uint8_t *key, long n, int key_len) {
+  char digits[24];
+  int digit_count = sprintf(digits, "%llu", (unsigned long long) key_hash::mix(n + 1));
+  memcpy(key, "user", 4);
+  for (int i = 4; i < key_len; i++)
+    key[i] = digits[(i - 4) % digit_count];
+  return key_len;
+}
+
+// Value of given version of record n, so that updates change it
+void make_value(uint8_t *val, long n, long version, int value_len) {
+  for (int i = 0; i < value_len; i++)
+    val[i] = 'a' + (n + version + i) % 26;
+}
+
+// Latencies of each op type seen by one thread, in nanoseconds
+struct bench_latencies {
+  vector<long> op_nanos[OP_COUNT];
+  long failed_count;
+};
+
+struct bench_run {
+  const bench_config *cfg;
+  const bench_workload *wl;
+  bench_store *store;
+  mutex store_mutex;
+  atomic<long> record_count;
+  atomic<long> ops_left;
+  long phase_op_count;
+  key_picker *picker; // NULL to pick as per workload
+  FILE *trace_fp; // ops are recorded here if not NULL
+  bool is_trace_failed; // no more ops recorded after a write fails
+  mutex trace_mutex;
+};
+
+int pick_op(const bench_workload *wl, int pct) {
+  for (int op = 0; op < OP_COUNT; op++) {
+    if (pct < wl->op_pct[op])
+      return op;
+    pct -= wl->op_pct[op];
+  }
+  return OP_READ;
+}
+
+// Record to read or update, any loaded record with same chance, or
+// for the latest workload, those inserted last more often, unless
+// a distribution is given with -d. seq_no is the count of ops picked
+// so far over all threads, for sequential picks
+long pick_record(bench_run *run, mt19937_64& rng, data_rng& pick_rng, long seq_no) {
+  long count = run->record_count;
+  if (run->picker != NULL) {
+    if (run->cfg->key_dist != KD_SEQUENTIAL)
+      return run->picker->next_existing(pick_rng, count);
+    long n = run->picker->next(pick_rng, seq_no % count);
+    return n < count ? n : count - 1;
+  }
+  if (!run->wl->is_latest)
+    return rng() % count;
+  // exponential back from the newest record
+  exponential_distribution<double> back(10.0 / count);
+  long n = count - 1 - (long) back(rng);
+  return n < 0 ? rng() % count : n;
+}
+
+void record_op(bench_run *run, uint8_t op, const uint8_t *key, int key_len, int val_len) {
+  lock_guard<mutex> lock(run->trace_mutex);
+  if (run->is_trace_failed)
+    return;
+  if (!write_trace_entry(run->trace_fp, op, key, key_len, val_len)) {
+    printf("Could not write trace: %s, tracing stopped\n", run->cfg->trace_out.c_str());
+    run->is_trace_failed = true;
+  }
+}
+
+void do_op(bench_run *run, int op, mt19937_64& rng, data_rng& pick_rng, long seq_no,
+    uint8_t *key, uint8_t *val, bench_latencies& lat) {
+  const bench_config *cfg = run->cfg;
+  long n = (op == OP_INSERT ? run->record_count.fetch_add(1) : pick_record(run, rng, pick_rng, seq_no));
+  int key_len = make_key(key, n, cfg->key_len);
+  int val_len = cfg->value_len;
+  if (op == OP_INSERT || op == OP_UPDATE)
+    make_value(val, n, rng() % 26, val_len);
+  bool is_ok = true;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  {
+    unique_lock<mutex> lock(run->store_mutex, defer_lock);
+    if (!run->store->is_thread_safe())
+      lock.lock();
+    switch (op) {
+      case OP_READ:
+        is_ok = run->store->get(key, key_len, &val_len, val);
+        break;
+      case OP_UPDATE:
+      case OP_INSERT:
+        run->store->put(key, key_len, val, val_len);
+        break;
+      case OP_SCAN:
+        is_ok = run->store->scan(key, key_len, 1 + rng() % cfg->scan_len);
+        break;
+      case OP_RMW:
+        is_ok = run->store->get(key, key_len, &val_len, val);
+        if (is_ok) {
+          val[0] = 'a' + (val[0] - 'a' + 1) % 26;
+          run->store->put(key, key_len, val, val_len);
+        }
+        break;
+    }
+  }
+  lat.op_nanos[op].push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  if (!is_ok)
+    lat.failed_count++;
+  // scans are not recorded as traces have no op for them
+  if (run->trace_fp != NULL && op != OP_SCAN) {
+    if (op == OP_READ || op == OP_RMW)
+      record_op(run, TRACE_OP_GET, key, key_len, 0);
+    if (op != OP_READ && (op != OP_RMW || is_ok))
+      record_op(run, TRACE_OP_PUT, key, key_len, val_len);
+  }
+}
+
+void bench_worker(bench_run *run, int thread_no, bench_latencies *lat) {
+  mt19937_64 rng(run->cfg->seed + thread_no);
+  data_rng pick_rng(run->cfg->seed * 31 + thread_no);
+  uint8_t key[run->cfg->key_len + 1];
+  uint8_t val[run->cfg->value_len + 1];
+  lat->failed_count = 0;
+  long ops_left;
+  while ((ops_left = run->ops_left.fetch_sub(1)) > 0) {
+    int op = (run->wl == NULL ? OP_INSERT : pick_op(run->wl, rng() % 100));
+    do_op(run, op, rng, pick_rng, run->phase_op_count - ops_left, key, val, *lat);
+  }
+}
+
+double percentile_us(vector<long>& nanos, double pct) {
+  if (nanos.empty())
+    return 0;
+  size_t idx = (size_t) ((nanos.size() - 1) * pct / 100);
+  nth_element(nanos.begin(), nanos.begin() + idx, nanos.end());
+  return nanos[idx] / 1000.0;
+}
+
+void print_latencies(vector<bench_latencies>& lats);
+
+// Runs op_count ops of workload, or loads records if wl is NULL
+void run_phase(bench_run *run, const bench_workload *wl, long op_count, const char *label) {
+  const bench_config *cfg = run->cfg;
+  run->wl = wl;
+  run->ops_left = op_count;
+  run->phase_op_count = op_count;
+  vector<bench_latencies> lats(cfg->thread_count);
+  vector<thread> threads;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int i = 0; i < cfg->thread_count; i++)
+    threads.push_back(thread(bench_worker, run, i, &lats[i]));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("%s, %s: %ld ops in %.3f s, %.0f ops/s, %d threads\n", cfg->engine.c_str(),
+      label, op_count, secs, secs > 0 ? op_count / secs : 0, cfg->thread_count);
+  print_latencies(lats);
+}
+
+void print_latencies(vector<bench_latencies>& lats) {
+  long failed_count = 0;
+  for (int op = 0; op < OP_COUNT; op++) {
+    vector<long> all;
+    for (size_t i = 0; i < lats.size(); i++)
+      all.insert(all.end(), lats[i].op_nanos[op].begin(), lats[i].op_nanos[op].end());
+    if (all.empty())
+      continue;
+    printf("  %-18s %10ld ops, p50: %9.2f us, p99: %9.2f us, p99.9: %9.2f us\n", op_names[op], (long) all.size(),
+        percentile_us(all, 50), percentile_us(all, 99), percentile_us(all, 99.9));
+  }
+  for (size_t i = 0; i < lats.size(); i++)
+    failed_count += lats[i].failed_count;
+  if (failed_count > 0)
+    printf("  %ld ops not found or not supported\n", failed_count);
+}
+
+// Replays ops recorded in trace file given with -f, in one thread.
+// Values put are made up to the length recorded
+void run_trace(bench_run *run) {
+  const bench_config *cfg = run->cfg;
+  FILE *fp = fopen(cfg->trace_in.c_str(), "rb");
+  if (fp == NULL) {
+    printf("Could not open trace: %s\n", cfg->trace_in.c_str());
+    return;
+  }
+  vector<bench_latencies> lats(1);
+  bench_latencies& lat = lats[0];
+  lat.failed_count = 0;
+  vector<uint8_t> val(cfg->value_len + 1);
+  trace_entry entry;
+  long op_count = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (read_trace_entry(fp, entry)) {
+    int op = OP_READ;
+    int val_len = val.size();
+    if (entry.op == TRACE_OP_PUT) {
+      op = OP_UPDATE;
+      val_len = entry.value_len;
+      if (val_len >= (int) val.size())
+        val.resize(val_len + 1);
+      make_value(val.data(), op_count, 0, val_len);
+    } else if (entry.op == TRACE_OP_DEL)
+      op = OP_DELETE;
+    else if (entry.op != TRACE_OP_GET) {
+      printf("Unknown op in trace: %d\n", entry.op);
+      break;
+    }
+    bool is_ok = true;
+    chrono::steady_clock::time_point op_start = chrono::steady_clock::now();
+    if (op == OP_UPDATE)
+      run->store->put(entry.key, entry.key_len, val.data(), val_len);
+    else if (op == OP_DELETE)
+      is_ok = run->store->del(entry.key, entry.key_len);
+    else
+      is_ok = run->store->get(entry.key, entry.key_len, &val_len, val.data());
+    lat.op_nanos[op].push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - op_start).count());
+    if (!is_ok)
+      lat.failed_count++;
+    op_count++;
+  }
+  fclose(fp);
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("%s, trace %s: %ld ops in %.3f s, %.0f ops/s, 1 thread\n", cfg->engine.c_str(),
+      cfg->trace_in.c_str(), op_count, secs, secs > 0 ? op_count / secs : 0);
+  print_latencies(lats);
+}
+
+// fsync() and fdatasync() made by this program and the libraries it
+// uses, including libsqlite3, are counted by wrapping those of libc
+atomic<long> sync_count(0);
+
+extern "C" int fsync(int fd) {
+  static int (*libc_fsync)(int) = (int (*)(int)) dlsym(RTLD_NEXT, "fsync");
+  sync_count++;
+  return libc_fsync(fd);
+}
+
+extern "C" int fdatasync(int fd) {
+  static int (*libc_fdatasync)(int) = (int (*)(int)) dlsym(RTLD_NEXT, "fdatasync");
+  sync_count++;
+  return libc_fdatasync(fd);
+}
+
+// Bytes passed to write() by this process so far, 0 if not known
+long bytes_written_so_far() {
+  ifstream io("/proc/self/io");
+  string name;
+  long val;
+  while (io >> name >> val) {
+    if (name == "wchar:")
+      return val;
+  }
+  return 0;
+}
+
+long file_size(const char *filename) {
+  struct stat file_stat;
+  return stat(filename, &file_stat) ? 0 : file_stat.st_size;
+}
+
+// Wall time, syncs and bytes written while loading a dataset
+struct load_stats {
+  chrono::steady_clock::time_point start;
+  long start_syncs;
+  long start_bytes;
+  void begin() {
+    start_syncs = sync_count;
+    start_bytes = bytes_written_so_far();
+    start = chrono::steady_clock::now();
+  }
+  void end(const char *label, int page_size, long record_count, const char *filename) {
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-10s page size: %6d, %ld records in %8.3f s, %9.0f rec/s, fsyncs: %6ld, written: %9ldkb, file: %9ldkb\n",
+        label, page_size, record_count, secs, secs > 0 ? record_count / secs : 0, sync_count - start_syncs,
+        (bytes_written_so_far() - start_bytes) / 1024, file_size(filename) / 1024);
+  }
+};
+
+// Loads records of prepare_data() with the sqlite writer of this library
+void load_with_writer(const uint8_t *data_buf, int64_t data_sz, long record_count, int page_size, int cache_kb) {
+  const char *filename = "bench_writer.db";
+  remove(filename);
+  load_stats stats;
+  stats.begin();
+  {
+    sqlite sq(2, 1, "key, value", "imain", page_size, page_size, cache_kb, filename);
+    for (int64_t pos = 0; pos < data_sz; pos++) {
+      int8_t vlen;
+      uint32_t key_len = read_vint32(data_buf + pos, &vlen);
+      pos += vlen;
+      uint32_t value_len = read_vint32(data_buf + pos + key_len + 1, &vlen);
+      sq.put(data_buf + pos, key_len, data_buf + pos + key_len + vlen + 1, value_len);
+      pos += key_len + value_len + vlen + 1;
+    }
+    sq.flush();
+    sq.cache->sync_file();
+  }
+  stats.end("writer", page_size, record_count, filename);
+}
+
+#if BENCH_SQLITE3 == 1
+bool exec_sqlite3(sqlite3 *db, const char *sql) {
+  char *err_msg = NULL;
+  if (sqlite3_exec(db, sql, NULL, NULL, &err_msg) != SQLITE_OK) {
+    cout << "sqlite3 error: " << (err_msg == NULL ? "" : err_msg) << ", sql: " << sql << endl;
+    sqlite3_free(err_msg);
+    return false;
+  }
+  return true;
+}
+
+// Loads the same records with libsqlite3, through a prepared
+// statement in WAL mode, BENCH_SQLITE3_BATCH rows per transaction
+bool load_with_sqlite3(const uint8_t *data_buf, int64_t data_sz, long record_count, int page_size, int cache_kb) {
+  const char *filename = "bench_sqlite3.db";
+  remove(filename);
+  load_stats stats;
+  stats.begin();
+  sqlite3 *db;
+  if (sqlite3_open(filename, &db) != SQLITE_OK) {
+    cout << "sqlite3 error: " << sqlite3_errmsg(db) << endl;
+    sqlite3_close(db);
+    return false;
+  }
+  char pragmas[200];
+  sprintf(pragmas, "PRAGMA page_size = %d; PRAGMA cache_size = -%d; PRAGMA journal_mode = WAL; "
+      "PRAGMA synchronous = NORMAL", page_size, cache_kb);
+  sqlite3_stmt *stmt = NULL;
+  bool is_ok = exec_sqlite3(db, pragmas)
+      && exec_sqlite3(db, "CREATE TABLE imain (key, value, PRIMARY KEY (key)) WITHOUT ROWID")
+      && sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO imain VALUES (?, ?)", -1, &stmt, NULL) == SQLITE_OK
+      && exec_sqlite3(db, "BEGIN");
+  long row_count = 0;
+  for (int64_t pos = 0; is_ok && pos < data_sz; pos++) {
+    int8_t vlen;
+    uint32_t key_len = read_vint32(data_buf + pos, &vlen);
+    pos += vlen;
+    uint32_t value_len = read_vint32(data_buf + pos + key_len + 1, &vlen);
+    sqlite3_bind_text(stmt, 1, (const char *) data_buf + pos, key_len, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, (const char *) data_buf + pos + key_len + vlen + 1, value_len, SQLITE_STATIC);
+    is_ok = (sqlite3_step(stmt) == SQLITE_DONE);
+    sqlite3_reset(stmt);
+    pos += key_len + value_len + vlen + 1;
+    if (is_ok && ++row_count % BENCH_SQLITE3_BATCH == 0)
+      is_ok = exec_sqlite3(db, "COMMIT") && exec_sqlite3(db, "BEGIN");
+  }
+  if (!is_ok)
+    cout << "sqlite3 error: " << sqlite3_errmsg(db) << endl;
+  is_ok = is_ok && exec_sqlite3(db, "COMMIT") && exec_sqlite3(db, "PRAGMA wal_checkpoint(TRUNCATE)");
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  if (is_ok)
+    stats.end("libsqlite3", page_size, record_count, filename);
+  return is_ok;
+}
+#endif
+
+// Loads one dataset from prepare_data() with the sqlite writer and
+// with libsqlite3 at each page size from 512 to 65536
+int compare_with_sqlite3(const bench_config& cfg) {
+  int64_t data_alloc_sz = 64 * 1024 * 1024;
+  uint8_t *data_buf = (uint8_t *) malloc(data_alloc_sz);
+  int64_t data_sz = prepare_data(&data_buf, data_alloc_sz, cfg.key_len, cfg.value_len, cfg.record_count,
+      CS_ALPHA_ONLY, true, cfg.key_dist < 0 ? KD_UNIFORM : cfg.key_dist, cfg.seed);
+  printf("Records: %ld, key len: up to %d, value len: up to %d, data size: %ldkb, cache: %dkb\n",
+      cfg.record_count, cfg.key_len, cfg.value_len, (long) (data_sz / 1024), cfg.cache_kb);
+  printf("writer: one fsync at end, libsqlite3: WAL with synchronous = NORMAL, "
+      "%d rows per commit\n", BENCH_SQLITE3_BATCH);
+  int ret = 0;
+  for (int i = 9; i < 17; i++) {
+    int page_size = 1 << i;
+    load_with_writer(data_buf, data_sz, cfg.record_count, page_size, cfg.cache_kb);
+#if BENCH_SQLITE3 == 1
+    if (!load_with_sqlite3(data_buf, data_sz, cfg.record_count, page_size, cfg.cache_kb))
+      ret = 1;
+#endif
+  }
+  free(data_buf);
+  return ret;
+}
+
+void print_usage() {
+  printf("\nBenchmark for Lobster Index\n");
+  printf("---------------------------\n\n");
+  printf("Usage\n");
+  printf("-----\n\n");
+  printf("bench_lobster <engine> <workloads> [-n <record_count>] [-o <op_count>]\n");
+  printf("              [-k <key_len>] [-v <value_len>] [-t <thread_count>]\n");
+  printf("              [-p <page_size>] [-c <cache_kb>] [-h <shard_count>]\n");
+  printf("              [-l <max_scan_len>] [-s <seed>] [-d <key_dist>]\n");
+  printf("              [-f <trace_file>] [-w <trace_file>]\n");
+  printf("    Loads record_count records into a new index of given engine\n");
+  printf("        and then runs op_count ops of each workload given\n");
+  printf("    engine is one of lobster, basix, sqlite, logger or slogger\n");
+  printf("        (logger sharded by key over shard_count loggers)\n");
+  printf("    workloads are letters of YCSB core workloads, such as ABCFDE:\n");
+  printf("        A: 50%% read, 50%% update      B: 95%% read, 5%% update\n");
+  printf("        C: 100%% read                 D: 95%% read latest, 5%% insert\n");
+  printf("        E: 95%% scan, 5%% insert       F: 50%% read, 50%% read-modify-write\n");
+  printf("        T: ops of trace file given with -f, in one thread\n");
+  printf("    Records to read are picked uniformly, or as per key_dist, one of\n");
+  printf("        uniform, zipf, hotspot, latest or seq. Engines other than slogger\n");
+  printf("        are used by one thread at a time.\n");
+  printf("    Ops other than scans are recorded to trace file given with -w\n\n");
+  printf("bench_lobster -x [-n <record_count>] [-k <key_len>] [-v <value_len>]\n");
+  printf("              [-c <cache_kb>] [-s <seed>] [-d <key_dist>]\n");
+  printf("    Loads the same records made by prepare_data() with the sqlite\n");
+  printf("        writer and with libsqlite3 at each page size from 512 to 65536\n");
+  printf("        and prints time taken, fsyncs, bytes written and file size\n");
+  printf("    The writer syncs its file once at the end, while libsqlite3 is in\n");
+  printf("        WAL mode with synchronous = NORMAL, syncing at checkpoints\n");
+  printf("        and not at each commit, so the two are not equally durable\n\n");
+}
+
+void set_defaults(bench_config& cfg) {
+  cfg.record_count = 1000000;
+  cfg.op_count = 1000000;
+  cfg.key_len = 24;
+  cfg.value_len = 100;
+  cfg.thread_count = 1;
+  cfg.page_size = 4096;
+  cfg.cache_kb = 64 * 1024;
+  cfg.shard_count = 8;
+  cfg.scan_len = 100;
+  cfg.seed = 1;
+  cfg.key_dist = -1;
+}
+
+// Index of name in key_dist_names, -1 if not found
+int find_key_dist(const char *name) {
+  for (int i = 0; i < (int) (sizeof(key_dist_names) / sizeof(key_dist_names[0])); i++) {
+    if (strcmp(name, key_dist_names[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Reads options given from argv[start] on, false if not valid
+bool parse_options(int argc, char *argv[], int start, bench_config& cfg) {
+  for (int i = start; i < argc; i += 2) {
+    if (i + 1 >= argc)
+      return false;
+    if (strcmp(argv[i], "-n") == 0)
+      cfg.record_count = atol(argv[i + 1]);
+    else if (strcmp(argv[i], "-o") == 0)
+      cfg.op_count = atol(argv[i + 1]);
+    else if (strcmp(argv[i], "-k") == 0)
+      cfg.key_len = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-v") == 0)
+      cfg.value_len = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-t") == 0)
+      cfg.thread_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-p") == 0)
+      cfg.page_size = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-c") == 0)
+      cfg.cache_kb = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-h") == 0)
+      cfg.shard_count = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-l") == 0)
+      cfg.scan_len = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "-s") == 0)
+      cfg.seed = atol(argv[i + 1]);
+    else if (strcmp(argv[i], "-d") == 0) {
+      cfg.key_dist = find_key_dist(argv[i + 1]);
+      if (cfg.key_dist < 0)
+        return false;
+    } else if (strcmp(argv[i], "-f") == 0)
+      cfg.trace_in = argv[i + 1];
+    else if (strcmp(argv[i], "-w") == 0)
+      cfg.trace_out = argv[i + 1];
+    else
+      return false;
+  }
+  return cfg.key_len >= 8 && cfg.key_len <= 255 && cfg.value_len >= 1 && cfg.thread_count >= 1
+      && cfg.record_count >= 1 && cfg.scan_len >= 1;
+}
+
+int main(int argc, char *argv[]) {
+
+  bench_config cfg;
+  set_defaults(cfg);
+  if (argc >= 2 && strcmp(argv[1], "-x") == 0) {
+    if (!parse_options(argc, argv, 2, cfg)) {
+      print_usage();
+      return 1;
+    }
+    return compare_with_sqlite3(cfg);
+  }
+  if (argc < 3 || !parse_options(argc, argv, 3, cfg)) {
+    print_usage();
+    return 1;
+  }
+  cfg.engine = argv[1];
+  cfg.workload = argv[2];
+  bench_run run;
+  run.cfg = &cfg;
+  run.record_count = 0;
+  run.picker = NULL;
+  run.trace_fp = NULL;
+  run.is_trace_failed = false;
+  if (!cfg.trace_out.empty()) {
+    run.trace_fp = fopen(cfg.trace_out.c_str(), "wb");
+    if (run.trace_fp == NULL) {
+      printf("Could not create trace: %s\n", cfg.trace_out.c_str());
+      return 1;
+    }
+  }
+  run.store = open_store(cfg);
+  if (run.store == NULL) {
+    print_usage();
+    return 1;
+  }
+  printf("Engine: %s, records: %ld, key len: %d, value len: %d, page size: %d, cache: %dkb, seed: %lu, keys: %s\n",
+      cfg.engine.c_str(), cfg.record_count, cfg.key_len, cfg.value_len, cfg.page_size, cfg.cache_kb, cfg.seed,
+      cfg.key_dist < 0 ? "as per workload" : key_dist_names[cfg.key_dist]);
+  run_phase(&run, NULL, cfg.record_count, "load");
+  if (cfg.key_dist >= 0)
+    run.picker = new key_picker(cfg.key_dist, cfg.record_count);
+  for (size_t i = 0; i < cfg.workload.length(); i++) {
+    if (toupper(cfg.workload[i]) == 'T') {
+      if (cfg.trace_in.empty())
+        printf("Trace file to be given with -f for workload T\n");
+      else
+        run_trace(&run);
+      continue;
+    }
+    const bench_workload *wl = NULL;
+    for (size_t j = 0; j < sizeof(workloads) / sizeof(workloads[0]); j++) {
+      if (workloads[j].name == toupper(cfg.workload[i]))
+        wl = &workloads[j];
+    }
+    if (wl == NULL) {
+      printf("Unknown workload: %c\n", cfg.workload[i]);
+      continue;
+    }
+    char label[20];
+    sprintf(label, "workload %c", wl->name);
+    run_phase(&run, wl, cfg.op_count, label);
+  }
+  delete run.picker;
+  delete run.store;
+  if (run.trace_fp != NULL && (fclose(run.trace_fp) != 0 || run.is_trace_failed)) {
+    printf("Trace incomplete: %s\n", cfg.trace_out.c_str());
+    return 1;
+  }
+
+  return 0;
+
+}
+#endif
@@ -0,0 +1,228 @@
+#ifndef BLOCKED_BLOOM_H
+#define BLOCKED_BLOOM_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#endif
+#include <stdint.h>
+#include "key_hash.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifndef BLOOM_FAILURE
+#define BLOOM_FAILURE 1
+#endif
+// Returned by check_uint8_str() when key may be present
+#define BLOCKED_BLOOM_MAYBE (BLOOM_FAILURE + 1)
+
+// Bits of each key are set within one 64 byte block so that a probe
+// reads only one cache line, tested in one go using a mask.
+#define BLOCKED_BLOOM_BLOCK_WORDS 8
+#define BLOCKED_BLOOM_BLOCK_BITS 512
+
+#define BLOCKED_BLOOM_MAGIC "BLKBLM01"
+
+// Bloom filter split into cache line sized blocks, taking the place
+// of bloom_filter with same method names. When more keys are added than
+// it was sized for, a part twice as big is added with half the false
+// positive rate of the last. The first has half of the given rate, so
+// rates of all parts add up to less than given however many there are.
+class blocked_bloom {
+    protected:
+        struct bloom_part {
+            uint64_t *blocks;
+            uint32_t block_count;
+            int hash_count;
+            long capacity;
+            long count;
+        };
+        std::vector<bloom_part> parts;
+        double fpr;
+
+        // Block number from upper half of hash, bits from lower half
+        // and a second hash, as in double hashing
+        static uint64_t *make_mask(const bloom_part& part, uint64_t h, uint64_t *mask, uint32_t& block_no) {
+            block_no = (uint32_t) (((h >> 32) * part.block_count) >> 32);
+            uint32_t h1 = (uint32_t) h;
+            uint32_t h2 = (uint32_t) key_hash::mix(h) | 1;
+            memset(mask, '\0', BLOCKED_BLOOM_BLOCK_WORDS * 8);
+            for (int i = 0; i < part.hash_count; i++) {
+                uint32_t bit = (h1 + i * h2) % BLOCKED_BLOOM_BLOCK_BITS;
+                mask[bit >> 6] |= (1ULL << (bit & 63));
+            }
+            return part.blocks + (size_t) block_no * BLOCKED_BLOOM_BLOCK_WORDS;
+        }
+
+        static bool has_all_bits(const uint64_t *block, const uint64_t *mask) {
+#if defined(__AVX2__)
+            __m256i b1 = _mm256_load_si256((const __m256i *) block);
+            __m256i b2 = _mm256_load_si256((const __m256i *) (block + 4));
+            __m256i m1 = _mm256_loadu_si256((const __m256i *) mask);
+            __m256i m2 = _mm256_loadu_si256((const __m256i *) (mask + 4));
+            return _mm256_testc_si256(b1, m1) && _mm256_testc_si256(b2, m2);
+#else
+            uint64_t missing = 0;
+            for (int i = 0; i < BLOCKED_BLOOM_BLOCK_WORDS; i++)
+                missing |= (mask[i] & ~block[i]);
+            return missing == 0;
+#endif
+        }
+
+        bool add_part(long capacity, double part_fpr) {
+            bloom_part part;
+            // blocking needs more bits per key and fewer hashes for same rate
+            double bits_per_key = -log(part_fpr) / (log(2) * log(2)) + 2;
+            double bits = bits_per_key * capacity;
+            part.block_count = (uint32_t) ceil(bits / BLOCKED_BLOOM_BLOCK_BITS);
+            if (part.block_count == 0)
+                part.block_count = 1;
+            part.hash_count = (int) round(bits_per_key * log(2) * 0.8);
+            if (part.hash_count < 1)
+                part.hash_count = 1;
+            if (part.hash_count > 16)
+                part.hash_count = 16;
+            part.capacity = capacity;
+            part.count = 0;
+            if (posix_memalign((void **) &part.blocks, 64, (size_t) part.block_count * 64))
+                return false;
+            memset(part.blocks, '\0', (size_t) part.block_count * 64);
+            parts.push_back(part);
+            return true;
+        }
+
+    public:
+        blocked_bloom() {
+            fpr = 0.01;
+        }
+
+        ~blocked_bloom() {
+            destroy();
+        }
+
+        // Sizes for given count of keys and false positive rate
+        void init(long capacity, double rate) {
+            destroy();
+            fpr = rate;
+            add_part(capacity > 1000 ? capacity : 1000, fpr / 2);
+        }
+
+        void destroy() {
+            for (size_t i = 0; i < parts.size(); i++)
+                free(parts[i].blocks);
+            parts.clear();
+        }
+
+        int add_uint8_str(const uint8_t *key, int len) {
+            if (parts.empty())
+                init(1000, fpr);
+            if (parts.back().count >= parts.back().capacity)
+                add_part(parts.back().capacity * 2, ldexp(fpr, -(int) parts.size() - 1));
+            uint64_t mask[BLOCKED_BLOOM_BLOCK_WORDS];
+            uint32_t block_no;
+            bloom_part& part = parts.back();
+            uint64_t *block = make_mask(part, key_hash::of(key, len), mask, block_no);
+            for (int i = 0; i < BLOCKED_BLOOM_BLOCK_WORDS; i++)
+                block[i] |= mask[i];
+            part.count++;
+            return 0;
+        }
+
+        // Returns BLOOM_FAILURE if key is surely not present
+        int check_uint8_str(const uint8_t *key, int len) {
+            uint64_t h = key_hash::of(key, len);
+            uint64_t mask[BLOCKED_BLOOM_BLOCK_WORDS];
+            uint32_t block_no;
+            // Newest part is biggest, so likely to have the key
+            for (int i = parts.size() - 1; i >= 0; i--) {
+                const uint64_t *block = make_mask(parts[i], h, mask, block_no);
+                if (has_all_bits(block, mask))
+                    return BLOCKED_BLOOM_MAYBE;
+            }
+            return BLOOM_FAILURE;
+        }
+
+        long get_count() {
+            long count = 0;
+            for (size_t i = 0; i < parts.size(); i++)
+                count += parts[i].count;
+            return count;
+        }
+
+        bool bf_export(const char *filename) {
+            FILE *fp = fopen(filename, "wb");
+            if (fp == NULL)
+                return false;
+            uint32_t part_count = parts.size();
+            bool is_ok = fwrite(BLOCKED_BLOOM_MAGIC, 8, 1, fp) == 1
+                    && fwrite(&fpr, sizeof(fpr), 1, fp) == 1
+                    && fwrite(&part_count, sizeof(part_count), 1, fp) == 1;
+            for (size_t i = 0; is_ok && i < parts.size(); i++) {
+                bloom_part& part = parts[i];
+                int64_t capacity = part.capacity;
+                int64_t count = part.count;
+                int32_t hash_count = part.hash_count;
+                is_ok = fwrite(&part.block_count, sizeof(part.block_count), 1, fp) == 1
+                    && fwrite(&hash_count, sizeof(hash_count), 1, fp) == 1
+                    && fwrite(&capacity, sizeof(capacity), 1, fp) == 1
+                    && fwrite(&count, sizeof(count), 1, fp) == 1
+                    && fwrite(part.blocks, 64, part.block_count, fp) == part.block_count;
+            }
+            return fclose(fp) == 0 && is_ok;
+        }
+
+        // Returns false if file is missing or not written by bf_export(),
+        // such as by the earlier bloom_filter. Caller can then rebuild it.
+        bool import(const char *filename) {
+            destroy();
+            FILE *fp = fopen(filename, "rb");
+            if (fp == NULL)
+                return false;
+            char magic[8];
+            uint32_t part_count = 0;
+            bool is_ok = fread(magic, 8, 1, fp) == 1 && memcmp(magic, BLOCKED_BLOOM_MAGIC, 8) == 0
+                    && fread(&fpr, sizeof(fpr), 1, fp) == 1
+                    && fread(&part_count, sizeof(part_count), 1, fp) == 1;
+            for (uint32_t i = 0; is_ok && i < part_count; i++) {
+                bloom_part part;
+                int64_t capacity, count;
+                int32_t hash_count;
+                is_ok = fread(&part.block_count, sizeof(part.block_count), 1, fp) == 1
+                    && fread(&hash_count, sizeof(hash_count), 1, fp) == 1
+                    && fread(&capacity, sizeof(capacity), 1, fp) == 1
+                    && fread(&count, sizeof(count), 1, fp) == 1
+                    && part.block_count > 0
+                    && posix_memalign((void **) &part.blocks, 64, (size_t) part.block_count * 64) == 0;
+                if (!is_ok)
+                    break;
+                part.hash_count = hash_count;
+                part.capacity = capacity;
+                part.count = count;
+                parts.push_back(part);
+                is_ok = fread(part.blocks, 64, part.block_count, fp) == part.block_count;
+            }
+            fclose(fp);
+            if (!is_ok)
+                destroy();
+            return is_ok;
+        }
+
+        void stats() {
+            long bytes = 0;
+            for (size_t i = 0; i < parts.size(); i++)
+                bytes += (long) parts[i].block_count * 64;
+            std::cout << "Blocked bloom: parts: " << parts.size() << ", keys: " << get_count()
+                    << ", bytes: " << bytes << ", target fpr: " << fpr << std::endl;
+            for (size_t i = 0; i < parts.size(); i++) {
+                std::cout << "  Part " << i << ": blocks: " << parts[i].block_count << ", k: " << parts[i].hash_count
+                        << ", keys: " << parts[i].count << "/" << parts[i].capacity << std::endl;
+            }
+        }
+
+};
+
+#endif
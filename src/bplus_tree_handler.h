@@ -53,6 +53,16 @@ using namespace std;
 #define DEFAULT_LEAF_BLOCK_SIZE 4096
 #endif
 
+// Where a key is or would go, as found by find_slot(), so that
+// put_at_slot() can update or insert there without descending again
+typedef struct {
+    int16_t search_result; // position if found, else ~insertion point
+    int8_t level_count;
+    uint8_t *node_paths[9];
+    const uint8_t *key; // as given to find_slot(), for refind_slot()
+    uint8_t key_len;
+} bpt_slot;
+
 template<class T> // CRTP
 class bplus_tree_handler {
 protected:
@@ -66,6 +76,7 @@ protected:
     int max_key_len;
     lru_cache *cache;
     int is_block_given;
+    int is_cache_given;
 
 public:
     uint8_t *root_block;
@@ -95,6 +106,7 @@ public:
             cache_size (cache_sz), filename (fname) {
         init_stats();
         is_block_given = block == NULL ? 0 : 1;
+        is_cache_given = 0;
         if (cache_size > 0) {
             cache = new lru_cache(leaf_block_size, cache_size, filename, 0, util::alignedAlloc);
             root_block = current_block = cache->get_disk_page_in_cache(0);
@@ -109,10 +121,23 @@ public:
         }
     }
 
+    // For trees sharing one file and cache, each rooted at its own page
+    bplus_tree_handler(uint16_t leaf_block_sz, uint16_t parent_block_sz,
+            lru_cache *shared_cache, int root_page_num) :
+            leaf_block_size (leaf_block_sz), parent_block_size (parent_block_sz),
+            cache_size (1), filename (NULL) {
+        init_stats();
+        is_block_given = 0;
+        is_cache_given = 1;
+        cache = shared_cache;
+        root_block = current_block = cache->pin_page(root_page_num);
+    }
+
     ~bplus_tree_handler() {
-        if (cache_size > 0)
-            delete cache;
-        else if (!is_block_given)
+        if (cache_size > 0) {
+            if (!is_cache_given)
+                delete cache;
+        } else if (!is_block_given)
             free(root_block);
     }
 
@@ -278,6 +303,69 @@ public:
         return NULL;
     }
 
+    // Descends once to the leaf where key is or would go and leaves
+    // current_block there. Returns true if key is found, when its
+    // value can be had from get_slot_value(). The caller may change
+    // the tree, such as by removing entries or splitting the leaf,
+    // and then call refind_slot() before put_at_slot().
+    bool find_slot(const uint8_t *key, uint8_t key_len, bpt_slot *slot) {
+        static_cast<T*>(this)->setCurrentBlockRoot();
+        this->key = (uint8_t *) key;
+        this->key_len = key_len;
+        slot->key = key;
+        slot->key_len = key_len;
+        slot->level_count = 1;
+        if (filledSize() == 0) {
+            slot->search_result = ~0;
+            return false;
+        }
+        slot->search_result = isLeaf() ?
+                static_cast<T*>(this)->searchCurrentBlock() :
+                traverseToLeaf(&slot->level_count, slot->node_paths);
+        return slot->search_result >= 0;
+    }
+
+    uint8_t *get_slot_value(bpt_slot *slot, int16_t *pValueLen) {
+        uint8_t k_len;
+        uint8_t *v = getKey(slot->search_result, &k_len) + k_len;
+        *pValueLen = *v;
+        return v + 1;
+    }
+
+    // Descends again for the key given to find_slot(), as the leaf
+    // and the path to it may not be the same after a split
+    void refind_slot(bpt_slot *slot) {
+        find_slot(slot->key, slot->key_len, slot);
+    }
+
+    // Overwrites value of key found if of same length, else inserts
+    // at slot, splitting blocks on the path as needed.
+    // Returns false if existing value is of a different length.
+    bool put_at_slot(bpt_slot *slot, const uint8_t *value, int16_t value_len) {
+        if (max_key_len < key_len)
+            max_key_len = key_len;
+        this->value = (const char *) value;
+        this->value_len = value_len;
+        if (slot->search_result >= 0) {
+            int16_t old_len;
+            uint8_t *old_value = get_slot_value(slot, &old_len);
+            if (old_len != value_len)
+                return false;
+            memcpy(old_value, value, value_len);
+            setChanged(1);
+            return true;
+        }
+        if (filledSize() == 0) {
+            static_cast<T*>(this)->addFirstData();
+            setChanged(1);
+        } else {
+            numLevels = slot->level_count;
+            recursiveUpdate(slot->search_result, slot->node_paths, slot->level_count - 1);
+        }
+        total_size++;
+        return true;
+    }
+
     void createStagingBlock(uint8_t *parent_block) {
         uint8_t *staging_block = allocateBlock(parent_block_size, 1, BPT_STAGING_LVL);
         int staging_page = cache->get_page_count() - 1;
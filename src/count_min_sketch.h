@@ -0,0 +1,83 @@
+#ifndef COUNT_MIN_SKETCH_H
+#define COUNT_MIN_SKETCH_H
+#ifndef ARDUINO
+#include <cstring>
+#include <vector>
+#endif
+#include <stdint.h>
+#include "key_hash.h"
+
+// Approximate count of times each key was added, in a few rows of
+// one byte counters, as in TinyLFU. Only counters at the least of a
+// key's counters are raised, so that keys sharing counters inflate
+// each other less. All counters are halved after decay_adds adds so
+// that counts follow recent use. Estimates never go below the count
+// of adds since the last halving.
+class count_min_sketch {
+    protected:
+        std::vector<uint8_t> counters;
+        int row_count;
+        uint32_t width_mask;
+        long adds;
+        long decay_adds;
+
+        // Counter of each row, by double hashing
+        void find_counters(const uint8_t *key, int len, uint8_t **row_counters) {
+            uint64_t h = key_hash::of(key, len);
+            uint32_t h1 = (uint32_t) h;
+            uint32_t h2 = (uint32_t) (h >> 32) | 1;
+            for (int i = 0; i < row_count; i++)
+                row_counters[i] = &counters[(size_t) i * (width_mask + 1) + ((h1 + i * h2) & width_mask)];
+        }
+
+    public:
+        // Each row has 2 ^ width_bits counters
+        count_min_sketch(int width_bits, int rows, long decay_after) {
+            row_count = rows > 8 ? 8 : rows;
+            width_mask = (1U << width_bits) - 1;
+            counters.resize((size_t) row_count << width_bits);
+            adds = 0;
+            decay_adds = decay_after;
+        }
+
+        // Returns count including this add
+        int add(const uint8_t *key, int len) {
+            uint8_t *row_counters[8];
+            find_counters(key, len, row_counters);
+            int least = 255;
+            for (int i = 0; i < row_count; i++) {
+                if (*row_counters[i] < least)
+                    least = *row_counters[i];
+            }
+            if (least < 255) {
+                for (int i = 0; i < row_count; i++) {
+                    if (*row_counters[i] == least)
+                        (*row_counters[i])++;
+                }
+                least++;
+            }
+            if (++adds >= decay_adds)
+                decay();
+            return least;
+        }
+
+        int estimate(const uint8_t *key, int len) {
+            uint8_t *row_counters[8];
+            find_counters(key, len, row_counters);
+            int least = 255;
+            for (int i = 0; i < row_count; i++) {
+                if (*row_counters[i] < least)
+                    least = *row_counters[i];
+            }
+            return least;
+        }
+
+        void decay() {
+            for (size_t i = 0; i < counters.size(); i++)
+                counters[i] >>= 1;
+            adds = 0;
+        }
+
+};
+
+#endif
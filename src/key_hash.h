@@ -0,0 +1,37 @@
+#ifndef KEY_HASH_H
+#define KEY_HASH_H
+#ifndef ARDUINO
+#include <cstring>
+#endif
+#include <stdint.h>
+
+// 64 bit hash of keys shared by filters and caches of logger
+namespace key_hash {
+
+// Finalizer of MurmurHash3, spreads bits of h over all 64 bits
+inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t of(const uint8_t *key, int len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, key, 8);
+        h = mix(h ^ w);
+        key += 8;
+        len -= 8;
+    }
+    uint64_t w = 0;
+    memcpy(&w, key, len);
+    return mix(h ^ w);
+}
+
+}
+
+#endif
@@ -2,13 +2,29 @@
 #define LOGGER_H
 
 #include <sys/stat.h>
+#include <dirent.h>
+#include <ctime>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "bfos.h"
 #include "basix.h"
 #include "sqlite.h"
-#include "bloom.hpp"
+#include "blocked_bloom.h"
+#include "tier_merger.h"
+#include "thread_pool.h"
+#include "logger_wal.h"
+#include "count_min_sketch.h"
+#include "miss_cache.h"
+#include "result_cache.h"
+#include "logger_metrics.h"
 
 //#define STAGING_BLOCK_SIZE 524288
 #define STAGING_BLOCK_SIZE 262144
@@ -16,46 +32,218 @@
 //#define STAGING_BLOCK_SIZE 32768
 #define BUCKET_BLOCK_SIZE 4096
 
-#define BUCKET_COUNT 2
+// Cold entries of a full staging block are written to idx1 or hot tiers
+// by a background thread instead of the inserting thread
+#define LOGGER_BG_DRAIN 1
+// Frozen entries are written in chunks of these many, each holding
+// tier_mutex, so that lookups wait for at most one chunk
+#define LOGGER_DRAIN_CHUNK 256
+
+// Adjacent rotated idx1 segments are merged into one in background
+// when the older one is at most this many times the size of the newer
+#define LOGGER_COMPACT_RATIO 2
+
+// idx1 is also rotated once it holds entries written over these many
+// seconds, so that each segment covers a span of time. 0 to rotate
+// only by count. This and the two below can be changed for a logger
+// with set_retention()
+#define LOGGER_SEGMENT_SECS 0
+// Rotated idx1 segments written to last more than these many seconds
+// ago are closed and their files removed, such as 30 * 86400 for 30
+// days. 0 to keep all. Only whole segments expire: entries in idx0,
+// hot tiers and idx1 are kept however old. Times are of entries being
+// drained into idx1, not of their puts, so an entry lasts a little
+// longer than this, by as long as it stayed in idx0. Segments keep
+// their numbers, so expiring one only removes its own files.
+#define LOGGER_RETENTION_SECS 0
+// Seconds between checks for segments to rotate or expire
+#define LOGGER_EXPIRE_CHECK_SECS 60
+
+// Rotated idx1 segments are probed newest first, as a key can be in
+// more than one and the newest copy is the one to return. When more
+// than one segment may have the key as per bloom filter, they are
+// probed side by side by these many threads. 0 to disable. Can be
+// set for a logger with set_probe_threads()
+#define LOGGER_PROBE_THREADS 0
+
+// Cache pages are moved between idx1, hot tiers and rotated segments
+// every these many lookups, from the one that would lose least by
+// having fewer to the one that would gain most by having more, going
+// by hits on pages evicted lately. 0 to keep sizes as configured
+#define LOGGER_TUNE_INTERVAL 65536
+// Pages moved at a time, as percent of cache size of the giving tier
+#define LOGGER_TUNE_STEP_PCT 10
+// No cache is made smaller than this many pages
+#define LOGGER_TUNE_MIN_PAGES 64
+
+// Puts are logged to <name>.wal, written and synced in groups once
+// LOGGER_WAL_GROUP_USEC microseconds pass or LOGGER_WAL_GROUP_BYTES
+// gather, and replayed into idx0 on open. 0 to disable
+#define LOGGER_WAL 1
+#define LOGGER_WAL_GROUP_USEC 2000
+#define LOGGER_WAL_GROUP_BYTES 262144
+// When 1, put() returns only once its group is synced. Otherwise
+// a crash loses at most about LOGGER_WAL_GROUP_USEC of puts
+#define LOGGER_WAL_SYNC_PUTS 0
+// All tiers are written out and the log emptied when it grows past this
+#define LOGGER_WAL_CHECKPOINT_BYTES (64L * 1024 * 1024)
+
+// Files of idx0 are marked as of this layout in <name>.ix0.fmt, as
+// entries are key length, key, value length and value with no count
+// byte in the value since counts moved to the sketch below. Files
+// left by the older layout are refused instead of misread.
+#define LOGGER_IDX0_FORMAT "LGRIX0v2"
+
+// Puts of each key are counted in a sketch of these many rows of
+// 2 ^ LOGGER_SKETCH_WIDTH_BITS counters, halved every
+// LOGGER_SKETCH_DECAY_PUTS puts. Entries with least counts leave idx0
+// first and counts decide which tier they go to.
+#define LOGGER_SKETCH_WIDTH_BITS 20
+#define LOGGER_SKETCH_ROWS 4
+#define LOGGER_SKETCH_DECAY_PUTS (4L << LOGGER_SKETCH_WIDTH_BITS)
+
+// Keys not found are remembered in 2 ^ LOGGER_MISS_CACHE_BITS buckets
+// of 8 so that looking them up again is one probe, till they are put.
+// 0 to disable
+#define LOGGER_MISS_CACHE_BITS 14
+// Values found by get() are kept in memory up to these many bytes,
+// so that lookups of hot keys need not read any page. 0 to disable.
+// Can be set for a logger with set_result_cache(). All are let go
+// when a segment expires, as some may be of keys gone with it
+#define LOGGER_RESULT_CACHE_BYTES 0
+// Seconds between snapshots of metrics written by set_metrics_file()
+#define LOGGER_METRICS_INTERVAL_SECS 10
 
 //typedef vector<basix *> cache_more;
 typedef std::vector<sqlite *> cache_more;
-typedef std::vector<bloom_filter *> cache_more_bf;
+typedef std::vector<blocked_bloom *> cache_more_bf;
+
+// Tier for entries seen more than once in idx0, apart from idx1 that
+// takes entries seen once. Cache size is in same units as for idx1.
+struct logger_tier_config {
+    std::string suffix; // such as ".ix2"
+    int block_size;
+    int cache_size;
+    int min_count;      // least count in idx0 for an entry to come here
+    long bloom_capacity; // to start with, grows as tier fills
+    double bloom_fpr;
+};
+
+// When entries were first and last drained into a segment, 0 if
+// none. Kept with each segment in a .tim file
+struct segment_times {
+    int64_t first;
+    int64_t last;
+};
+
+struct logger_tier {
+    logger_tier_config config;
+    std::string name;
+    std::string bf_name;
+    sqlite *idx;
+    blocked_bloom *bf;
+};
 
 class logger {
     protected:
       basix *idx0;
       //basix *idx1;
       sqlite *idx1;
-      bloom_filter *bf_idx1;
+      blocked_bloom *bf_idx1;
       cache_more idx1_more;
       cache_more_bf bf_idx1_more;
-#if BUCKET_COUNT == 2
-      //basix *idx2;
-      sqlite *idx2;
-      bloom_filter *bf_idx2;
-#endif
+      segment_times idx1_times;
+      // Of each segment in idx1_more, in same order
+      std::vector<segment_times> seg_times;
+      // Number in file name of each segment in idx1_more, in same
+      // order, so newest and highest first. Numbers are not reused
+      // while segments are open and gaps are left by merges and expiry
+      std::vector<size_t> seg_nos;
+      int segment_secs;
+      int retention_secs;
+      int expire_check_secs;
+      // Hottest first, that is in descending order of min_count.
+      // Looked up before idx1 in that order.
+      std::vector<logger_tier> hot_tiers;
       bool is_cache0_full;
       int cache0_size;
       int cache0_page_count;
       int cache1_size;
-      int cache2_size;
       int cache_more_size;
       long idx1_count_limit_mil;
       std::string idx1_name;
       std::string bf_idx1_name;
-      std::string bf_idx2_name;
       bool use_bloom;
 
-      int *flush_counts;
-      long no_of_inserts;
-      int zero_count;
-      long *idx_more_found_counts;
-      long *idx_more_pve_counts;
-      long *idx_more_lookup_counts;
+      logger_metrics metrics;
+      std::string metrics_file;
+      int metrics_interval_secs;
+      bool to_stop_metrics;
+      std::mutex metrics_mutex;
+      std::condition_variable metrics_cv;
+      std::thread metrics_thread;
+
+      // How often each key was put lately, in place of counting
+      // in the values kept in idx0
+      count_min_sketch *hotness;
+      miss_cache *misses;
+      result_cache *results;
+      // Bumped by compact thread as segments expire, for results to be
+      // cleared by the thread making gets before it is used again
+      std::atomic<long> expiry_count;
+      long results_expiry_count;
+      // Entries taken out of idx0 waiting to be written to idx1 or hot tiers,
+      // in key order. Lookups find them here until written.
+      // Each is preceded by its count as per hotness when taken out.
+      uint8_t *frozen_buf;
+      int frozen_buf_len;
+      std::vector<int> frozen_pos;
+      bool is_draining;
+      bool to_stop_drain;
+      // Guards idx1, hot tiers, idx1_more, their bloom filters and counters
+      // and frozen entries while being drained
+      std::mutex tier_mutex;
+      std::condition_variable drain_cv;
+#if LOGGER_BG_DRAIN == 1
+      std::thread drain_thread;
+#endif
+      bool to_stop_compact;
+      // Number of newer of the two segments being merged, 0 if none
+      size_t merging_seg_no;
+      // Keys removed from the two segments being merged, to be removed
+      // from merged segment once ready. Till then lookups skip these
+      std::set<std::string> merge_removed_keys;
+      thread_pool *probe_pool;
+      // Pages of idx1, hot tiers and segments together are kept
+      // within this by tune_cache_sizes()
+      long cache_budget;
+      long tune_interval;
+      long lookups_since_tune;
+      std::unordered_map<lru_cache *, long> tune_ghost_hits;
+      std::condition_variable compact_cv;
+      std::thread compact_thread;
+      logger_wal *wal;
+      // Guards idx0 between the thread making puts and gets and
+      // a checkpoint made by compact thread
+      std::mutex staging_mutex;
+      std::atomic<bool> is_checkpoint_asked;
 
     public:
+        // Has one hot tier, .ix2, for entries seen more than once
         logger(const char *fname, size_t cache_size_mb) {
+            int cache2_size = (cache_size_mb > 0xFFFFFFF ? (cache_size_mb >> 28) & 0x0F : (cache_size_mb & 0xFF)) * 16;
+            cache2_size *= 1024;
+            logger_tier_config tier2 = {".ix2", BUCKET_BLOCK_SIZE, cache2_size, 2, 1000000L, 0.005};
+            std::vector<logger_tier_config> tier_configs(1, tier2);
+            init(fname, cache_size_mb, tier_configs);
+        }
+
+        // Hot tiers as given, none for all entries to go to idx1
+        logger(const char *fname, size_t cache_size_mb, const std::vector<logger_tier_config>& tier_configs) {
+            init(fname, cache_size_mb, tier_configs);
+        }
+
+        void init(const char *fname, size_t cache_size_mb, const std::vector<logger_tier_config>& tier_configs) {
             use_bloom = true;
             char fname0[strlen(fname) + 5];
             char fname1[strlen(fname) + 5];
@@ -73,91 +261,208 @@ class logger {
             cache1_size *= 1024;
             cache_more_size = (cache_size_mb > 0xFFFFFF ? (cache_size_mb >> 24) & 0x0F : (cache_size_mb & 0xFF) / (cache_size_mb < 4 ? 2 : 4)) * 16;
             cache_more_size *= 1024;
+            check_staging_format(fname0);
             idx0 = new basix(STAGING_BLOCK_SIZE, STAGING_BLOCK_SIZE, cache0_size, fname0);
             //idx1 = new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache1_size, fname1);
             idx1 = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache1_size, fname1);
             if (use_bloom) {
-                bf_idx1 = new bloom_filter;
-                if (file_exists(bf_idx1_name.c_str()))
-                    bf_idx1->import(bf_idx1_name.c_str());
-                else
-                    bf_idx1->init(idx1_count_limit_mil * 1000000L, 0.005);
+                bf_idx1 = new blocked_bloom;
+                load_filter(bf_idx1, bf_idx1_name.c_str(), idx1, fname1, idx1_count_limit_mil * 1000000L);
             }
             idx1->to_demote_blocks = false;
-            bool more_files = true;
-            size_t more_count = 0;
-            while (more_files) {
-                char new_name[idx1_name.length() + 10];
-                sprintf(new_name, "%s.%lu", idx1_name.c_str(), more_count + 1);
-                char bf_new_name[bf_idx1_name.length() + 10];
-                sprintf(bf_new_name, "%s.%lu.blm", idx1_name.c_str(), idx1_more.size() + 1);
-                if (file_exists(new_name)) {
-                    //idx1_more.push_back(new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name));
-                    idx1_more.push_back(new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name));
-                    if (use_bloom) {
-                        bloom_filter *new_bf = new bloom_filter;
-                        new_bf->import(bf_new_name);
-                        bf_idx1_more.push_back(new_bf);
-                    }
-                } else {
-                    more_files = false;
-                    break;
+            idx1_times = load_times(idx1_name + ".tim", idx1_name);
+            if (idx1->size() == 0)
+                idx1_times.first = idx1_times.last = 0;
+            segment_secs = LOGGER_SEGMENT_SECS;
+            retention_secs = LOGGER_RETENTION_SECS;
+            expire_check_secs = LOGGER_EXPIRE_CHECK_SECS;
+            std::vector<size_t> found_nos = find_segment_nos();
+            for (size_t i = 0; i < found_nos.size(); i++) {
+                size_t seg_no = found_nos[i];
+                //idx1_more.push_back(new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name));
+                // Newest segment, with highest number, is kept first
+                std::string new_name = segment_name(seg_no);
+                idx1_more.insert(idx1_more.begin(), new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name.c_str()));
+                seg_nos.insert(seg_nos.begin(), seg_no);
+                seg_times.insert(seg_times.begin(), load_times(times_name(seg_no), new_name));
+                if (use_bloom) {
+                    blocked_bloom *new_bf = new blocked_bloom;
+                    load_filter(new_bf, segment_name(seg_no, true).c_str(), idx1_more[0], new_name.c_str(), 0);
+                    bf_idx1_more.insert(bf_idx1_more.begin(), new_bf);
                 }
-                more_count++;
             }
             std::cout << "Stg buf: " << cache0_size << "mb, Idx1 buf: " << cache1_size << "mb, Idx1+ buf: " << cache_more_size << "mb" << std::endl;
-            std::cout << "Idx1 entry count limit: " << idx1_count_limit_mil << " million";
-#if BUCKET_COUNT == 2
-            char fname2[strlen(fname) + 5];
-            strcpy(fname2, fname);
-            strcat(fname2, ".ix2");
-            bf_idx2_name = fname2;
-            bf_idx2_name += ".blm";
-            if (use_bloom) {
-                bf_idx2 = new bloom_filter;
-                if (file_exists(bf_idx2_name.c_str()))
-                    bf_idx2->import(bf_idx2_name.c_str());
-                else
-                    bf_idx2->init(30000000L, 0.005);
+            std::cout << "Idx1 entry count limit: " << idx1_count_limit_mil << " million" << std::endl;
+            for (size_t i = 0; i < tier_configs.size(); i++) {
+                logger_tier tier;
+                tier.config = tier_configs[i];
+                tier.name = fname;
+                tier.name += tier.config.suffix;
+                tier.bf_name = tier.name + ".blm";
+                tier.idx = new sqlite(2, 1, "key, value", "imain", tier.config.block_size, tier.config.block_size,
+                                tier.config.cache_size, tier.name.c_str());
+                tier.bf = NULL;
+                if (use_bloom) {
+                    tier.bf = new blocked_bloom;
+                    load_filter(tier.bf, tier.bf_name.c_str(), tier.idx, tier.name.c_str(), tier.config.bloom_capacity);
+                }
+                std::cout << "Tier " << tier.name << " buf: " << tier.config.cache_size << "mb, min count: " << tier.config.min_count << std::endl;
+                hot_tiers.push_back(tier);
             }
-            cache2_size = (cache_size_mb > 0xFFFFFFF ? (cache_size_mb >> 28) & 0x0F : (cache_size_mb & 0xFF)) * 16;
-            cache2_size *= 1024;
-            std::cout << ", Idx2 buf: " << cache2_size << "mb" << std::endl;
-            //idx2 = new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache2_size, fname2);
-            idx2 = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache2_size, fname2);
-#else
-            cout << endl;
-#endif
+            std::stable_sort(hot_tiers.begin(), hot_tiers.end(), [](const logger_tier& t1, const logger_tier& t2) {
+                return t1.config.min_count > t2.config.min_count;
+            });
             is_cache0_full = false;
             cache0_page_count = cache0_size * 1024 * 1024 / STAGING_BLOCK_SIZE;
-            flush_counts = new int[cache0_page_count];
-            memset(flush_counts, '\0', sizeof(int) * cache0_page_count);
-            idx_more_found_counts = new long[50];
-            idx_more_pve_counts = new long[50];
-            idx_more_lookup_counts = new long[50];
-            memset(idx_more_found_counts, '\0', sizeof(long) * 50);
-            memset(idx_more_pve_counts, '\0', sizeof(long) * 50);
-            memset(idx_more_lookup_counts, '\0', sizeof(long) * 50);
-            no_of_inserts = 0;
-            zero_count = cache0_page_count;
+            metrics.tier_count = std::min(hot_tiers.size() + 1 + idx1_more.size(), (size_t) LOGGER_METRICS_MAX_TIERS);
+            to_stop_metrics = false;
+            metrics_interval_secs = LOGGER_METRICS_INTERVAL_SECS;
+            cache_budget = cache1_size + cache_more_size * (idx1_more.empty() ? 1 : idx1_more.size());
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                cache_budget += hot_tiers[i].config.cache_size;
+            tune_interval = LOGGER_TUNE_INTERVAL;
+            lookups_since_tune = 0;
+            probe_pool = (LOGGER_PROBE_THREADS > 0 ? new thread_pool(LOGGER_PROBE_THREADS) : NULL);
+            hotness = new count_min_sketch(LOGGER_SKETCH_WIDTH_BITS, LOGGER_SKETCH_ROWS, LOGGER_SKETCH_DECAY_PUTS);
+            misses = (LOGGER_MISS_CACHE_BITS > 0 ? new miss_cache(LOGGER_MISS_CACHE_BITS) : NULL);
+            results = (LOGGER_RESULT_CACHE_BYTES > 0 ? new result_cache(LOGGER_RESULT_CACHE_BYTES) : NULL);
+            expiry_count = 0;
+            results_expiry_count = 0;
+            frozen_buf = new uint8_t[STAGING_BLOCK_SIZE];
+            frozen_buf_len = 0;
+            is_draining = false;
+            to_stop_drain = false;
+#if LOGGER_BG_DRAIN == 1
+            drain_thread = std::thread(&logger::drain_worker, this);
+#endif
+            remove(segment_name(0).c_str()); // left by unfinished merge
+            remove(segment_name(0, true).c_str());
+            remove(times_name(0).c_str());
+            to_stop_compact = false;
+            is_checkpoint_asked = false;
+            merging_seg_no = 0;
+            compact_thread = std::thread(&logger::compact_worker, this);
+            wal = NULL;
+#if LOGGER_WAL == 1
+            std::string wal_name = fname;
+            wal_name += ".wal";
+            open_wal(wal_name.c_str());
+#endif
+        }
+
+        // Puts entries logged before a crash into idx0 again and writes
+        // out all tiers, after which the log can start afresh
+        void open_wal(const char *wal_name) {
+            logger_wal *log = new logger_wal(wal_name, LOGGER_WAL_GROUP_USEC, LOGGER_WAL_GROUP_BYTES);
+            long count = log->replay([this](const uint8_t *k, int k_len, const uint8_t *v, int v_len, bool is_tombstone) {
+                put_entry(k, k_len, v, v_len, is_tombstone);
+            });
+            wal = log;
+            if (count > 0) {
+                std::cout << "Replayed " << count << " entries from " << wal_name << std::endl;
+                checkpoint();
+            }
+        }
+
+        // Writes out and syncs idx0 and all tiers so that puts logged
+        // so far need not be kept. Made by compact thread once the log
+        // grows past LOGGER_WAL_CHECKPOINT_BYTES, and on open and close.
+        // Tiers are synced once before puts are held up, so that what
+        // is left to write while they wait is mostly idx0.
+        void checkpoint() {
+            {
+                std::lock_guard<std::mutex> lock(tier_mutex);
+                sync_tiers();
+            }
+            std::lock_guard<std::mutex> staging_lock(staging_mutex);
+            wait_for_drain();
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            idx0->cache->flush_all();
+            idx0->cache->sync_file();
+            sync_tiers();
+            wal->truncate();
+            is_checkpoint_asked = false;
+            metrics.checkpoints++;
+            publish_staging_stats();
+            publish_tier_stats();
+        }
+
+        // Writes out and syncs idx1, hot tiers and segments.
+        // Caller holds tier_mutex
+        void sync_tiers() {
+            idx1->flush();
+            idx1->cache->sync_file();
+            save_times(idx1_name + ".tim", idx1_times);
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                hot_tiers[i].idx->flush();
+                hot_tiers[i].idx->cache->sync_file();
+            }
+            for (size_t pos = 0; pos < idx1_more.size(); pos++) {
+                idx1_more[pos]->flush();
+                idx1_more[pos]->cache->sync_file();
+            }
+        }
+
+        // Has compact thread make a checkpoint, so that the put that
+        // finds the log past LOGGER_WAL_CHECKPOINT_BYTES does not
+        void ask_checkpoint() {
+            if (is_checkpoint_asked.exchange(true))
+                return;
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            compact_cv.notify_all();
+        }
+
+        // Waits till puts made so far are on disk in the log
+        void sync_wal() {
+            if (wal != NULL)
+                wal->sync();
         }
 
         ~logger() {
+            stop_metrics_file();
+            // stopped first as it may be making a checkpoint
+            {
+                std::unique_lock<std::mutex> lock(tier_mutex);
+                to_stop_compact = true;
+            }
+            compact_cv.notify_all();
+            compact_thread.join();
+            if (wal != NULL) {
+                checkpoint();
+                delete wal;
+            }
+#if LOGGER_BG_DRAIN == 1
+            {
+                std::unique_lock<std::mutex> lock(tier_mutex);
+                to_stop_drain = true;
+            }
+            drain_cv.notify_all();
+            drain_thread.join();
+#endif
+            if (probe_pool != NULL)
+                delete probe_pool;
+            delete [] frozen_buf;
+            delete hotness;
+            if (misses != NULL)
+                delete misses;
+            if (results != NULL)
+                delete results;
             delete idx0;
             delete idx1;
+            save_times(idx1_name + ".tim", idx1_times);
             if (use_bloom) {
                 bf_idx1->bf_export(bf_idx1_name.c_str());
                 bf_idx1->destroy();
                 delete bf_idx1;
             }
-#if BUCKET_COUNT == 2
-            delete idx2;
-            if (use_bloom) {
-                bf_idx2->bf_export(bf_idx2_name.c_str());
-                bf_idx2->destroy();
-                delete bf_idx2;
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                delete hot_tiers[i].idx;
+                if (use_bloom) {
+                    hot_tiers[i].bf->bf_export(hot_tiers[i].bf_name.c_str());
+                    hot_tiers[i].bf->destroy();
+                    delete hot_tiers[i].bf;
+                }
             }
-#endif
             for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++)
                 delete *it;
             if (use_bloom) {
@@ -166,10 +471,136 @@ class logger {
                     delete *it;
                 }
             }
-            delete flush_counts;
-            delete idx_more_found_counts;
-            delete idx_more_pve_counts;
-            delete idx_more_lookup_counts;
+        }
+
+        // Counters are kept for hot tiers, then idx1, then segments,
+        // those past LOGGER_METRICS_MAX_TIERS together in the last slot
+        int tier_stat_idx(int tier_no) {
+            return logger_metrics::slot_of(tier_no);
+        }
+
+        int seg_stat_idx(int pos) {
+            return tier_stat_idx(hot_tiers.size() + 1 + pos);
+        }
+
+        // Counters can be read from any thread without locks. Those of
+        // caches are as of the last freeze, drain or checkpoint.
+        logger_metrics& get_metrics() {
+            return metrics;
+        }
+
+        // Writes metrics as name{tier="..."} value lines. Per tier
+        // counters move along as segments rotate, merge and expire, all
+        // under tier_mutex, so it is held while they are written along
+        // with names of the tiers they are of.
+        void write_metrics(std::ostream& out) {
+            std::ostringstream metrics_out;
+            {
+                std::lock_guard<std::mutex> lock(tier_mutex);
+                int tier_count = metrics.tier_count;
+                int seg_start = hot_tiers.size() + 1;
+                std::vector<std::string> names(tier_count);
+                for (int i = 0; i < tier_count; i++) {
+                    if (i < (int) hot_tiers.size())
+                        names[i] = hot_tiers[i].config.suffix;
+                    else if (i == (int) hot_tiers.size())
+                        names[i] = "idx1";
+                    else
+                        names[i] = "idx1." + std::to_string(seg_nos[i - seg_start]);
+                }
+                // last slot counts the tiers after it too
+                int last = tier_count - 1;
+                if (last >= 0 && seg_start + seg_nos.size() > (size_t) tier_count) {
+                    if (last >= seg_start)
+                        names[last] = "idx1." + std::to_string(seg_nos.back()) + "-" + std::to_string(seg_nos[last - seg_start]);
+                    else
+                        names[last] += "+";
+                }
+                std::vector<const char *> name_ptrs(tier_count);
+                for (int i = 0; i < tier_count; i++)
+                    name_ptrs[i] = names[i].c_str();
+                metrics.write(metrics_out, name_ptrs.data());
+            }
+            out << metrics_out.str();
+            if (wal != NULL) {
+                out << "logger_wal_bytes_written " << wal->get_bytes_written() << "\n";
+                out << "logger_wal_syncs " << wal->get_sync_count() << "\n";
+            }
+        }
+
+        // Writes metrics to given file every interval_secs, through a
+        // temporary file renamed over it so readers see a whole snapshot
+        void set_metrics_file(const char *filename, int interval_secs) {
+            stop_metrics_file();
+            metrics_file = filename;
+            metrics_interval_secs = (interval_secs > 0 ? interval_secs : LOGGER_METRICS_INTERVAL_SECS);
+            to_stop_metrics = false;
+            metrics_thread = std::thread(&logger::metrics_worker, this);
+        }
+
+        void stop_metrics_file() {
+            if (!metrics_thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(metrics_mutex);
+                to_stop_metrics = true;
+            }
+            metrics_cv.notify_all();
+            metrics_thread.join();
+        }
+
+        void metrics_worker() {
+            std::unique_lock<std::mutex> lock(metrics_mutex);
+            while (true) {
+                metrics_cv.wait_for(lock, std::chrono::seconds(metrics_interval_secs), [this] {
+                    return to_stop_metrics;
+                });
+                write_metrics_file();
+                if (to_stop_metrics)
+                    return;
+            }
+        }
+
+        void write_metrics_file() {
+            std::string tmp_name = metrics_file + ".tmp";
+            std::ofstream out(tmp_name.c_str(), std::ios::trunc);
+            if (!out) {
+                std::cout << "Error writing metrics file: " << tmp_name << std::endl;
+                return;
+            }
+            write_metrics(out);
+            out.close();
+            if (rename(tmp_name.c_str(), metrics_file.c_str()))
+                std::cout << "Error renaming file from: " << tmp_name << " to: " << metrics_file << std::endl;
+        }
+
+        // Counters of idx0 cache, from the thread making puts
+        void publish_staging_stats() {
+            cache_stats cs = idx0->cache->get_cache_stats();
+            metrics.staging_flushes = cs.cache_flush_count;
+            metrics.staging_pages_read = cs.pages_read;
+            metrics.staging_bytes_written = cs.pages_written * idx0->cache->get_page_size();
+        }
+
+        // Counters of caches of idx1, hot tiers and segments, caller holds tier_mutex
+        void publish_tier_stats() {
+            std::vector<lru_cache *> caches(1, idx1->cache);
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                caches.push_back(hot_tiers[i].idx->cache);
+            for (size_t pos = 0; pos < idx1_more.size(); pos++)
+                caches.push_back(idx1_more[pos]->cache);
+            long flushes = 0;
+            long pages_read = 0;
+            long bytes_written = 0;
+            for (size_t i = 0; i < caches.size(); i++) {
+                cache_stats cs = caches[i]->get_cache_stats();
+                flushes += cs.cache_flush_count;
+                pages_read += cs.pages_read;
+                bytes_written += cs.pages_written * caches[i]->get_page_size();
+            }
+            metrics.tier_flushes = flushes;
+            metrics.tier_pages_read = pages_read;
+            metrics.tier_bytes_written = bytes_written;
         }
 
         bool file_exists (const char *filename) {
@@ -177,45 +608,428 @@ class logger {
           return (stat (filename, &buffer) == 0);
         }
 
+        // True if idx1 has entries written over segment_secs
+        bool is_idx1_span_over(int64_t now) {
+            return segment_secs > 0 && idx1_times.first > 0
+                    && now - idx1_times.first >= segment_secs && idx1->size() > 0;
+        }
+
+        // Notes entries being written to idx1 now
+        void mark_idx1_time(int64_t now) {
+            if (idx1_times.first == 0)
+                idx1_times.first = now;
+            idx1_times.last = now;
+        }
+
+        // Rotates idx1 to a new segment once it has too many entries
+        // or covers segment_secs. It is numbered one past the newest.
+        // Caller holds tier_mutex
         void spawn_more_idx1_if_full() {
-            if (cache_more_size > 0 && idx1->size() >= idx1_count_limit_mil * 1000000L) {
+            if (cache_more_size > 0 && (idx1->size() >= idx1_count_limit_mil * 1000000L || is_idx1_span_over(time(NULL)))) {
                 delete idx1;
                 if (use_bloom) {
                     bf_idx1->bf_export(bf_idx1_name.c_str());
                 }
-                char new_name[idx1_name.length() + 10];
-                sprintf(new_name, "%s.%lu", idx1_name.c_str(), idx1_more.size() + 1);
-                char bf_new_name[bf_idx1_name.length() + 10];
-                sprintf(bf_new_name, "%s.%lu.blm", idx1_name.c_str(), idx1_more.size() + 1);
-                if (rename(idx1_name.c_str(), new_name))
+                size_t seg_no = (seg_nos.empty() ? 1 : seg_nos[0] + 1);
+                std::string new_name = segment_name(seg_no);
+                std::string bf_new_name = segment_name(seg_no, true);
+                if (rename(idx1_name.c_str(), new_name.c_str()))
                     std::cout << "Error renaming file from: " << idx1_name << " to: " << new_name << std::endl;
                 else {
-                    if (use_bloom && rename(bf_idx1_name.c_str(), bf_new_name))
+                    if (use_bloom && rename(bf_idx1_name.c_str(), bf_new_name.c_str()))
                         std::cout << "Error renaming file from: " << bf_idx1_name << " to: " << bf_new_name << std::endl;
                     else {
                         //idx1_more.insert(idx1_more.begin(), new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name));
                         //idx1 = new basix(BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache1_size, idx1_name.c_str());
-                        idx1_more.insert(idx1_more.begin(), new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name));
+                        save_times(times_name(seg_no), idx1_times);
+                        remove((idx1_name + ".tim").c_str());
+                        idx1_more.insert(idx1_more.begin(), new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, new_name.c_str()));
                         idx1 = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache1_size, idx1_name.c_str());
+                        seg_nos.insert(seg_nos.begin(), seg_no);
+                        seg_times.insert(seg_times.begin(), idx1_times);
+                        idx1_times.first = idx1_times.last = 0;
                         if (use_bloom) {
                             bf_idx1_more.insert(bf_idx1_more.begin(), bf_idx1);
-                            bf_idx1 = new bloom_filter;
+                            bf_idx1 = new blocked_bloom;
                             bf_idx1->init(idx1_count_limit_mil * 1000000L, 0.005);
-                            int count = idx1_more.size();
-                            while (count--) {
-                                idx_more_found_counts[count + BUCKET_COUNT] = idx_more_found_counts[count + BUCKET_COUNT - 1];
-                                idx_more_pve_counts[count + BUCKET_COUNT] = idx_more_pve_counts[count + BUCKET_COUNT - 1];
-                                idx_more_lookup_counts[count + BUCKET_COUNT] = idx_more_lookup_counts[count + BUCKET_COUNT - 1];
-                            }
-                            idx_more_found_counts[BUCKET_COUNT - 1] = 0;
-                            idx_more_pve_counts[BUCKET_COUNT - 1] = 0;
-                            idx_more_lookup_counts[BUCKET_COUNT - 1] = 0;
                         }
+                        metrics.insert_tier(hot_tiers.size());
+                        metrics.rotations++;
+                        compact_cv.notify_all();
                     }
                 }
             }
         }
 
+        // Loads filter saved earlier, else builds it from keys of the tree,
+        // as for files saved by the earlier bloom_filter
+        void load_filter(blocked_bloom *bf, const char *bf_name, sqlite *idx, const char *idx_name, long capacity) {
+            if (bf->import(bf_name))
+                return;
+            long count = idx->size();
+            bf->init(count > capacity ? count : capacity, 0.005);
+            if (count == 0)
+                return;
+            std::cout << "Building bloom filter " << bf_name << " from " << count << " keys" << std::endl;
+            idx->flush();
+            sqlite_cursor cursor(idx_name);
+            while (cursor.next()) {
+                int key_len;
+                const uint8_t *key = cursor.get_key(key_len);
+                bf->add_uint8_str(key, key_len);
+            }
+        }
+
+        // Name of rotated idx1 segment or its bloom filter.
+        // Segment 0 is the one being formed by merging two others
+        std::string segment_name(size_t seg_no, bool is_bloom = false) {
+            char name[idx1_name.length() + 20];
+            if (seg_no == 0)
+                sprintf(name, "%s.cmp%s", idx1_name.c_str(), is_bloom ? ".blm" : "");
+            else
+                sprintf(name, "%s.%lu%s", idx1_name.c_str(), seg_no, is_bloom ? ".blm" : "");
+            return name;
+        }
+
+        std::string times_name(size_t seg_no) {
+            return segment_name(seg_no) + ".tim";
+        }
+
+        // Numbers of segment files found beside idx1, lowest first.
+        // Found by listing the directory as there can be gaps
+        std::vector<size_t> find_segment_nos() {
+            std::string dir_name = ".";
+            std::string prefix = idx1_name + ".";
+            size_t slash = idx1_name.rfind('/');
+            if (slash != std::string::npos) {
+                dir_name = (slash == 0 ? "/" : idx1_name.substr(0, slash));
+                prefix = idx1_name.substr(slash + 1) + ".";
+            }
+            std::vector<size_t> nos;
+            DIR *dir = opendir(dir_name.c_str());
+            if (dir == NULL)
+                return nos;
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                const char *name = entry->d_name;
+                if (strncmp(name, prefix.c_str(), prefix.length()))
+                    continue;
+                const char *num = name + prefix.length();
+                // not .blm, .tim or .cmp of a merge
+                if (*num < '1' || *num > '9' || strspn(num, "0123456789") != strlen(num))
+                    continue;
+                nos.push_back(strtoul(num, NULL, 10));
+            }
+            closedir(dir);
+            std::sort(nos.begin(), nos.end());
+            return nos;
+        }
+
+        // Probes segments side by side with given threads, as
+        // LOGGER_PROBE_THREADS does for all loggers, 0 for none
+        void set_probe_threads(int thread_count) {
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            if (probe_pool != NULL)
+                delete probe_pool;
+            probe_pool = (thread_count > 0 ? new thread_pool(thread_count) : NULL);
+        }
+
+        // Moves cache pages every given lookups, as LOGGER_TUNE_INTERVAL
+        // does for all loggers, 0 to keep sizes as they are
+        void set_tune_interval(long lookups) {
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            tune_interval = lookups;
+            lookups_since_tune = 0;
+        }
+
+        // Pages of cache of each hot tier, idx1 and each segment, newest
+        // first, as last set by tune_cache_sizes()
+        std::vector<int> get_cache_sizes() {
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            std::vector<int> sizes;
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                sizes.push_back(hot_tiers[i].config.cache_size);
+            sizes.push_back(cache1_size);
+            sizes.resize(sizes.size() + idx1_more.size(), cache_more_size);
+            return sizes;
+        }
+
+        long get_cache_budget() {
+            return cache_budget;
+        }
+
+        // Keeps values found by get() within given bytes, as
+        // LOGGER_RESULT_CACHE_BYTES does for all loggers, 0 for none.
+        // From the thread making puts and gets
+        void set_result_cache(long bytes) {
+            if (results != NULL)
+                delete results;
+            results = (bytes > 0 ? new result_cache(bytes) : NULL);
+        }
+
+        // Clears results if segments expired since it was last used, as
+        // they may hold values that are gone. From the thread making gets
+        void check_results_expiry() {
+            long count = expiry_count;
+            if (count == results_expiry_count)
+                return;
+            results->clear();
+            results_expiry_count = count;
+        }
+
+        // Rotates idx1 every seg_secs, expires segments last drained
+        // into retain_secs ago and checks for either every check_secs,
+        // as LOGGER_SEGMENT_SECS, LOGGER_RETENTION_SECS and
+        // LOGGER_EXPIRE_CHECK_SECS do for all loggers
+        void set_retention(int seg_secs, int retain_secs, int check_secs) {
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            segment_secs = seg_secs;
+            retention_secs = retain_secs;
+            expire_check_secs = (check_secs > 0 ? check_secs : LOGGER_EXPIRE_CHECK_SECS);
+            compact_cv.notify_all();
+        }
+
+        // Throws EINVAL if idx0 file has pages but is not marked as of
+        // LOGGER_IDX0_FORMAT, else marks it so
+        static void check_staging_format(const char *fname0) {
+            std::string fmt_name = std::string(fname0) + ".fmt";
+            char fmt[sizeof(LOGGER_IDX0_FORMAT)] = "";
+            FILE *fp = fopen(fmt_name.c_str(), "rb");
+            if (fp != NULL) {
+                size_t len = fread(fmt, 1, sizeof(fmt) - 1, fp);
+                fmt[len] = 0;
+                fclose(fp);
+            }
+            if (strcmp(fmt, LOGGER_IDX0_FORMAT) == 0)
+                return;
+            struct stat file_stat;
+            if (stat(fname0, &file_stat) == 0 && file_stat.st_size > 0) {
+                std::cout << "Staging file " << fname0 << " not of format " << LOGGER_IDX0_FORMAT << std::endl;
+                throw EINVAL;
+            }
+            fp = fopen(fmt_name.c_str(), "wb");
+            if (fp == NULL)
+                throw errno;
+            bool is_written = (fwrite(LOGGER_IDX0_FORMAT, 1, sizeof(fmt) - 1, fp) == sizeof(fmt) - 1);
+            if (fclose(fp) || !is_written)
+                throw EIO;
+        }
+
+        // Reads times saved with a segment. For files from before times
+        // were kept, both are taken as when the file was last changed
+        static segment_times load_times(const std::string& filename, const std::string& idx_name) {
+            segment_times times = {0, 0};
+            FILE *fp = fopen(filename.c_str(), "rb");
+            if (fp != NULL) {
+                int64_t vals[2];
+                if (fread(vals, sizeof(int64_t), 2, fp) == 2) {
+                    times.first = vals[0];
+                    times.last = vals[1];
+                }
+                fclose(fp);
+                return times;
+            }
+            struct stat file_stat;
+            if (stat(idx_name.c_str(), &file_stat) == 0)
+                times.first = times.last = file_stat.st_mtime;
+            return times;
+        }
+
+        static void save_times(const std::string& filename, const segment_times& times) {
+            FILE *fp = fopen(filename.c_str(), "wb");
+            if (fp == NULL) {
+                std::cout << "Error writing times to: " << filename << std::endl;
+                return;
+            }
+            int64_t vals[2] = {times.first, times.last};
+            if (fwrite(vals, sizeof(int64_t), 2, fp) != 2)
+                std::cout << "Error writing times to: " << filename << std::endl;
+            fclose(fp);
+        }
+
+        // Closes and removes files of segments last drained into more
+        // than retention_secs ago, oldest first. Hot tiers and idx1 are
+        // not expired, idx1 only once rotated. Other segments keep their
+        // numbers, so nothing is renamed. Files of a segment go last,
+        // so that if stopped midway, the segment is still whole and
+        // found on open. Not to be called during a merge. Caller
+        // holds tier_mutex
+        void expire_segments() {
+            int64_t now = time(NULL);
+            if (is_idx1_span_over(now))
+                spawn_more_idx1_if_full();
+            if (retention_secs <= 0)
+                return;
+            while (!idx1_more.empty()) {
+                size_t pos = idx1_more.size() - 1;
+                if (seg_times[pos].last == 0 || now - seg_times[pos].last < retention_secs)
+                    break;
+                size_t seg_no = seg_nos[pos];
+                delete idx1_more[pos];
+                remove(times_name(seg_no).c_str());
+                if (use_bloom) {
+                    bf_idx1_more[pos]->destroy();
+                    delete bf_idx1_more[pos];
+                    bf_idx1_more.pop_back();
+                    remove(segment_name(seg_no, true).c_str());
+                }
+                remove(segment_name(seg_no).c_str());
+                idx1_more.pop_back();
+                seg_nos.pop_back();
+                seg_times.pop_back();
+                metrics.remove_tier(seg_stat_idx(pos));
+                metrics.expired_segments++;
+                expiry_count++;
+                std::cout << "Expired idx1 segment " << seg_no << ", " << idx1_more.size() << " left" << std::endl;
+            }
+        }
+
+        static long file_size(const std::string& filename) {
+            struct stat file_stat;
+            return stat(filename.c_str(), &file_stat) ? 0 : file_stat.st_size;
+        }
+
+        // Picks the smallest adjacent pair of segments of similar size
+        // Returns number of newer one, 0 if none. Caller holds tier_mutex
+        size_t pick_segments_to_merge() {
+            size_t best_seg_no = 0;
+            long best_size = 0;
+            // oldest pair first, pos - 1 being the newer of each
+            for (size_t pos = idx1_more.size(); pos-- > 1; ) {
+                long newer_size = file_size(segment_name(seg_nos[pos - 1]));
+                long older_size = file_size(segment_name(seg_nos[pos]));
+                if (older_size > newer_size * LOGGER_COMPACT_RATIO)
+                    continue;
+                // merged segment would expire only when the newer one does
+                if (segment_secs > 0 && seg_times[pos - 1].last - seg_times[pos].first > segment_secs)
+                    continue;
+                if (best_seg_no == 0 || newer_size + older_size < best_size) {
+                    best_seg_no = seg_nos[pos - 1];
+                    best_size = newer_size + older_size;
+                }
+            }
+            return best_seg_no;
+        }
+
+        // Position of segment of given number in idx1_more
+        size_t segment_pos(size_t seg_no) {
+            return std::find(seg_nos.begin(), seg_nos.end(), seg_no) - seg_nos.begin();
+        }
+
+        // Merges segment of given number with the older one next to it
+        // into a new file, keeping only the newer value of keys in both.
+        // Lookups continue on the two till the merged one replaces them.
+        // It takes the number of the older one and is put in place before
+        // files of the newer are removed, so that if stopped midway the
+        // newer one is found on open along with the merged one.
+        void merge_segments(size_t newer_no, size_t older_no, long entry_count) {
+            std::string merged_name = segment_name(0);
+            sqlite *merged = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE, cache_more_size, merged_name.c_str());
+            blocked_bloom *merged_bf = NULL;
+            if (use_bloom) {
+                merged_bf = new blocked_bloom;
+                merged_bf->init(entry_count > 1000 ? entry_count : 1000, 0.005);
+            }
+            tier_merger segments;
+            segments.add_cursor(new sqlite_tier_cursor(segment_name(newer_no).c_str()));
+            segments.add_cursor(new sqlite_tier_cursor(segment_name(older_no).c_str()));
+            std::unique_lock<std::mutex> lock(tier_mutex);
+            // nothing older for tombstones to hide when merging oldest
+            segments.set_skip_deleted(seg_nos.back() == older_no);
+            lock.unlock();
+            while (segments.next()) {
+                int rec_len, key_len;
+                const uint8_t *rec = ((sqlite_tier_cursor *) segments.get_cursor())->get_rec(rec_len);
+                const uint8_t *key = segments.get_key(key_len);
+                merged->put(rec, -rec_len, NULL, 0);
+                if (use_bloom)
+                    merged_bf->add_uint8_str(key, key_len);
+            }
+            delete merged;
+            if (use_bloom)
+                merged_bf->bf_export(segment_name(0, true).c_str());
+            lock.lock();
+            // Segments rotated in meanwhile are ahead in the list
+            size_t pos = segment_pos(newer_no);
+            delete idx1_more[pos];
+            delete idx1_more[pos + 1];
+            segment_times merged_times = seg_times[pos + 1];
+            if (seg_times[pos].first > 0 && (merged_times.first == 0 || seg_times[pos].first < merged_times.first))
+                merged_times.first = seg_times[pos].first;
+            if (seg_times[pos].last > merged_times.last)
+                merged_times.last = seg_times[pos].last;
+            // filter and times of merged one cover the older one's keys
+            // and times, so they go in place before the segment itself
+            if (use_bloom)
+                rename(segment_name(0, true).c_str(), segment_name(older_no, true).c_str());
+            save_times(times_name(older_no), merged_times);
+            rename(merged_name.c_str(), segment_name(older_no).c_str());
+            remove(times_name(newer_no).c_str());
+            if (use_bloom)
+                remove(segment_name(newer_no, true).c_str());
+            remove(segment_name(newer_no).c_str());
+            seg_times.erase(seg_times.begin() + pos);
+            seg_times[pos] = merged_times;
+            seg_nos.erase(seg_nos.begin() + pos);
+            if (use_bloom) {
+                bf_idx1_more[pos]->destroy();
+                delete bf_idx1_more[pos];
+                bf_idx1_more[pos + 1]->destroy();
+                delete bf_idx1_more[pos + 1];
+                bf_idx1_more.erase(bf_idx1_more.begin() + pos);
+                bf_idx1_more[pos] = merged_bf;
+            }
+            idx1_more.erase(idx1_more.begin() + pos);
+            idx1_more[pos] = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE,
+                    cache_more_size, segment_name(older_no).c_str());
+            merging_seg_no = 0;
+            for (std::set<std::string>::iterator it = merge_removed_keys.begin(); it != merge_removed_keys.end(); it++) {
+                int val_len;
+                if (idx1_more[pos]->get((const uint8_t *) it->data(), it->length(), &val_len))
+                    idx1_more[pos]->remove_found_entry();
+            }
+            merge_removed_keys.clear();
+            metrics.merge_tier(seg_stat_idx(pos));
+            metrics.merges++;
+            std::cout << "Merged idx1 segments " << older_no << " and " << newer_no << std::endl;
+        }
+
+        void compact_worker() {
+            std::unique_lock<std::mutex> lock(tier_mutex);
+            while (!to_stop_compact) {
+                if (is_checkpoint_asked) {
+                    lock.unlock();
+                    checkpoint();
+                    lock.lock();
+                    continue;
+                }
+                if (segment_secs > 0 || retention_secs > 0)
+                    expire_segments();
+                size_t newer_no = pick_segments_to_merge();
+                if (newer_no == 0) {
+                    if (segment_secs > 0 || retention_secs > 0)
+                        compact_cv.wait_for(lock, std::chrono::seconds(expire_check_secs));
+                    else
+                        compact_cv.wait(lock);
+                    continue;
+                }
+                size_t pos = segment_pos(newer_no);
+                size_t older_no = seg_nos[pos + 1];
+                long entry_count = idx1_more[pos]->size() + idx1_more[pos + 1]->size();
+                // Reopen so that pages changed by removals are on disk
+                // for the merge to read. No removals till merge is done
+                for (size_t i = pos; i <= pos + 1; i++) {
+                    delete idx1_more[i];
+                    idx1_more[i] = new sqlite(2, 1, "key, value", "imain", BUCKET_BLOCK_SIZE, BUCKET_BLOCK_SIZE,
+                            cache_more_size, segment_name(seg_nos[i]).c_str());
+                }
+                merging_seg_no = newer_no;
+                lock.unlock();
+                merge_segments(newer_no, older_no, entry_count);
+                lock.lock();
+            }
+        }
+
         void remove_entry_from_more_idxs(const uint8_t *key, uint8_t key_len) {
             uint8_t *val;
             int val_len;
@@ -227,7 +1041,10 @@ class logger {
                     //cout << it-idx1_more.begin() << " ";
                     //cout << "Found in idx_more" << it-idx1_more.begin() << endl;
                     if ((*it)->get(key, key_len, &val_len)) {
-                        (*it)->remove_found_entry();
+                        if (is_being_merged(it - idx1_more.begin()))
+                            merge_removed_keys.insert(std::string((const char *) key, key_len));
+                        else
+                            (*it)->remove_found_entry();
                         return;
                     }
                 }
@@ -251,135 +1068,346 @@ class logger {
             remove_entry_from_more_idxs(key, key_len);
         }
 
+        // Waits till entries frozen earlier are written out
+        void wait_for_drain() {
+            std::unique_lock<std::mutex> lock(tier_mutex);
+            while (is_draining)
+                drain_cv.wait(lock);
+        }
+
+        // Moves cold entries of the full staging block in idx0 to frozen_buf,
+        // those with least counts first, till a third of the block is left.
+        // Counts are found once and the least count to keep worked out
+        // from them, so the block is gone over only twice.
+        void freeze_cold_entries() {
+            wait_for_drain();
+            frozen_buf_len = 0;
+            frozen_pos.clear();
+            int filled_size = idx0->filled_size();
+            int target_size = filled_size / 3;
+            std::vector<uint8_t> counts(filled_size);
+            for (int i = 0; i < filled_size; i++) {
+                uint8_t *k = idx0->current_block + idx0->get_ptr(i);
+                int v_len = k[*k + 1];
+                counts[i] = (is_staged_tombstone(k + *k + 2, v_len) ? 0 : hotness->estimate(k + 1, *k));
+            }
+            // entries with count below this go, then those with this count
+            // in the order found till target is reached
+            std::vector<uint8_t> sorted_counts(counts);
+            int to_freeze = filled_size - target_size;
+            if (to_freeze <= 0)
+                return;
+            std::nth_element(sorted_counts.begin(), sorted_counts.begin() + to_freeze - 1, sorted_counts.end());
+            int max_count = sorted_counts[to_freeze - 1];
+            int at_max_left = to_freeze;
+            for (int i = 0; i < filled_size; i++) {
+                if (counts[i] < max_count)
+                    at_max_left--;
+            }
+            int src = 0;
+            for (int i = 0; i < filled_size; i++) {
+                bool to_take = counts[i] < max_count || (counts[i] == max_count && at_max_left-- > 0);
+                if (!to_take) {
+                    src++;
+                    continue;
+                }
+                uint32_t src_idx = idx0->get_ptr(src);
+                int k_len = idx0->current_block[src_idx];
+                int entry_len = k_len + idx0->current_block[src_idx + k_len + 1] + 2;
+                frozen_buf[frozen_buf_len++] = counts[i];
+                memcpy(frozen_buf + frozen_buf_len, idx0->current_block + src_idx, entry_len);
+                frozen_pos.push_back(frozen_buf_len);
+                frozen_buf_len += entry_len;
+                idx0->remove_entry(src);
+            }
+            metrics.freezes++;
+            metrics.frozen_entries += frozen_pos.size();
+            publish_staging_stats();
+            std::unique_lock<std::mutex> lock(tier_mutex);
+            is_draining = true;
+        }
+
+        // Writes frozen entries to the hottest tier whose min_count is not
+        // more than their count in idx0, to idx1 if none. Entries are
+        // sorted out by tier first and each tier is then written in key
+        // order as in frozen_buf, so one after another they go left to
+        // right and the path is mostly in cache. Each entry descends its
+        // tier once, counted in drain_descents.
+        void drain_frozen() {
+            int64_t now = time(NULL);
+            std::vector<std::vector<int> > tier_entries(hot_tiers.size() + 1);
+            for (size_t i = 0; i < frozen_pos.size(); i++) {
+                uint8_t *k = frozen_buf + frozen_pos[i];
+                // tombstones go to idx1
+                bool is_tombstone = is_staged_tombstone(k + *k + 2, k[*k + 1]);
+                tier_entries[is_tombstone ? hot_tiers.size() : tier_for_count(k[-1])].push_back(frozen_pos[i]);
+            }
+            for (size_t tier_no = 0; tier_no < tier_entries.size(); tier_no++) {
+                std::vector<int>& entries = tier_entries[tier_no];
+                for (size_t start = 0; start < entries.size(); start += LOGGER_DRAIN_CHUNK) {
+                    size_t end = std::min(entries.size(), start + LOGGER_DRAIN_CHUNK);
+                    std::lock_guard<std::mutex> lock(tier_mutex);
+                    for (size_t i = start; i < end; i++)
+                        drain_entry(frozen_buf + entries[i], tier_no, now);
+                }
+            }
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            frozen_pos.clear();
+            is_draining = false;
+            publish_tier_stats();
+        }
+
+        // Writes a frozen entry to given tier, hot_tiers.size() for idx1.
+        // Caller holds tier_mutex
+        void drain_entry(const uint8_t *k, size_t tier_no, int64_t now) {
+            int k_len = *k++;
+            int v_len = k[k_len];
+            const uint8_t *v = k + k_len + 1;
+            if (is_staged_tombstone(v, v_len)) {
+                mark_idx1_time(now);
+                drain_tombstone(k, k_len);
+                metrics.drained_tombstones++;
+                return;
+            }
+            remove_from_hotter_tiers(k, k_len, tier_no);
+            if (tier_no < hot_tiers.size()) {
+                logger_tier& tier = hot_tiers[tier_no];
+                bool is_inserted = put_at_leaf(tier.idx, k, k_len, v, v_len);
+                if (use_bloom && is_inserted)
+                    tier.bf->add_uint8_str(k, k_len);
+                return;
+            }
+            bool is_inserted = put_at_leaf(idx1, k, k_len, v, v_len);
+            if (use_bloom && is_inserted)
+                bf_idx1->add_uint8_str(k, k_len);
+            mark_idx1_time(now);
+            spawn_more_idx1_if_full();
+        }
+
+        // Puts to idx in a single descent. An old record of the key,
+        // which may be a tombstone, is removed from the leaf found and
+        // the new one inserted where it was, as records are not updated
+        // in place. Returns true if the key was not there
+        bool put_at_leaf(sqlite *idx, const uint8_t *k, int k_len, const uint8_t *v, int v_len) {
+            bpt_slot slot;
+            metrics.drain_descents++;
+            bool is_found = idx->find_slot(k, k_len, &slot);
+            if (is_found) {
+                idx->remove_found_entry();
+                slot.search_result = ~slot.search_result;
+            }
+            idx->put_at_slot(&slot, v, v_len);
+            return !is_found;
+        }
+
+        // Index of tier for entries of given count in idx0,
+        // hot_tiers.size() for idx1
+        size_t tier_for_count(int entry_count) {
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                if (entry_count >= hot_tiers[i].config.min_count)
+                    return i;
+            }
+            return hot_tiers.size();
+        }
+
+        // Removes key from tiers looked up before the given one so that
+        // what is written there is not hidden by an older value
+        void remove_from_hotter_tiers(const uint8_t *k, int k_len, size_t tier_no) {
+            for (size_t i = 0; i < tier_no && i < hot_tiers.size(); i++) {
+                if (!use_bloom || hot_tiers[i].bf->check_uint8_str(k, k_len) != BLOOM_FAILURE) {
+                    int old_len;
+                    if (hot_tiers[i].idx->get(k, k_len, &old_len))
+                        hot_tiers[i].idx->remove_found_entry();
+                }
+            }
+        }
+
+        // Tombstone goes to idx1 as a record with NULL value. Any value
+        // in hot tiers is removed as they are looked up before idx1.
+        void drain_tombstone(const uint8_t *k, int k_len) {
+            int old_len;
+            remove_from_hotter_tiers(k, k_len, hot_tiers.size());
+            if (!use_bloom || bf_idx1->check_uint8_str(k, k_len) != BLOOM_FAILURE) {
+                metrics.drain_descents++;
+                if (idx1->get(k, k_len, &old_len))
+                    idx1->remove_found_entry();
+            }
+            uint8_t rec[k_len + 12];
+            int rec_len = make_tombstone_rec(rec, k, k_len);
+            metrics.drain_descents++;
+            idx1->put(rec, -rec_len, NULL, 0);
+            if (use_bloom)
+                bf_idx1->add_uint8_str(k, k_len);
+            spawn_more_idx1_if_full();
+        }
+
+        static int make_tombstone_rec(uint8_t *rec, const uint8_t *k, int k_len) {
+            uint32_t key_type = k_len * 2 + 13;
+            int hdr_len = util::get_vlen_of_uint32(key_type) + 2;
+            uint8_t *ptr = rec;
+            ptr += util::write_vint32(ptr, hdr_len);
+            ptr += util::write_vint32(ptr, key_type);
+            *ptr++ = 0; // NULL value
+            memcpy(ptr, k, k_len);
+            return ptr + k_len - rec;
+        }
+
+        // Deleted keys are staged with an empty value, so values
+        // put are to be at least one byte long
+        static bool is_staged_tombstone(const uint8_t *v, int v_len) {
+            return v_len == 0;
+        }
+
+        void drain_worker() {
+            std::unique_lock<std::mutex> lock(tier_mutex);
+            while (!to_stop_drain || is_draining) {
+                if (!is_draining) {
+                    drain_cv.wait(lock);
+                    continue;
+                }
+                lock.unlock();
+                drain_frozen();
+                drain_cv.notify_all();
+                lock.lock();
+            }
+        }
+
+        // Copies value found, cut to size of caller's buffer. Length is
+        // given as -1 for tombstones, as by tiers below idx0
+        static void copy_found_value(const uint8_t *v, int v_len, int *in_size_out_value_len, uint8_t *val) {
+            if (is_staged_tombstone(v, v_len)) {
+                *in_size_out_value_len = -1;
+                return;
+            }
+            if (v_len > *in_size_out_value_len)
+                v_len = *in_size_out_value_len;
+            if (val != NULL && v_len > 0)
+                memcpy(val, v, v_len);
+            *in_size_out_value_len = v_len;
+        }
+
+        // Looks up idx0, from the thread making puts
+        bool get_staged(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            std::lock_guard<std::mutex> staging_lock(staging_mutex);
+            bpt_slot slot;
+            if (!idx0->find_slot(key, key_len, &slot))
+                return false;
+            int16_t v_len;
+            uint8_t *v = idx0->get_slot_value(&slot, &v_len);
+            copy_found_value(v, v_len, in_size_out_value_len, val);
+            return true;
+        }
+
+        // Looks up entries frozen for draining, caller holds tier_mutex
+        bool get_frozen(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            int first = 0;
+            int last = frozen_pos.size();
+            while (first < last) {
+                int middle = (first + last) >> 1;
+                uint8_t *k = frozen_buf + frozen_pos[middle];
+                int cmp = util::compare(k + 1, *k, key, key_len);
+                if (cmp < 0)
+                    first = middle + 1;
+                else if (cmp > 0)
+                    last = middle;
+                else {
+                    copy_found_value(k + *k + 2, k[*k + 1], in_size_out_value_len, val);
+                    return true;
+                }
+            }
+            return false;
+        }
+
         bool put(const char *key, uint8_t key_len, const char *value, int value_len) {
             return put((const uint8_t *) key, key_len, (const uint8_t *) value, value_len);
         }
 
+        // Returns true if the key was in idx0 and its value replaced
+        // there. Empty values are not put, as they mark deleted keys
+        // in idx0, and give false
         bool put(const uint8_t *key, uint8_t key_len, const uint8_t *value, int value_len) {
-            no_of_inserts++;
-            if (no_of_inserts % 5000000 == 0) {
-                //for (int i = 0; i < cache0_page_count; i++)
-                //    printf("%2x", flush_counts[i]);
-                //cout << endl;
-                std::cout << "Idx1+ lookups: ";
-                std::cout << idx_more_lookup_counts[0] << " ";
-                if (BUCKET_COUNT == 2)
-                    std::cout << idx_more_lookup_counts[1] << " ";
-                for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++) {
-                    std::cout << idx_more_lookup_counts[it - idx1_more.begin() + BUCKET_COUNT] << " ";
-                }
-                std::cout << std::endl;
-                if (use_bloom) {
-                    std::cout << "Idx1+ positiv: ";
-                    std::cout << idx_more_pve_counts[0] << " ";
-                    if (BUCKET_COUNT == 2)
-                        std::cout << idx_more_pve_counts[1] << " ";
-                    for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++) {
-                        std::cout << idx_more_pve_counts[it - idx1_more.begin() + BUCKET_COUNT] << " ";
-                    }
-                    std::cout << std::endl;
-                }
-                std::cout << "Idx1+ found  : ";
-                std::cout << idx_more_found_counts[0] << " ";
-                if (BUCKET_COUNT == 2)
-                    std::cout << idx_more_found_counts[1] << " ";
-                for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++) {
-                    std::cout << idx_more_found_counts[it - idx1_more.begin() + BUCKET_COUNT] << " ";
+            if (value_len <= 0)
+                return false;
+            return put_entry(key, key_len, value, value_len, false);
+        }
+
+        // Deletes by staging a tombstone in idx0, which hides values of
+        // the key in colder tiers and goes down the tiers like any entry.
+        // Returns true if the key had a value, as get() would have found,
+        // false if it was not there or deleted already. The tombstone is
+        // staged either way.
+        bool del(const char *key, uint8_t key_len) {
+            return del((const uint8_t *) key, key_len);
+        }
+
+        bool del(const uint8_t *key, uint8_t key_len) {
+            int v_len = 0;
+            bool is_found = get_from_tiers(key, key_len, &v_len, NULL);
+            put_entry(key, key_len, NULL, 0, true);
+            return is_found;
+        }
+
+        bool put_entry(const uint8_t *key, uint8_t key_len, const uint8_t *value, int value_len, bool is_tombstone) {
+            long wal_seq = 0;
+            // held from append so that a checkpoint does not empty
+            // the log of a put not yet in idx0
+            std::unique_lock<std::mutex> staging_lock(staging_mutex);
+            if (wal != NULL) {
+                if (wal->size() >= LOGGER_WAL_CHECKPOINT_BYTES)
+                    ask_checkpoint();
+                wal_seq = wal->append(key, key_len, value, value_len, is_tombstone);
+            }
+            if (misses != NULL || results != NULL) {
+                uint64_t h = key_hash::of(key, key_len);
+                if (misses != NULL)
+                    misses->forget(h);
+                if (results != NULL) {
+                    check_results_expiry();
+                    if (is_tombstone)
+                        results->remove(h, key, key_len);
+                    else
+                        results->update(h, key, key_len, value, value_len);
                 }
-                std::cout << std::endl;
-                memset(flush_counts, '\0', sizeof(int) * cache0_page_count);
-                zero_count = cache0_page_count;
             }
+            if (is_tombstone)
+                metrics.deletes++;
+            else
+                metrics.puts++;
             if (idx0->cache->cache_size_in_pages <= idx0->cache->file_page_count) {
                 is_cache0_full = true;
             }
-            int out_val_len = value_len + 1;
-            uint8_t val[value_len + 1];
-            bool is_found_in_idx0 = idx0->get(key, key_len, &out_val_len, val);
-            idx0->set_value(value, value_len + 1);
-            bool is_full = idx0->is_full(0);
+            // one descent finds where the key goes, to check for room
+            // there and then update or insert at the same place. If
+            // room had to be made, which can split the leaf, it is
+            // descended to again
+            bpt_slot slot;
+            bool is_found = idx0->find_slot(key, key_len, &slot);
+            if (is_tombstone) {
+                value = (const uint8_t *) "";
+                value_len = 0;
+            } else
+                hotness->add(key, key_len);
+            idx0->set_value(value, value_len);
+            bool is_full = idx0->is_full(is_found ? slot.search_result : ~slot.search_result);
             if (is_full && is_cache0_full) {
-                int target_size = idx0->filled_size() / 3;
-                int cur_count = 1;
-                int next_min = 255;
-                while (idx0->filled_size() > target_size) {
-                    for (int i = 0; i < idx0->filled_size(); i++) {
-                        uint32_t src_idx = idx0->get_ptr(i);
-                        int k_len = idx0->current_block[src_idx];
-                        uint8_t *k = idx0->current_block + src_idx + 1;
-                        int v_len = idx0->current_block[src_idx + k_len + 1];
-                        uint8_t *v = idx0->current_block + src_idx + k_len + 2;
-                        if (v_len != value_len + 1)
-                            std::cout << "src_idx: " << src_idx << ", vlen: " << v_len << " ";
-                        int entry_count = v[v_len - 1];
-                        if (v_len != value_len + 1) {
-                            std::cout << entry_count << std::endl;
-                            printf("k: %.*s, len: %d\n", k_len, k, k_len);
-                        }
-                        if (entry_count <= cur_count) {
-                            int v1_len;
-                            uint8_t v1[value_len + 1];
-#if BUCKET_COUNT == 2
-                            if (entry_count <= 1) {
-                                bool is_inserted = !idx1->put(k, k_len, v, v_len - 1);
-                                if (use_bloom && is_inserted)
-                                    bf_idx1->add_uint8_str(k, k_len);
-                                //remove_entry_from_more_idxs(k, k_len);
-                                // if (v1 != NULL)
-                                //     memcpy(v1, v, v_len - 1);
-                                spawn_more_idx1_if_full();
-                            } else {
-                                bool is_inserted = !idx2->put(k, k_len, v, v_len - 1);
-                                if (use_bloom && is_inserted)
-                                    bf_idx2->add_uint8_str(k, k_len);
-                                //printf("Key: %.*s, %d,%d,%d,%d,%d\n", k_len, k, v[0], v[1], v[2], v[4], v[5]);
-                                //remove_entry_from_idx1_more(k, k_len);
-                            }
+                freeze_cold_entries();
+#if LOGGER_BG_DRAIN == 1
+                drain_cv.notify_all();
 #else
-                            v1 = idx1->put(k, k_len, v, v_len - 1, &v1_len);
-                            if (use_bloom && v1 == NULL)
-                                bf_idx1->add_uint8_str(k, k_len);
-                            remove_entry_from_more_idxs(k, k_len);
-                            // if (v1 != NULL)
-                            //     memcpy(v1, v, v_len - 1);
-                            spawn_more_idx1_if_full();
+                drain_frozen();
 #endif
-                            idx0->remove_entry(i);
-                            i--;
-                        } else {
-                            if (entry_count < next_min)
-                                next_min = entry_count;
-                            if (entry_count > 2)
-                                v[v_len - 1]--;
-                        }
-                        if (idx0->filled_size() <= target_size && cur_count > 1)
-                            break;
-                    }
-                    cur_count = (cur_count == next_min ? 255 : next_min);
-                    //cout << "next_min: " << next_min << endl;
-                }
-                //if (idx0->filled_size() > 0)
-                //    cout << "Not emptied" << endl;
                 idx0->make_space();
-                // if (idx0->current_block != idx0->root_block) {
-                //     int idx = (idx0->current_block - idx0->cache->page_cache)/STAGING_BLOCK_SIZE;
-                //     if (idx < cache0_page_count && flush_counts[idx] == 0 && zero_count)
-                //         zero_count--;
-                //     if (flush_counts[idx] < 255)
-                //         flush_counts[idx]++;
-                // }
-            }
-            int new_val_len = value_len;
-            uint8_t new_val[new_val_len + 1];
-            memcpy(new_val, value, new_val_len);
-            if (is_found_in_idx0) {
-                uint8_t entry_count = val[new_val_len];
-                new_val[new_val_len] = entry_count < 255 ? entry_count + 1 : 255;
-            } else
-                new_val[new_val_len] = 1;
-            new_val_len++;
-            //cout << "Found in idx0: " << entry_count << endl;
-            return idx0->put(key, key_len, new_val, new_val_len);
+                idx0->refind_slot(&slot);
+            }
+            // value of another length is not replaced in place
+            if (!idx0->put_at_slot(&slot, value, value_len))
+                idx0->put(key, key_len, value, value_len);
+            staging_lock.unlock();
+#if LOGGER_WAL_SYNC_PUTS == 1
+            if (wal != NULL)
+                wal->wait_durable(wal_seq);
+#endif
+            return is_found;
         }
 
         bool get(const char *key, uint8_t key_len, int *out_value_len, char *val) {
@@ -387,64 +1415,308 @@ class logger {
         }
 
         bool get(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
-            bool is_found = idx0->get(key, key_len, in_size_out_value_len, val);
-            if (is_found) {
+            metrics.gets++;
+            if (misses == NULL && results == NULL) {
+                bool is_found = get_from_tiers(key, key_len, in_size_out_value_len, val);
+                if (is_found)
+                    metrics.gets_found++;
+                return is_found;
+            }
+            uint64_t h = key_hash::of(key, key_len);
+            if (results != NULL)
+                check_results_expiry();
+            if (results != NULL && results->get(h, key, key_len, in_size_out_value_len, val)) {
+                metrics.result_cache_hits++;
+                metrics.gets_found++;
                 return true;
             }
-#if BUCKET_COUNT == 2
+            if (misses != NULL && misses->contains(h)) {
+                metrics.miss_cache_hits++;
+                return false;
+            }
+            int buf_size = (in_size_out_value_len == NULL ? 0 : *in_size_out_value_len);
+            bool is_found = get_from_tiers(key, key_len, in_size_out_value_len, val);
             if (!is_found) {
-                idx_more_lookup_counts[0]++;
-                if (!use_bloom || (use_bloom && bf_idx2->check_uint8_str(key, key_len) != BLOOM_FAILURE)) {
-                    idx_more_pve_counts[0]++;
-                    is_found = idx2->get(key, key_len, in_size_out_value_len, val);
+                if (misses != NULL)
+                    misses->add(h);
+                return false;
+            }
+            metrics.gets_found++;
+            if (results != NULL && val != NULL && in_size_out_value_len != NULL && *in_size_out_value_len < buf_size)
+                results->add(h, key, key_len, val, *in_size_out_value_len); // value not cut short
+            return is_found;
+        }
+
+        // Looks up idx0, frozen entries, hot tiers, idx1 and then segments.
+        // Tombstones are told apart by length before the value is cut to
+        // size of caller's buffer, which may be 0 with val NULL.
+        bool get_from_tiers(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            bool is_found = get_staged(key, key_len, in_size_out_value_len, val);
+            if (is_found)
+                return *in_size_out_value_len >= 0;
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            if (tune_interval > 0 && ++lookups_since_tune >= tune_interval)
+                tune_cache_sizes();
+            if (!frozen_pos.empty() && get_frozen(key, key_len, in_size_out_value_len, val))
+                return *in_size_out_value_len >= 0;
+            for (size_t i = 0; i < hot_tiers.size() && !is_found; i++) {
+                int stat = tier_stat_idx(i);
+                metrics.tier_lookups[stat]++;
+                if (!use_bloom || (use_bloom && hot_tiers[i].bf->check_uint8_str(key, key_len) != BLOOM_FAILURE)) {
+                    metrics.tier_bloom_positives[stat]++;
+                    is_found = hot_tiers[i].idx->get(key, key_len, in_size_out_value_len, val);
                     if (is_found)
-                        idx_more_found_counts[0]++;
+                        metrics.tier_found[stat]++;
                 }
             }
-#endif
             if (!is_found) {
-                idx_more_lookup_counts[BUCKET_COUNT - 1]++;
+                int idx1_stat = tier_stat_idx(hot_tiers.size());
+                metrics.tier_lookups[idx1_stat]++;
                 if (!use_bloom || (use_bloom && bf_idx1->check_uint8_str(key, key_len) != BLOOM_FAILURE)) {
-                    idx_more_pve_counts[BUCKET_COUNT - 1]++;
+                    metrics.tier_bloom_positives[idx1_stat]++;
                     is_found = idx1->get(key, key_len, in_size_out_value_len, val);
                     if (is_found)
-                        idx_more_found_counts[BUCKET_COUNT - 1]++;
+                        metrics.tier_found[idx1_stat]++;
                 }
             }
-            if (!is_found) {
-                cache_more_bf::iterator it_bf;
-                if (use_bloom)
-                    it_bf = bf_idx1_more.begin();
-                for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++) {
-                    idx_more_lookup_counts[it - idx1_more.begin() + BUCKET_COUNT]++;
-                    if (!use_bloom || (use_bloom && (*it_bf)->check_uint8_str(key, key_len) != BLOOM_FAILURE)) {
-                       idx_more_pve_counts[it - idx1_more.begin() + BUCKET_COUNT]++;
-                       is_found = (*it)->get(key, key_len, in_size_out_value_len, val);
-                       if (is_found) {
-                           idx_more_found_counts[it - idx1_more.begin() + BUCKET_COUNT]++;
-                           break;
-                       }
-                    }
-                    it_bf++;
+            if (!is_found && !idx1_more.empty())
+                is_found = get_from_more_idxs(key, key_len, in_size_out_value_len, val);
+            // value is given as NULL for tombstones in idx1 and below
+            if (is_found && *in_size_out_value_len < 0)
+                return false;
+            return is_found;
+        }
+
+        // A key can be in more than one rotated segment and the newest
+        // copy is to be returned, so segments are probed newest first
+        // and the first hit is final. With probe_pool, all segments
+        // whose bloom filter says maybe are probed at once instead.
+        bool get_from_more_idxs(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            std::vector<int> to_probe;
+            for (size_t pos = 0; pos < idx1_more.size(); pos++) {
+                metrics.tier_lookups[seg_stat_idx(pos)]++;
+                if (use_bloom && bf_idx1_more[pos]->check_uint8_str(key, key_len) == BLOOM_FAILURE)
+                    continue;
+                metrics.tier_bloom_positives[seg_stat_idx(pos)]++;
+                if (probe_pool != NULL) {
+                    to_probe.push_back(pos);
+                    continue;
+                }
+                if (probe_more_idx(pos, key, key_len, in_size_out_value_len, val)) {
+                    found_in_more_idx(pos);
+                    return true;
                 }
             }
-            return is_found;
+            if (to_probe.empty())
+                return false;
+            if (to_probe.size() == 1) {
+                if (!probe_more_idx(to_probe[0], key, key_len, in_size_out_value_len, val))
+                    return false;
+                found_in_more_idx(to_probe[0]);
+                return true;
+            }
+            int buf_size = (in_size_out_value_len == NULL ? 0 : *in_size_out_value_len);
+            std::vector<uint8_t> bufs(to_probe.size() * buf_size + 1);
+            std::vector<int> val_lens(to_probe.size(), buf_size);
+            std::vector<char> is_found(to_probe.size(), 0);
+            metrics.parallel_probes++;
+            probe_pool->run_all(to_probe.size(), [&](int i) {
+                is_found[i] = probe_more_idx(to_probe[i], key, key_len,
+                        in_size_out_value_len == NULL ? NULL : &val_lens[i],
+                        val == NULL ? NULL : bufs.data() + i * buf_size);
+            });
+            // to_probe is newest first
+            for (size_t i = 0; i < to_probe.size(); i++) {
+                if (is_found[i]) {
+                    if (in_size_out_value_len != NULL)
+                        *in_size_out_value_len = val_lens[i];
+                    if (val != NULL && val_lens[i] > 0)
+                        memcpy(val, bufs.data() + i * buf_size, val_lens[i]);
+                    found_in_more_idx(to_probe[i]);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool probe_more_idx(int pos, const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            if (!idx1_more[pos]->get(key, key_len, in_size_out_value_len, val))
+                return false;
+            // removed while being merged but still in file
+            if (is_being_merged(pos) && merge_removed_keys.count(std::string((const char *) key, key_len)))
+                return false;
+            return true;
+        }
+
+        void found_in_more_idx(int pos) {
+            metrics.tier_found[seg_stat_idx(pos)]++;
+        }
+
+        // Caches sized together, all rotated segments being one group
+        struct cache_group {
+            std::vector<lru_cache *> caches;
+            int *cache_size; // of each cache, used when reopened too
+            double gain;     // ghost hits per ghost page since last time
+        };
+
+        // Moves a step of pages from the group gaining least from its
+        // last pages to the one that would gain most from more, or only
+        // takes back pages when over cache_budget, such as after idx1 is
+        // rotated. Staging idx0 is left alone as its size decides when
+        // entries are frozen, not just how often pages are read.
+        // Caller holds tier_mutex and no tree operation is under way.
+        void tune_cache_sizes() {
+            lookups_since_tune = 0;
+            std::vector<cache_group> groups(hot_tiers.size() + 1);
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                groups[i].caches.push_back(hot_tiers[i].idx->cache);
+                groups[i].cache_size = &hot_tiers[i].config.cache_size;
+            }
+            groups[hot_tiers.size()].caches.push_back(idx1->cache);
+            groups[hot_tiers.size()].cache_size = &cache1_size;
+            if (!idx1_more.empty()) {
+                groups.resize(groups.size() + 1);
+                for (size_t pos = 0; pos < idx1_more.size(); pos++)
+                    groups.back().caches.push_back(idx1_more[pos]->cache);
+                groups.back().cache_size = &cache_more_size;
+            }
+            for (size_t i = groups.size(); i-- > 0; ) {
+                if (*groups[i].cache_size <= 0) // no cache
+                    groups.erase(groups.begin() + i);
+            }
+            long total_pages = 0;
+            std::unordered_map<lru_cache *, long> ghost_hits;
+            for (size_t i = 0; i < groups.size(); i++) {
+                cache_group& group = groups[i];
+                long hits = 0;
+                long ghost_pages = 0;
+                for (size_t j = 0; j < group.caches.size(); j++) {
+                    lru_cache *cache = group.caches[j];
+                    long cache_hits = cache->get_cache_stats().ghost_hits;
+                    std::unordered_map<lru_cache *, long>::iterator it = tune_ghost_hits.find(cache);
+                    if (it != tune_ghost_hits.end() && it->second <= cache_hits)
+                        hits += cache_hits - it->second;
+                    ghost_hits[cache] = cache_hits;
+                    ghost_pages += tune_step(cache->get_cache_size());
+                }
+                group.gain = (double) hits / ghost_pages;
+                total_pages += (long) *group.cache_size * group.caches.size();
+            }
+            tune_ghost_hits.swap(ghost_hits);
+            int giver = -1;
+            int taker = -1;
+            for (int i = 0; i < (int) groups.size(); i++) {
+                if (*groups[i].cache_size > LOGGER_TUNE_MIN_PAGES && (giver == -1 || groups[i].gain < groups[giver].gain))
+                    giver = i;
+                if (taker == -1 || groups[i].gain > groups[taker].gain)
+                    taker = i;
+            }
+            if (giver >= 0) {
+                cache_group& from = groups[giver];
+                int step = tune_step(*from.cache_size);
+                if (*from.cache_size - step < LOGGER_TUNE_MIN_PAGES)
+                    step = *from.cache_size - LOGGER_TUNE_MIN_PAGES;
+                long moved = (long) step * from.caches.size();
+                if (total_pages > cache_budget) {
+                    resize_group(from, *from.cache_size - step);
+                } else if (taker != giver && groups[taker].gain > from.gain * 2 && groups[taker].gain > 0) {
+                    cache_group& to = groups[taker];
+                    long taken = (moved + cache_budget - total_pages) / to.caches.size();
+                    resize_group(from, *from.cache_size - step);
+                    resize_group(to, *to.cache_size + taken);
+                }
+            }
+            for (size_t i = 0; i < groups.size(); i++) {
+                for (size_t j = 0; j < groups[i].caches.size(); j++)
+                    groups[i].caches[j]->set_ghost_size(tune_step(groups[i].caches[j]->get_cache_size()));
+            }
+        }
+
+        static int tune_step(int cache_size) {
+            int step = cache_size * LOGGER_TUNE_STEP_PCT / 100;
+            return step < 1 ? 1 : step;
+        }
+
+        void resize_group(cache_group& group, int cache_size) {
+            for (size_t i = 0; i < group.caches.size(); i++) {
+                if (!group.caches[i]->resize(cache_size))
+                    return;
+            }
+            *group.cache_size = cache_size;
+        }
+
+        // Older of the two is right after the newer in idx1_more
+        bool is_being_merged(size_t pos) {
+            return merging_seg_no && (seg_nos[pos] == merging_seg_no || (pos > 0 && seg_nos[pos - 1] == merging_seg_no));
+        }
+
+        // Iterator over all entries in key order, newest value of each key
+        // and leaving out deleted keys, from start_key (inclusive) till
+        // end_key (exclusive). Either can be NULL for no bound.
+        // To be used from the thread making puts, with no puts till done.
+        // Caller deletes it.
+        tier_merger *iterate(const uint8_t *start_key = NULL, int start_len = 0,
+                const uint8_t *end_key = NULL, int end_len = 0) {
+            std::unique_lock<std::mutex> staging_lock(staging_mutex);
+            wait_for_drain();
+            tier_merger *merger = new tier_merger();
+            buf_tier_cursor *staged = new buf_tier_cursor(true);
+            copy_staging_entries(idx0->root_block, staged);
+            staging_lock.unlock();
+            staged->sort();
+            merger->add_cursor(staged);
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                hot_tiers[i].idx->flush();
+                merger->add_cursor(new sqlite_tier_cursor(hot_tiers[i].name.c_str()));
+            }
+            idx1->flush();
+            merger->add_cursor(new sqlite_tier_cursor(idx1->filename));
+            for (size_t pos = 0; pos < idx1_more.size(); pos++) {
+                idx1_more[pos]->flush();
+                sqlite_tier_cursor *seg = new sqlite_tier_cursor(segment_name(seg_nos[pos]).c_str());
+                if (is_being_merged(pos))
+                    seg->set_skip_keys(merge_removed_keys);
+                merger->add_cursor(seg);
+            }
+            merger->set_skip_deleted(true);
+            merger->set_range(start_key, start_len, end_key, end_len);
+            return merger;
+        }
+
+        // Copies entries of idx0 under given block, children first
+        // noted down since reading them can evict the block from cache
+        void copy_staging_entries(uint8_t *block, buf_tier_cursor *out) {
+            idx0->set_current_block(block);
+            if (idx0->is_leaf()) {
+                for (int i = 0; i < idx0->filled_size(); i++)
+                    out->add(block + idx0->get_ptr(i));
+                return;
+            }
+            std::vector<uint32_t> child_pages;
+            for (int i = 0; i < idx0->filled_size(); i++)
+                child_pages.push_back(idx0->get_child_page(block + idx0->get_ptr(i)));
+            for (size_t i = 0; i < child_pages.size(); i++)
+                copy_staging_entries(idx0->cache->get_disk_page_in_cache(child_pages[i]), out);
         }
 
         cache_stats get_cache_stats() {
+            std::lock_guard<std::mutex> lock(tier_mutex);
             return idx1->get_cache_stats();
         }
         int get_max_key_len() {
-#if BUCKET_COUNT == 2
-            return std::max(std::max(idx0->get_max_key_len(), idx1->get_max_key_len()), idx2->get_max_key_len());
-#else
-            return max(idx0->get_max_key_len(), idx1->get_max_key_len());
-#endif
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            int max_key_len = std::max(idx0->get_max_key_len(), idx1->get_max_key_len());
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                max_key_len = std::max(max_key_len, hot_tiers[i].idx->get_max_key_len());
+            return max_key_len;
         }
         int get_num_levels() {
+            std::lock_guard<std::mutex> lock(tier_mutex);
             return idx1->get_num_levels();
         }
         void print_stats(long sz) {
+            std::lock_guard<std::mutex> lock(tier_mutex);
             idx0->print_stats(idx0->size());
             idx1->print_stats(idx1->size());
             if (use_bloom)
@@ -456,34 +1728,34 @@ class logger {
                     (*it_bf)->stats();
                 it_bf++;
             }
-#if BUCKET_COUNT == 2
-            idx2->print_stats(idx2->size());
-            if (use_bloom)
-                bf_idx2->stats();
-#endif
+            for (size_t i = 0; i < hot_tiers.size(); i++) {
+                hot_tiers[i].idx->print_stats(hot_tiers[i].idx->size());
+                if (use_bloom)
+                    hot_tiers[i].bf->stats();
+            }
         }
         void print_num_levels() {
+            std::lock_guard<std::mutex> lock(tier_mutex);
             idx0->print_num_levels();
             idx1->print_num_levels();
             for (cache_more::iterator it = idx1_more.begin(); it != idx1_more.end(); it++)
             	(*it)->print_num_levels();
-#if BUCKET_COUNT == 2
-            idx2->print_num_levels();
-#endif
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                hot_tiers[i].idx->print_num_levels();
         }
         long size() {
-#if BUCKET_COUNT == 2
-            return idx0->size() + idx1->size() + idx2->size();
-#else
-            return idx0->size() + idx1->size();
-#endif
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            long total = idx0->size() + idx1->size();
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                total += hot_tiers[i].idx->size();
+            return total;
         }
         long filled_size() {
-#if BUCKET_COUNT == 2
-            return idx0->filled_size() + idx1->filled_size() + idx2->size();
-#else
-            return idx0->filled_size() + idx1->filled_size();
-#endif
+            std::lock_guard<std::mutex> lock(tier_mutex);
+            long total = idx0->filled_size() + idx1->filled_size();
+            for (size_t i = 0; i < hot_tiers.size(); i++)
+                total += hot_tiers[i].idx->size();
+            return total;
         }
 
 };
@@ -0,0 +1,162 @@
+#ifndef LOGGER_METRICS_H
+#define LOGGER_METRICS_H
+#ifndef ARDUINO
+#include <atomic>
+#include <ostream>
+#endif
+
+// Counters kept for hot tiers, then idx1, then rotated segments.
+// Tiers past the last are counted together in it
+#define LOGGER_METRICS_MAX_TIERS 50
+
+// Counters of logger, each updated without locks so that they can be
+// read at any time from another thread, such as for scraping.
+// Per tier counters are in lookup order, hot tiers, idx1 and then
+// segments newest first, tier_count of them in use. Cache counters
+// are of files now open and published after each freeze and drain,
+// so they lag a little and drop when segments are merged.
+// Tiers are given to per tier counters through slot_of(). Once there
+// are more tiers than slots, the last slot adds up counts of all of
+// them from there on, and may keep counts of some that are gone.
+struct logger_metrics {
+    std::atomic<long> puts;
+    std::atomic<long> deletes;
+    std::atomic<long> gets;
+    std::atomic<long> gets_found;
+    std::atomic<long> miss_cache_hits;
+    std::atomic<long> result_cache_hits;
+    std::atomic<int> tier_count;
+    std::atomic<long> tier_lookups[LOGGER_METRICS_MAX_TIERS];
+    std::atomic<long> tier_bloom_positives[LOGGER_METRICS_MAX_TIERS];
+    std::atomic<long> tier_found[LOGGER_METRICS_MAX_TIERS];
+    // Lookups that probed more than one segment side by side
+    std::atomic<long> parallel_probes;
+    std::atomic<long> freezes;
+    std::atomic<long> frozen_entries;
+    std::atomic<long> drained_tombstones;
+    std::atomic<long> drain_descents;
+    std::atomic<long> rotations;
+    std::atomic<long> merges;
+    std::atomic<long> expired_segments;
+    std::atomic<long> checkpoints;
+    std::atomic<long> staging_flushes;
+    std::atomic<long> staging_pages_read;
+    std::atomic<long> staging_bytes_written;
+    std::atomic<long> tier_flushes;
+    std::atomic<long> tier_pages_read;
+    std::atomic<long> tier_bytes_written;
+
+    logger_metrics() {
+        reset();
+    }
+
+    void reset() {
+        puts = deletes = gets = gets_found = 0;
+        miss_cache_hits = result_cache_hits = 0;
+        tier_count = 0;
+        for (int i = 0; i < LOGGER_METRICS_MAX_TIERS; i++)
+            tier_lookups[i] = tier_bloom_positives[i] = tier_found[i] = 0;
+        parallel_probes = 0;
+        freezes = frozen_entries = drained_tombstones = drain_descents = 0;
+        rotations = merges = expired_segments = checkpoints = 0;
+        staging_flushes = staging_pages_read = staging_bytes_written = 0;
+        tier_flushes = tier_pages_read = tier_bytes_written = 0;
+    }
+
+    // Slot of per tier counters for given tier
+    static int slot_of(int tier) {
+        return tier < LOGGER_METRICS_MAX_TIERS ? tier : LOGGER_METRICS_MAX_TIERS - 1;
+    }
+
+    // Bloom positives that were not found
+    long tier_false_positives(int tier) {
+        long fp = tier_bloom_positives[tier] - tier_found[tier];
+        return fp < 0 ? 0 : fp;
+    }
+
+    // Makes room at given tier for a new one, such as when idx1 rotates
+    void insert_tier(int tier) {
+        const int last = LOGGER_METRICS_MAX_TIERS - 1;
+        int count = tier_count;
+        if (tier >= last) {
+            tier_count = last + 1; // counted in last slot with the rest
+            return;
+        }
+        int move_from = count;
+        if (count > last) {
+            // tier moved to the last slot joins those already there
+            tier_lookups[last] += tier_lookups[last - 1];
+            tier_bloom_positives[last] += tier_bloom_positives[last - 1];
+            tier_found[last] += tier_found[last - 1];
+            move_from = last - 1;
+        }
+        for (int i = move_from; i > tier; i--) {
+            tier_lookups[i] = tier_lookups[i - 1].load();
+            tier_bloom_positives[i] = tier_bloom_positives[i - 1].load();
+            tier_found[i] = tier_found[i - 1].load();
+        }
+        tier_lookups[tier] = tier_bloom_positives[tier] = tier_found[tier] = 0;
+        tier_count = (count > last ? last + 1 : count + 1);
+    }
+
+    // Adds counts of given tier to the next and closes the gap,
+    // as when two segments are merged
+    void merge_tier(int tier) {
+        if (tier + 1 >= tier_count || tier + 1 >= LOGGER_METRICS_MAX_TIERS)
+            return;
+        tier_lookups[tier + 1] += tier_lookups[tier];
+        tier_bloom_positives[tier + 1] += tier_bloom_positives[tier];
+        tier_found[tier + 1] += tier_found[tier];
+        remove_tier(tier);
+    }
+
+    // Drops counts of given tier, as when a segment expires
+    void remove_tier(int tier) {
+        int count = tier_count;
+        // counts in the last slot cannot be told apart
+        if (tier >= count || tier >= LOGGER_METRICS_MAX_TIERS - 1)
+            return;
+        for (int i = tier; i < count - 1; i++) {
+            tier_lookups[i] = tier_lookups[i + 1].load();
+            tier_bloom_positives[i] = tier_bloom_positives[i + 1].load();
+            tier_found[i] = tier_found[i + 1].load();
+        }
+        tier_lookups[count - 1] = tier_bloom_positives[count - 1] = tier_found[count - 1] = 0;
+        tier_count = count - 1;
+    }
+
+    // One line per value, as name{label} value
+    void write(std::ostream& out, const char **tier_names) {
+        out << "logger_puts " << puts << "\n";
+        out << "logger_deletes " << deletes << "\n";
+        out << "logger_gets " << gets << "\n";
+        out << "logger_gets_found " << gets_found << "\n";
+        out << "logger_miss_cache_hits " << miss_cache_hits << "\n";
+        out << "logger_result_cache_hits " << result_cache_hits << "\n";
+        int count = tier_count;
+        for (int i = 0; i < count; i++) {
+            out << "logger_tier_lookups{tier=\"" << tier_names[i] << "\"} " << tier_lookups[i] << "\n";
+            out << "logger_tier_bloom_positives{tier=\"" << tier_names[i] << "\"} " << tier_bloom_positives[i] << "\n";
+            out << "logger_tier_bloom_false_positives{tier=\"" << tier_names[i] << "\"} " << tier_false_positives(i) << "\n";
+            out << "logger_tier_found{tier=\"" << tier_names[i] << "\"} " << tier_found[i] << "\n";
+        }
+        out << "logger_parallel_probes " << parallel_probes << "\n";
+        out << "logger_freezes " << freezes << "\n";
+        out << "logger_frozen_entries " << frozen_entries << "\n";
+        out << "logger_drained_tombstones " << drained_tombstones << "\n";
+        out << "logger_drain_descents " << drain_descents << "\n";
+        out << "logger_rotations " << rotations << "\n";
+        out << "logger_merges " << merges << "\n";
+        out << "logger_expired_segments " << expired_segments << "\n";
+        out << "logger_checkpoints " << checkpoints << "\n";
+        out << "logger_staging_flushes " << staging_flushes << "\n";
+        out << "logger_staging_pages_read " << staging_pages_read << "\n";
+        out << "logger_staging_bytes_written " << staging_bytes_written << "\n";
+        out << "logger_tier_flushes " << tier_flushes << "\n";
+        out << "logger_tier_pages_read " << tier_pages_read << "\n";
+        out << "logger_tier_bytes_written " << tier_bytes_written << "\n";
+    }
+
+};
+
+#endif
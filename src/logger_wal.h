@@ -0,0 +1,298 @@
+#ifndef LOGGER_WAL_H
+#define LOGGER_WAL_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#endif
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOGGER_WAL_MAGIC "LGRWAL01"
+#define LOGGER_WAL_HDR_SIZE 8
+// checksum, key length, flags and value length
+#define LOGGER_WAL_REC_HDR_SIZE 8
+#define LOGGER_WAL_TOMBSTONE 0x01
+
+// Append-only log of puts and deletes made to logger, so that entries
+// still only in cache pages of idx0 can be put again after a crash.
+// Records are gathered in memory and written with one fdatasync() by
+// a background thread once group_usec has passed since the first of
+// them or group_bytes have gathered, whichever comes first. The thread
+// sleeps while there are none. So at most about group_usec worth
+// of puts is lost, unless the caller waits with wait_durable().
+// If a group cannot be written, the file is cut back to where it was
+// and the error is thrown to waiters and to later appends, till
+// truncate() once the records are in the files of logger.
+// Each record is laid out as checksum (4 bytes), key length (1),
+// flags (1), value length (2, little endian), key and value.
+class logger_wal {
+    protected:
+        std::string name;
+        int fd;
+        std::string pending;
+        std::string writing;
+        long appended_seq;
+        long durable_seq;
+        long file_bytes;
+        // Read without the lock for metrics
+        std::atomic<long> bytes_written;
+        std::atomic<long> sync_count;
+        int group_usec;
+        int group_bytes;
+        // errno of the group that could not be written, 0 if none
+        int write_error;
+        bool is_writing;
+        bool is_sync_asked;
+        bool to_stop;
+        std::mutex wal_mutex;
+        std::condition_variable commit_cv;
+        std::condition_variable durable_cv;
+        std::thread committer;
+
+        // FNV-1a over everything after the checksum
+        static uint32_t calc_cksum(const uint8_t *data, int len) {
+            uint32_t h = 2166136261U;
+            for (int i = 0; i < len; i++) {
+                h ^= data[i];
+                h *= 16777619U;
+            }
+            return h;
+        }
+
+        static bool write_fully(int fd, const char *data, size_t len) {
+            while (len > 0) {
+                ssize_t count = write(fd, data, len);
+                if (count < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += count;
+                len -= count;
+            }
+            return true;
+        }
+
+        void commit_loop() {
+            std::unique_lock<std::mutex> lock(wal_mutex);
+            while (true) {
+                // idle with no timeout till a record comes, then gather
+                // for group_usec from it unless asked to write sooner
+                commit_cv.wait(lock, [this] {
+                    return to_stop || is_sync_asked || !pending.empty();
+                });
+                commit_cv.wait_for(lock, std::chrono::microseconds(group_usec), [this] {
+                    return to_stop || is_sync_asked || (int) pending.length() >= group_bytes;
+                });
+                if (pending.empty()) {
+                    is_sync_asked = false;
+                    durable_cv.notify_all();
+                    if (to_stop)
+                        return;
+                    continue;
+                }
+                writing.swap(pending);
+                long seq = appended_seq;
+                is_writing = true;
+                is_sync_asked = false;
+                lock.unlock();
+                bool is_ok = write_fully(fd, writing.data(), writing.length()) && fdatasync(fd) == 0;
+                int err = errno;
+                lock.lock();
+                if (!is_ok) {
+                    // Part of the group may be in the file. Groups after
+                    // it are not written either, as replay would skip
+                    // over the lost records to later ones
+                    perror("logger_wal");
+                    write_error = (err == 0 ? EIO : err);
+                    if (ftruncate(fd, file_bytes) == 0)
+                        lseek(fd, file_bytes, SEEK_SET);
+                    writing.clear();
+                    pending.clear();
+                    is_writing = false;
+                    durable_cv.notify_all();
+                    continue;
+                }
+                file_bytes += writing.length();
+                bytes_written += writing.length();
+                sync_count++;
+                writing.clear();
+                is_writing = false;
+                durable_seq = seq;
+                durable_cv.notify_all();
+            }
+        }
+
+    public:
+        logger_wal(const char *filename, int latency_usec, int batch_bytes) {
+            name = filename;
+            group_usec = latency_usec;
+            group_bytes = batch_bytes;
+            appended_seq = durable_seq = 0;
+            bytes_written = sync_count = 0;
+            write_error = 0;
+            is_writing = is_sync_asked = to_stop = false;
+            fd = open(filename, O_RDWR | O_CREAT, 0644);
+            if (fd == -1)
+                throw errno;
+            file_bytes = lseek(fd, 0, SEEK_END);
+            if (file_bytes < LOGGER_WAL_HDR_SIZE) {
+                if (ftruncate(fd, 0) || pwrite(fd, LOGGER_WAL_MAGIC, LOGGER_WAL_HDR_SIZE, 0) != LOGGER_WAL_HDR_SIZE)
+                    throw EIO;
+                fdatasync(fd);
+                file_bytes = LOGGER_WAL_HDR_SIZE;
+            }
+            lseek(fd, file_bytes, SEEK_SET);
+            committer = std::thread(&logger_wal::commit_loop, this);
+        }
+
+        ~logger_wal() {
+            {
+                std::lock_guard<std::mutex> lock(wal_mutex);
+                to_stop = true;
+            }
+            commit_cv.notify_all();
+            committer.join();
+            close(fd);
+        }
+
+        // Gives each record found to fn, oldest first. Stops at a torn or
+        // corrupt record, which is cut off along with anything after it.
+        // To be called before any append().
+        long replay(std::function<void(const uint8_t *, int, const uint8_t *, int, bool)> fn) {
+            std::lock_guard<std::mutex> lock(wal_mutex);
+            std::string data(file_bytes, '\0');
+            if (pread(fd, &data[0], file_bytes, 0) != file_bytes
+                    || memcmp(data.data(), LOGGER_WAL_MAGIC, LOGGER_WAL_HDR_SIZE) != 0) {
+                std::cout << "Ignoring unreadable WAL: " << name << std::endl;
+                if (ftruncate(fd, 0) || pwrite(fd, LOGGER_WAL_MAGIC, LOGGER_WAL_HDR_SIZE, 0) != LOGGER_WAL_HDR_SIZE)
+                    throw EIO;
+                fdatasync(fd);
+                file_bytes = LOGGER_WAL_HDR_SIZE;
+                lseek(fd, file_bytes, SEEK_SET);
+                return 0;
+            }
+            const uint8_t *d = (const uint8_t *) data.data();
+            long pos = LOGGER_WAL_HDR_SIZE;
+            long count = 0;
+            while (pos + LOGGER_WAL_REC_HDR_SIZE <= file_bytes) {
+                const uint8_t *rec = d + pos;
+                int key_len = rec[4];
+                int value_len = rec[6] | (rec[7] << 8);
+                int rec_len = LOGGER_WAL_REC_HDR_SIZE + key_len + value_len;
+                uint32_t cksum;
+                memcpy(&cksum, rec, 4);
+                if (pos + rec_len > file_bytes || cksum != calc_cksum(rec + 4, rec_len - 4))
+                    break;
+                fn(rec + LOGGER_WAL_REC_HDR_SIZE, key_len, rec + LOGGER_WAL_REC_HDR_SIZE + key_len,
+                        value_len, (rec[5] & LOGGER_WAL_TOMBSTONE) != 0);
+                pos += rec_len;
+                count++;
+            }
+            if (pos != file_bytes) {
+                std::cout << "Cutting off torn end of WAL: " << name << " at " << pos << std::endl;
+                if (ftruncate(fd, pos))
+                    throw EIO;
+                fdatasync(fd);
+                file_bytes = pos;
+                lseek(fd, file_bytes, SEEK_SET);
+            }
+            return count;
+        }
+
+        // Adds a record to be written with the next group.
+        // Returns its number for wait_durable(). Throws errno of
+        // a group that could not be written, till truncate()
+        long append(const uint8_t *key, int key_len, const uint8_t *value, int value_len, bool is_tombstone) {
+            uint8_t hdr[LOGGER_WAL_REC_HDR_SIZE];
+            hdr[4] = key_len;
+            hdr[5] = is_tombstone ? LOGGER_WAL_TOMBSTONE : 0;
+            hdr[6] = value_len & 0xFF;
+            hdr[7] = (value_len >> 8) & 0xFF;
+            std::lock_guard<std::mutex> lock(wal_mutex);
+            if (write_error)
+                throw write_error;
+            size_t rec_pos = pending.length();
+            pending.append((const char *) hdr, LOGGER_WAL_REC_HDR_SIZE);
+            pending.append((const char *) key, key_len);
+            if (value_len > 0)
+                pending.append((const char *) value, value_len);
+            uint8_t *rec = (uint8_t *) &pending[rec_pos];
+            uint32_t cksum = calc_cksum(rec + 4, pending.length() - rec_pos - 4);
+            memcpy(rec, &cksum, 4);
+            // first record of a group starts its time
+            if (rec_pos == 0 || (int) pending.length() >= group_bytes)
+                commit_cv.notify_one();
+            return ++appended_seq;
+        }
+
+        // Waits till record of given number is on disk.
+        // Throws errno if its group could not be written
+        void wait_durable(long seq) {
+            std::unique_lock<std::mutex> lock(wal_mutex);
+            while (durable_seq < seq && !write_error)
+                durable_cv.wait(lock);
+            if (durable_seq < seq)
+                throw write_error;
+        }
+
+        // Writes what is gathered now instead of waiting for group_usec
+        // and waits till it is on disk, throwing errno if it could not be
+        void sync() {
+            std::unique_lock<std::mutex> lock(wal_mutex);
+            long seq = appended_seq;
+            is_sync_asked = true;
+            commit_cv.notify_one();
+            while (durable_seq < seq && !write_error)
+                durable_cv.wait(lock);
+            if (durable_seq < seq)
+                throw write_error;
+        }
+
+        // Empties the log once all records so far are in the files
+        // of logger, which also clears any write error.
+        // Appends are not to be made meanwhile.
+        void truncate() {
+            std::unique_lock<std::mutex> lock(wal_mutex);
+            while (is_writing)
+                durable_cv.wait(lock);
+            pending.clear();
+            if (ftruncate(fd, LOGGER_WAL_HDR_SIZE))
+                throw EIO;
+            fdatasync(fd);
+            file_bytes = LOGGER_WAL_HDR_SIZE;
+            lseek(fd, file_bytes, SEEK_SET);
+            durable_seq = appended_seq;
+            write_error = 0;
+            durable_cv.notify_all();
+        }
+
+        // Bytes of records written since opened
+        long get_bytes_written() {
+            return bytes_written;
+        }
+
+        // Groups written, each with one fdatasync()
+        long get_sync_count() {
+            return sync_count;
+        }
+
+        // Bytes written and waiting to be written
+        long size() {
+            std::lock_guard<std::mutex> lock(wal_mutex);
+            return file_bytes + pending.length();
+        }
+
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LRUCACHE_H
 #define LRUCACHE_H
 #include <set>
+#include <list>
 #include <unordered_map>
 #include <iostream>
 #define _FILE_OFFSET_BITS 64
@@ -17,6 +18,11 @@
 #include <cstring>
 
 #define USE_FOPEN 1
+// Prints counters when a cache is closed, otherwise they are
+// to be read with get_cache_stats()
+#ifndef LRU_CACHE_PRINT_STATS
+#define LRU_CACHE_PRINT_STATS 0
+#endif
 
 using namespace std;
 
@@ -34,8 +40,13 @@ typedef struct {
     long pages_written;
     long pages_read;
     int last_pages_to_flush;
+    long ghost_hits;
 } cache_stats;
 
+// Redirects page reads and writes of a cache, for example to a write-ahead log
+typedef int (*page_read_fn)(void *ctx, uint8_t *block, off_t file_pos, size_t bytes);
+typedef void (*page_write_fn)(void *ctx, uint8_t *block, off_t file_pos, size_t bytes);
+
 class lru_cache {
 protected:
     int page_size;
@@ -50,6 +61,7 @@ protected:
     unordered_map<int, dbl_lnklst*> disk_to_cache_map;
     dbl_lnklst *llarr;
     set<int> new_pages;
+    unordered_map<int, uint8_t*> pinned_pages;
     const char *filename;
 #if USE_FOPEN == 1
     FILE *fp;
@@ -59,7 +71,40 @@ protected:
     size_t file_page_count;
     uint8_t empty;
     cache_stats stats;
+    page_read_fn page_reader;
+    page_write_fn page_writer;
+    void *page_io_ctx;
+    void *(*page_alloc_fn)(size_t);
+    // Pages evicted most recently, newest first. A miss on one of these
+    // would have been a hit with that many more pages in cache.
+    list<int> ghost_pages;
+    unordered_map<int, list<int>::iterator> ghost_map;
+    int ghost_size;
+    void add_ghost(int disk_page) {
+        if (ghost_size == 0)
+            return;
+        ghost_pages.push_front(disk_page);
+        ghost_map[disk_page] = ghost_pages.begin();
+        if (ghost_pages.size() > ghost_size) {
+            ghost_map.erase(ghost_pages.back());
+            ghost_pages.pop_back();
+        }
+    }
+    void check_ghost(int disk_page) {
+        if (ghost_map.empty())
+            return;
+        unordered_map<int, list<int>::iterator>::iterator it = ghost_map.find(disk_page);
+        if (it != ghost_map.end()) {
+            stats.ghost_hits++;
+            ghost_pages.erase(it->second);
+            ghost_map.erase(it);
+        }
+    }
     void write_page(uint8_t *block, off_t file_pos, size_t bytes, bool is_new = true) {
+        if (page_writer != NULL) {
+            page_writer(page_io_ctx, block, file_pos, bytes);
+            return;
+        }
         //if (is_new)
         //  fseek(fp, 0, SEEK_END);
         //else
@@ -145,6 +190,8 @@ public:
         cache_occupied_size = 0;
         lnklst_first_entry = lnklst_last_entry = NULL;
         filename = fname;
+        page_alloc_fn = alloc_fn;
+        ghost_size = 0;
         page_cache = (uint8_t *) alloc_fn(pg_size * page_count);
         root_block = (uint8_t *) alloc_fn(pg_size);
         llarr = (dbl_lnklst *) alloc_fn(page_count * sizeof(dbl_lnklst));
@@ -174,20 +221,29 @@ public:
         file_page_count = file_stat.st_size;
         if (file_page_count > 0)
            file_page_count /= page_size;
+#if LRU_CACHE_PRINT_STATS == 1
         cout << "File page count: " << file_page_count << endl;
+#endif
         empty = 0;
+        page_reader = NULL;
+        page_writer = NULL;
+        page_io_ctx = NULL;
+        off_t root_pos = page_size;
+        root_pos *= skip_page_count;
 #if USE_FOPEN == 1
+        fseek(fp, root_pos, SEEK_SET);
         if (fread(root_block, 1, page_size, fp) != page_size) {
-            file_page_count = 1;
-            fseek(fp, 0, SEEK_SET);
+            file_page_count = skip_page_count + 1;
+            fseek(fp, root_pos, SEEK_SET);
             if (fwrite(root_block, 1, page_size, fp) != page_size)
               throw EIO;
             empty = 1;
         }
 #else
+        lseek(fd, root_pos, SEEK_SET);
         if (read(fd, root_block, page_size) != page_size) {
-            file_page_count = 1;
-            lseek(fd, 0, SEEK_SET);
+            file_page_count = skip_page_count + 1;
+            lseek(fd, root_pos, SEEK_SET);
             if (write(fd, root_block, page_size) != page_size)
               throw EIO;
             empty = 1;
@@ -207,7 +263,15 @@ public:
         }
         write_pages(pages_to_write);
         free(page_cache);
-        write_page(root_block, 0, page_size);
+        off_t root_pos = page_size;
+        root_pos *= skip_page_count;
+        write_page(root_block, root_pos, page_size);
+        for (unordered_map<int, uint8_t*>::iterator it = pinned_pages.begin(); it != pinned_pages.end(); it++) {
+            off_t file_pos = page_size;
+            file_pos *= it->first;
+            write_page(it->second, file_pos, page_size);
+            free(it->second);
+        }
 #if USE_FOPEN == 1
         fclose(fp);
 #else
@@ -215,13 +279,20 @@ public:
 #endif
         free(root_block);
         free(llarr);
+#if LRU_CACHE_PRINT_STATS == 1
         cout << "total_cache_requests: " << " " << stats.total_cache_req << endl;
         cout << "total_cache_misses: " << " " << stats.total_cache_misses << endl;
         cout << "cache_flush_count: " << " " << stats.cache_flush_count << endl;
+#endif
     }
     uint8_t *get_disk_page_in_cache(int disk_page, uint8_t *block_to_keep = NULL, bool is_new = false) {
         if (disk_page == skip_page_count)
             return root_block;
+        if (!pinned_pages.empty()) {
+            unordered_map<int, uint8_t*>::iterator it = pinned_pages.find(disk_page);
+            if (it != pinned_pages.end())
+                return it->second;
+        }
         int cache_pos = 0;
         int removed_disk_page = 0;
         if (disk_to_cache_map.find(disk_page) == disk_to_cache_map.end()) {
@@ -274,6 +345,7 @@ public:
                     //  fflush(fp);
                     //}
                 removed_disk_page = entry_to_move->disk_page;
+                add_ghost(removed_disk_page);
                 cache_pos = entry_to_move->cache_loc;
                 //if (!is_new)
                   move_to_front(entry_to_move);
@@ -284,8 +356,13 @@ public:
                 stats.total_cache_req++;
             }
             if (!is_new && new_pages.find(disk_page) == new_pages.end()) {
+                check_ghost(disk_page);
                 off_t file_pos = page_size;
                 file_pos *= disk_page;
+                if (page_reader != NULL) {
+                    if (page_reader(page_io_ctx, &page_cache[page_size * cache_pos], file_pos, page_size) != page_size)
+                        perror("read");
+                } else
 #if USE_FOPEN == 1
                 if (!fseek(fp, file_pos, SEEK_SET)) {
                     int read_count = fread(&page_cache[page_size * cache_pos], 1, page_size, fp);
@@ -331,6 +408,168 @@ public:
         file_page_count++;
         return new_page;
     }
+    // Keeps given page outside the LRU list, like root_block, so that
+    // several trees sharing this cache can each hold a stable root.
+    // Pages beyond end of file are zeroed and the file extended.
+    uint8_t *pin_page(int disk_page) {
+        if (disk_page == skip_page_count) {
+            if (disk_page >= file_page_count)
+                file_page_count = disk_page + 1;
+            return root_block;
+        }
+        unordered_map<int, uint8_t*>::iterator it = pinned_pages.find(disk_page);
+        if (it != pinned_pages.end())
+            return it->second;
+        uint8_t *block = (uint8_t *) malloc(page_size);
+        if (block == NULL)
+            throw ENOMEM;
+        if (disk_page < file_page_count) {
+            off_t file_pos = page_size;
+            file_pos *= disk_page;
+            if (read_page(block, file_pos, page_size) != page_size)
+                throw EIO;
+        } else {
+            memset(block, '\0', page_size);
+            file_page_count = disk_page + 1;
+        }
+        pinned_pages[disk_page] = block;
+        return block;
+    }
+    int read_page(uint8_t *block, off_t file_pos, size_t bytes) {
+        if (page_reader != NULL) {
+            stats.pages_read++;
+            return page_reader(page_io_ctx, block, file_pos, bytes);
+        }
+#if USE_FOPEN == 1
+        if (fseek(fp, file_pos, SEEK_SET))
+            return 0;
+        int read_count = fread(block, 1, bytes, fp);
+#else
+        if (lseek(fd, file_pos, SEEK_SET) == -1)
+            return 0;
+        int read_count = read(fd, block, bytes);
+#endif
+        stats.pages_read++;
+        return read_count;
+    }
+    // Pages are read and written through given functions from here on
+    // Passing NULL goes back to the file
+    void set_page_io(page_read_fn read_fn, page_write_fn write_fn, void *ctx) {
+#if USE_FOPEN == 1
+        fflush(fp);
+#endif
+        page_reader = read_fn;
+        page_writer = write_fn;
+        page_io_ctx = ctx;
+    }
+    // Writes all changed and new pages, root and pinned pages
+    // while keeping them in cache
+    void flush_all() {
+        set<int> pages_to_write(new_pages);
+        for (unordered_map<int, dbl_lnklst*>::iterator it = disk_to_cache_map.begin(); it != disk_to_cache_map.end(); it++) {
+            uint8_t *block = &page_cache[page_size * it->second->cache_loc];
+            if (block[0] & 0x40) // is it changed
+                pages_to_write.insert(it->first);
+        }
+        new_pages.clear();
+        write_pages(pages_to_write);
+        off_t root_pos = page_size;
+        root_pos *= skip_page_count;
+        write_page(root_block, root_pos, page_size);
+        for (unordered_map<int, uint8_t*>::iterator it = pinned_pages.begin(); it != pinned_pages.end(); it++) {
+            off_t file_pos = page_size;
+            file_pos *= it->first;
+            write_page(it->second, file_pos, page_size);
+        }
+#if USE_FOPEN == 1
+        fflush(fp);
+#endif
+    }
+    // Changes number of pages cached, to be called between operations
+    // on the tree as page pointers handed out earlier become invalid.
+    // When shrinking, pages of slots beyond the new size are written
+    // if changed and let go. Returns false if memory is not available.
+    bool resize(int page_count) {
+        if (page_count < 1 || page_count == cache_size_in_pages)
+            return page_count >= 1;
+        uint8_t *new_cache = (uint8_t *) page_alloc_fn((size_t) page_size * page_count);
+        dbl_lnklst *new_llarr = (dbl_lnklst *) page_alloc_fn(page_count * sizeof(dbl_lnklst));
+        if (new_cache == NULL || new_llarr == NULL) {
+            free(new_cache);
+            free(new_llarr);
+            return false;
+        }
+        if (page_count < cache_occupied_size) {
+            set<int> pages_to_write;
+            for (int i = page_count; i < cache_occupied_size; i++) {
+                uint8_t *block = &page_cache[page_size * i];
+                if ((block[0] & 0x40) || new_pages.find(llarr[i].disk_page) != new_pages.end())
+                    pages_to_write.insert(llarr[i].disk_page);
+            }
+            write_pages(pages_to_write);
+            for (int i = page_count; i < cache_occupied_size; i++) {
+                dbl_lnklst *entry = &llarr[i];
+                if (entry->prev != NULL)
+                    entry->prev->next = entry->next;
+                else
+                    lnklst_first_entry = entry->next;
+                if (entry->next != NULL)
+                    entry->next->prev = entry->prev;
+                else
+                    lnklst_last_entry = entry->prev;
+                new_pages.erase(entry->disk_page);
+                disk_to_cache_map.erase(entry->disk_page);
+                add_ghost(entry->disk_page);
+            }
+            cache_occupied_size = page_count;
+        }
+        // Slot i is always at llarr[i], so links are moved by offset
+        memcpy(new_cache, page_cache, (size_t) page_size * cache_occupied_size);
+        for (int i = 0; i < cache_occupied_size; i++) {
+            new_llarr[i] = llarr[i];
+            if (llarr[i].prev != NULL)
+                new_llarr[i].prev = new_llarr + (llarr[i].prev - llarr);
+            if (llarr[i].next != NULL)
+                new_llarr[i].next = new_llarr + (llarr[i].next - llarr);
+            disk_to_cache_map[new_llarr[i].disk_page] = &new_llarr[i];
+        }
+        if (lnklst_first_entry != NULL) {
+            lnklst_first_entry = new_llarr + (lnklst_first_entry - llarr);
+            lnklst_last_entry = new_llarr + (lnklst_last_entry - llarr);
+        }
+        lnklst_last_free = NULL;
+        free(page_cache);
+        free(llarr);
+        page_cache = new_cache;
+        llarr = new_llarr;
+        cache_size_in_pages = page_count;
+        calc_flush_count();
+        return true;
+    }
+    // Number of evicted pages to remember for counting ghost_hits,
+    // that is how many more hits a cache bigger by that much would get
+    void set_ghost_size(int page_count) {
+        ghost_size = page_count;
+        while (ghost_pages.size() > ghost_size) {
+            ghost_map.erase(ghost_pages.back());
+            ghost_pages.pop_back();
+        }
+    }
+    // Makes pages written so far durable, such as before letting go
+    // of a log of the changes in them
+    bool sync_file() {
+#if USE_FOPEN == 1
+        return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+#else
+        return fsync(fd) == 0;
+#endif
+    }
+    int get_cache_size() {
+        return cache_size_in_pages;
+    }
+    int get_page_size() {
+        return page_size;
+    }
     int get_page_count() {
         return file_page_count;
     }
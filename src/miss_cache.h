@@ -0,0 +1,86 @@
+#ifndef MISS_CACHE_H
+#define MISS_CACHE_H
+#ifndef ARDUINO
+#include <cstdlib>
+#include <cstring>
+#endif
+#include <stdint.h>
+#include <errno.h>
+#include "key_hash.h"
+
+// Entries of a bucket, filling one 64 byte cache line
+#define MISS_CACHE_WAYS 8
+
+// Hashes of keys recently looked up and not found, so that looking
+// them up again takes one cache line read. Kept in buckets of
+// MISS_CACHE_WAYS hashes and when a bucket is full, the hash picks
+// which one to replace. A key put afterwards is to be removed with
+// forget(). Zero marks an empty slot, so a key hashing to zero is
+// never remembered.
+class miss_cache {
+    protected:
+        uint64_t *slots;
+        uint32_t bucket_mask;
+        long hits;
+
+        uint64_t *find_bucket(uint64_t h) {
+            return slots + (size_t) ((h >> 32) & bucket_mask) * MISS_CACHE_WAYS;
+        }
+
+    public:
+        // Holds 2 ^ bucket_bits buckets
+        miss_cache(int bucket_bits) {
+            bucket_mask = (1U << bucket_bits) - 1;
+            size_t bytes = (size_t) (bucket_mask + 1) * MISS_CACHE_WAYS * 8;
+            if (posix_memalign((void **) &slots, 64, bytes))
+                throw ENOMEM;
+            memset(slots, '\0', bytes);
+            hits = 0;
+        }
+
+        ~miss_cache() {
+            free(slots);
+        }
+
+        bool contains(uint64_t h) {
+            if (h == 0)
+                return false;
+            uint64_t *bucket = find_bucket(h);
+            for (int i = 0; i < MISS_CACHE_WAYS; i++) {
+                if (bucket[i] == h) {
+                    hits++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void add(uint64_t h) {
+            if (h == 0)
+                return;
+            uint64_t *bucket = find_bucket(h);
+            int empty_way = -1;
+            for (int i = 0; i < MISS_CACHE_WAYS; i++) {
+                if (bucket[i] == h)
+                    return;
+                if (bucket[i] == 0 && empty_way == -1)
+                    empty_way = i;
+            }
+            bucket[empty_way >= 0 ? empty_way : (h & (MISS_CACHE_WAYS - 1))] = h;
+        }
+
+        void forget(uint64_t h) {
+            uint64_t *bucket = find_bucket(h);
+            for (int i = 0; i < MISS_CACHE_WAYS; i++) {
+                if (bucket[i] == h)
+                    bucket[i] = 0;
+            }
+        }
+
+        long get_hits() {
+            return hits;
+        }
+
+};
+
+#endif
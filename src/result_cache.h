@@ -0,0 +1,168 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+#ifndef ARDUINO
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#endif
+#include <stdint.h>
+
+// Values of keys looked up lately, kept within a byte budget and let
+// go by CLOCK: entries found since the hand last passed get another
+// round, others are removed. Keys are found by their 64 bit hash
+// given by the caller and then compared in full.
+class result_cache {
+    protected:
+        struct cache_entry {
+            uint64_t h;
+            std::string key;
+            std::string value;
+            bool is_used;
+            bool is_referenced;
+        };
+        std::vector<cache_entry> entries;
+        std::vector<int> free_entries;
+        std::unordered_map<uint64_t, int> entry_map;
+        size_t clock_hand;
+        long bytes_used;
+        long byte_budget;
+        long hits;
+
+        // Approximate memory held, including the map node
+        static long entry_bytes(const cache_entry& e) {
+            return e.key.length() + e.value.length() + sizeof(cache_entry) + 32;
+        }
+
+        int find(uint64_t h, const uint8_t *key, int key_len) {
+            std::unordered_map<uint64_t, int>::iterator it = entry_map.find(h);
+            if (it == entry_map.end())
+                return -1;
+            cache_entry& e = entries[it->second];
+            if (e.key.length() != key_len || memcmp(e.key.data(), key, key_len) != 0)
+                return -1;
+            return it->second;
+        }
+
+        void remove_at(int idx) {
+            cache_entry& e = entries[idx];
+            bytes_used -= entry_bytes(e);
+            entry_map.erase(e.h);
+            e.is_used = false;
+            e.key.clear();
+            e.value.clear();
+            e.key.shrink_to_fit();
+            e.value.shrink_to_fit();
+            free_entries.push_back(idx);
+        }
+
+        void evict() {
+            while (bytes_used > byte_budget && !entry_map.empty()) {
+                if (clock_hand >= entries.size())
+                    clock_hand = 0;
+                cache_entry& e = entries[clock_hand];
+                if (e.is_used) {
+                    if (e.is_referenced)
+                        e.is_referenced = false;
+                    else
+                        remove_at(clock_hand);
+                }
+                clock_hand++;
+            }
+        }
+
+    public:
+        result_cache(long budget) {
+            byte_budget = budget;
+            bytes_used = 0;
+            clock_hand = 0;
+            hits = 0;
+        }
+
+        // Copies value of key if cached, not more than *in_size_out_value_len
+        // bytes and gives its length there
+        bool get(uint64_t h, const uint8_t *key, int key_len, int *in_size_out_value_len, uint8_t *val) {
+            int idx = find(h, key, key_len);
+            if (idx == -1)
+                return false;
+            cache_entry& e = entries[idx];
+            e.is_referenced = true;
+            hits++;
+            if (in_size_out_value_len != NULL) {
+                int v_len = e.value.length();
+                if (v_len > *in_size_out_value_len)
+                    v_len = *in_size_out_value_len;
+                if (val != NULL)
+                    memcpy(val, e.value.data(), v_len);
+                *in_size_out_value_len = v_len;
+            }
+            return true;
+        }
+
+        // Adds key, or another key of same hash is replaced
+        void add(uint64_t h, const uint8_t *key, int key_len, const uint8_t *value, int value_len) {
+            std::unordered_map<uint64_t, int>::iterator it = entry_map.find(h);
+            if (it != entry_map.end())
+                remove_at(it->second);
+            int idx;
+            if (free_entries.empty()) {
+                idx = entries.size();
+                entries.resize(idx + 1);
+            } else {
+                idx = free_entries.back();
+                free_entries.pop_back();
+            }
+            cache_entry& e = entries[idx];
+            e.h = h;
+            e.key.assign((const char *) key, key_len);
+            e.value.assign((const char *) value, value_len);
+            e.is_used = true;
+            e.is_referenced = false;
+            entry_map[h] = idx;
+            bytes_used += entry_bytes(e);
+            evict();
+        }
+
+        // Changes value if key is cached
+        void update(uint64_t h, const uint8_t *key, int key_len, const uint8_t *value, int value_len) {
+            int idx = find(h, key, key_len);
+            if (idx == -1)
+                return;
+            cache_entry& e = entries[idx];
+            bytes_used -= entry_bytes(e);
+            e.value.assign((const char *) value, value_len);
+            bytes_used += entry_bytes(e);
+            evict();
+        }
+
+        void remove(uint64_t h, const uint8_t *key, int key_len) {
+            int idx = find(h, key, key_len);
+            if (idx != -1)
+                remove_at(idx);
+        }
+
+        // Lets go of all entries, such as when values they hold may be
+        // gone from where they were found
+        void clear() {
+            entries.clear();
+            free_entries.clear();
+            entry_map.clear();
+            clock_hand = 0;
+            bytes_used = 0;
+        }
+
+        long get_bytes_used() {
+            return bytes_used;
+        }
+
+        long get_hits() {
+            return hits;
+        }
+
+        long size() {
+            return entry_map.size();
+        }
+
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SHARDED_LOGGER_H
+#define SHARDED_LOGGER_H
+#ifndef ARDUINO
+#include <string>
+#include <vector>
+#include <mutex>
+#include <functional>
+#endif
+#include <stdint.h>
+#include <errno.h>
+#include "logger.h"
+#include "key_hash.h"
+
+// Keys are spread over shards by a hash seeded apart from the one
+// used within each logger, so that each shard sees all of its
+// sketch and cache buckets
+#define SHARDED_LOGGER_SEED 0x2545f4914f6cdd1dULL
+
+// Loggers that each take the keys hashing to them, in files named
+// <name>.s<n>, so that puts from many threads go on side by side.
+// Each shard has its own idx0, drain and compact threads and WAL and
+// is used by one thread at a time. Threads putting keys of different
+// shards do not wait for each other. Cache sizes given are for each
+// shard.
+class sharded_logger {
+    protected:
+        struct logger_shard {
+            std::mutex shard_mutex;
+            logger *lgr;
+        };
+        std::vector<logger_shard *> shards;
+
+        logger_shard *find_shard(const uint8_t *key, uint8_t key_len) {
+            uint64_t h = key_hash::mix(key_hash::of(key, key_len) ^ SHARDED_LOGGER_SEED);
+            return shards[h % shards.size()];
+        }
+
+        static std::string shard_name(const char *fname, int shard_no) {
+            std::string name = fname;
+            name += ".s";
+            name += std::to_string(shard_no);
+            return name;
+        }
+
+    public:
+        sharded_logger(const char *fname, size_t cache_size_mb, int shard_count) {
+            if (shard_count <= 0)
+                throw EINVAL;
+            for (int i = 0; i < shard_count; i++) {
+                logger_shard *shard = new logger_shard;
+                shard->lgr = new logger(shard_name(fname, i).c_str(), cache_size_mb);
+                shards.push_back(shard);
+            }
+        }
+
+        sharded_logger(const char *fname, size_t cache_size_mb, int shard_count,
+                const std::vector<logger_tier_config>& tier_configs) {
+            if (shard_count <= 0)
+                throw EINVAL;
+            for (int i = 0; i < shard_count; i++) {
+                logger_shard *shard = new logger_shard;
+                shard->lgr = new logger(shard_name(fname, i).c_str(), cache_size_mb, tier_configs);
+                shards.push_back(shard);
+            }
+        }
+
+        ~sharded_logger() {
+            for (size_t i = 0; i < shards.size(); i++) {
+                delete shards[i]->lgr;
+                delete shards[i];
+            }
+        }
+
+        bool put(const char *key, uint8_t key_len, const char *value, int value_len) {
+            return put((const uint8_t *) key, key_len, (const uint8_t *) value, value_len);
+        }
+
+        bool put(const uint8_t *key, uint8_t key_len, const uint8_t *value, int value_len) {
+            logger_shard *shard = find_shard(key, key_len);
+            std::lock_guard<std::mutex> lock(shard->shard_mutex);
+            return shard->lgr->put(key, key_len, value, value_len);
+        }
+
+        bool del(const char *key, uint8_t key_len) {
+            return del((const uint8_t *) key, key_len);
+        }
+
+        bool del(const uint8_t *key, uint8_t key_len) {
+            logger_shard *shard = find_shard(key, key_len);
+            std::lock_guard<std::mutex> lock(shard->shard_mutex);
+            return shard->lgr->del(key, key_len);
+        }
+
+        bool get(const char *key, uint8_t key_len, int *out_value_len, char *val) {
+            return get((const uint8_t *) key, key_len, out_value_len, (uint8_t *) val);
+        }
+
+        bool get(const uint8_t *key, uint8_t key_len, int *in_size_out_value_len, uint8_t *val) {
+            logger_shard *shard = find_shard(key, key_len);
+            std::lock_guard<std::mutex> lock(shard->shard_mutex);
+            return shard->lgr->get(key, key_len, in_size_out_value_len, val);
+        }
+
+        // Gives entries from start_key on to fn in key order over all
+        // shards, newest value of each and leaving out deleted keys,
+        // till fn returns false or there are no more. All shards are
+        // locked meanwhile, so puts from other threads wait till done.
+        // Returns number of entries given.
+        long scan(const uint8_t *start_key, int start_len,
+                std::function<bool(const uint8_t *, int, const uint8_t *, int)> fn) {
+            std::vector<std::unique_lock<std::mutex> > locks;
+            std::vector<tier_merger *> mergers;
+            std::vector<bool> has_entry;
+            for (size_t i = 0; i < shards.size(); i++) {
+                locks.push_back(std::unique_lock<std::mutex>(shards[i]->shard_mutex));
+                mergers.push_back(shards[i]->lgr->iterate(start_key, start_len));
+                has_entry.push_back(mergers[i]->next());
+            }
+            long count = 0;
+            while (true) {
+                // keys of shards do not overlap, so least of all is next
+                int least = -1;
+                int least_len = 0;
+                const uint8_t *least_key = NULL;
+                for (size_t i = 0; i < mergers.size(); i++) {
+                    if (!has_entry[i])
+                        continue;
+                    int key_len;
+                    const uint8_t *key = mergers[i]->get_key(key_len);
+                    if (least == -1 || util::compare(key, key_len, least_key, least_len) < 0) {
+                        least = i;
+                        least_key = key;
+                        least_len = key_len;
+                    }
+                }
+                if (least == -1)
+                    break;
+                int value_len;
+                const uint8_t *value = mergers[least]->get_value(value_len);
+                count++;
+                if (!fn(least_key, least_len, value, value_len))
+                    break;
+                has_entry[least] = mergers[least]->next();
+            }
+            for (size_t i = 0; i < mergers.size(); i++)
+                delete mergers[i];
+            return count;
+        }
+
+        // Writes out all shards so that their WALs can start afresh
+        void checkpoint() {
+            for (size_t i = 0; i < shards.size(); i++) {
+                std::lock_guard<std::mutex> lock(shards[i]->shard_mutex);
+                shards[i]->lgr->checkpoint();
+            }
+        }
+
+        int get_shard_count() {
+            return shards.size();
+        }
+
+        // For metrics of each shard. Not to be used for puts or gets
+        // while other threads are using the shard
+        logger *get_shard(int shard_no) {
+            return shards[shard_no]->lgr;
+        }
+
+};
+
+#endif
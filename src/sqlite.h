@@ -5,8 +5,10 @@
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <vector>
 #endif
 #include "bplus_tree_handler.h"
+#include "sqlite_wal.h"
 
 // TODO: decide whether needed
 #define page_resv_bytes 5 
@@ -25,11 +27,36 @@ enum {SQLT_RES_SEEK_ERR = -6, SQLT_RES_READ_ERR = -7,
   SQLT_RES_TYPE_MISMATCH = -12, SQLT_RES_INV_CHKSUM = -13,
   SQLT_RES_NEED_1_PK = -14, SQLT_RES_NO_SPACE = -15};
 
+// Describes one b-tree listed in sqlite_master, used when
+// several tables and indexes share one file
+typedef struct {
+    std::string type; // "table" or "index"
+    std::string name;
+    std::string tbl_name;
+    int root_page; // 1 based as in sqlite_master
+    std::string col_names; // for index, the indexed columns
+    int pk_col_count;
+} sqlite_master_entry;
+
 // CRTP see https://en.wikipedia.org/wiki/Curiously_recurring_template_pattern
 class sqlite : public bplus_tree_handler<sqlite> {
 
     private:
         int U,X,M;
+        // Types of primary key columns if fixed for the schema, see set_pk_col_types()
+        std::vector<uint8_t> pk_col_types;
+        // Set by enable_wal()
+        sqlite_wal *wal;
+
+        static int wal_read_page(void *ctx, uint8_t *block, off_t file_pos, size_t bytes) {
+            sqlite_wal *wal = (sqlite_wal *) ctx;
+            return wal->read_page(file_pos / wal->get_page_size() + 1, block);
+        }
+
+        static void wal_write_page(void *ctx, uint8_t *block, off_t file_pos, size_t bytes) {
+            sqlite_wal *wal = (sqlite_wal *) ctx;
+            wal->write_page(file_pos / wal->get_page_size() + 1, block);
+        }
         // Returns type of column based on given value and length
         // See https://www.sqlite.org/fileformat.html#record_format
         uint32_t derive_col_type_or_len(int type, const void *val, int len) {
@@ -209,119 +236,14 @@ class sqlite : public bplus_tree_handler<sqlite> {
         // Writes data into buffer to form first page of Sqlite db
         int write_page0(int total_col_count, int pk_col_count,
             const std::string& col_names, const std::string& table_name = {}) {
-
-            int block_size = leaf_block_size;
-            if (block_size % 512 || block_size < 512 || block_size > 65536)
-                throw SQLT_RES_INV_PAGE_SZ;
-
-            master_block = (uint8_t *) malloc(block_size);
-            current_block = master_block;
-
-            // 100 uint8_t header - refer https://www.sqlite.org/fileformat.html
-            memcpy(current_block, "SQLite format 3\0", 16);
-            util::write_uint16(current_block + 16, block_size == 65536 ? 1 : (uint16_t) block_size);
-            current_block[18] = 1;
-            current_block[19] = 1;
-            current_block[20] = page_resv_bytes;
-            current_block[21] = 64;
-            current_block[22] = 32;
-            current_block[23] = 32;
-            //write_uint32(current_block + 24, 0);
-            //write_uint32(current_block + 28, 0);
-            //write_uint32(current_block + 32, 0);
-            //write_uint32(current_block + 36, 0);
-            //write_uint32(current_block + 40, 0);
-            memset(current_block + 24, '\0', 20); // Set to zero, above 5
-            util::write_uint32(current_block + 28, 2); // TODO: Update during finalize
-            util::write_uint32(current_block + 44, 4);
-            //write_uint16(current_block + 48, 0);
-            //write_uint16(current_block + 52, 0);
-            memset(current_block + 48, '\0', 8); // Set to zero, above 2
-            util::write_uint32(current_block + 56, 1);
-            // User version initially 0, set to table leaf count
-            // used to locate last leaf page for binary search
-            // and move to last page.
-            util::write_uint32(current_block + 60, 0);
-            util::write_uint32(current_block + 64, 0);
-            // App ID - set to 0xA5xxxxxx where A5 is signature
-            // till it is implemented
-            util::write_uint32(current_block + 68, 0xA5000000);
-            memset(current_block + 72, '\0', 20); // reserved space
-            util::write_uint32(current_block + 92, 105);
-            util::write_uint32(current_block + 96, 3016000);
-            memset(current_block + 100, '\0', block_size - 100); // Set remaining page to zero
-
-            // master table b-tree
-            init_bt_tbl_leaf(current_block + 100);
-
-            // write table script record
-            std::string tbl_name = "idx1";
-            if (!table_name.empty())
-                tbl_name = table_name;
-            // write table script record
-            int col_count = 5;
-            // if (table_script) {
-            //     uint16_t script_len = strlen(table_script);
-            //     if (script_len > block_size - 100 - page_resv_bytes - 8 - 10)
-            //         return SQLT_RES_TOO_LONG;
-            //     set_col_val(4, SQLT_TYPE_TEXT, table_script, script_len);
-            // } else {
-                int table_name_len = tbl_name.length();
-                // len("CREATE TABLE ") + table_name_len + len(" (")
-                //    + len("PRIMARY KEY (") + len(") WITHOUT ROWID")
-                size_t script_len = 13 + table_name_len + 2 + 13 + 15;
-                script_len += col_names.length();
-                script_len += 2; // len(", ")
-                int pk_end_pos = 0;
-                for (int i = 0, comma_count = 0; i < col_names.length(); i++) {
-                    if (col_names[i] == ',')
-                        comma_count++;
-                    if (comma_count == pk_col_count) {
-                        pk_end_pos = i;
-                        break;
-                    }
-                }
-                if (pk_end_pos == 0)
-                    pk_end_pos = col_names.length();
-                script_len += pk_end_pos;
-                script_len++; // len(")")
-                // 100 byte header, 2 byte ptr, 3 byte rec/hdr vlen, 1 byte rowid
-                // 6 byte hdr len, 5 byte "table", twice table name, 4 byte uint32 root
-                if (script_len > (block_size - 100 - page_resv_bytes - blk_hdr_len
-                        - 2 - 3 - 1 - 6 - 5 - tbl_name.length() * 2 - 4))
-                    return SQLT_RES_TOO_LONG;
-                uint8_t *script_loc = current_block + block_size - page_resv_bytes - script_len;
-                uint8_t *script_pos = script_loc;
-                memcpy(script_pos, "CREATE TABLE ", 13);
-                script_pos += 13;
-                memcpy(script_pos, tbl_name.c_str(), table_name_len);
-                script_pos += table_name_len;
-                *script_pos++ = ' ';
-                *script_pos++ = '(';
-                memcpy(script_pos, col_names.c_str(), col_names.length());
-                script_pos += col_names.length();
-                *script_pos++ = ',';
-                *script_pos++ = ' ';
-                memcpy(script_pos, "PRIMARY KEY (", 13);
-                script_pos += 13;
-                memcpy(script_pos, col_names.c_str(), pk_end_pos);
-                script_pos += pk_end_pos;
-                *script_pos++ = ')';
-                memcpy(script_pos, ") WITHOUT ROWID", 15);
-                script_pos += 15;
-            // }
-            int32_t root_page_no = 2;
-            const void *master_rec_values[] = {"table", tbl_name.c_str(), tbl_name.c_str(), &root_page_no, script_loc};
-            const size_t master_rec_col_lens[] = {5, table_name.length(), table_name.length(), sizeof(root_page_no), script_len};
-            const uint8_t master_rec_col_types[] = {SQLT_TYPE_TEXT, SQLT_TYPE_TEXT, SQLT_TYPE_TEXT, SQLT_TYPE_INT32, SQLT_TYPE_TEXT};
-            int res = write_new_rec(0, 1, 5, master_rec_values, master_rec_col_lens, master_rec_col_types);
-            if (res < 0)
-               return res;
-
-            cache->write_page(master_block, 0, block_size);
-
-            return SQLT_RES_OK;
-
+            std::vector<sqlite_master_entry> entries(1);
+            entries[0].type = "table";
+            entries[0].name = table_name.empty() ? "idx1" : table_name;
+            entries[0].tbl_name = entries[0].name;
+            entries[0].root_page = 2;
+            entries[0].col_names = col_names;
+            entries[0].pk_col_count = pk_col_count;
+            return write_page0(entries);
         }
 
         static int64_t cvt_to_int64(const uint8_t *ptr, int type) {
@@ -416,6 +338,7 @@ class sqlite : public bplus_tree_handler<sqlite> {
             X = ((U-12)*64/255)-23;
             M = ((U-12)*32/255)-23;
             master_block = NULL;
+            wal = NULL;
             if (cache_size > 0) {
                 if (cache->is_empty()) {
                     int res = write_page0(column_count, pk_count, column_names, table_name);
@@ -430,25 +353,98 @@ class sqlite : public bplus_tree_handler<sqlite> {
             set_current_block_root();
         }
 
-        uint8_t *locate_col(int which_col, uint8_t *rec, int& col_type_or_len, int& col_len, int& col_type) {
+        static void decode_serial_type(uint32_t serial_type, int& col_len, int& col_type) {
+            if (serial_type >= 12) {
+                col_len = (serial_type - 12) >> 1;
+                col_type = (serial_type % 2 ? SQLT_TYPE_TEXT : SQLT_TYPE_BLOB);
+            } else {
+                col_len = col_data_lens[serial_type];
+                col_type = serial_type;
+            }
+        }
+
+        // Compares primary key columns using types fixed for the schema
+        // so that types are not derived and converted for every column.
+        // Integers are compared as signed as Sqlite does.
+        // If a record does not carry the expected type for a column,
+        // that column is compared using compare_col()
+        int compare_keys_by_plan(const uint8_t *rec1, const uint8_t *rec2) {
             int8_t vlen;
-            int hdr_len = util::read_vint32(rec, &vlen);
-            int hdr_pos = vlen;
-            uint8_t *data_ptr = rec + hdr_len;
-            col_len = vlen = 0;
-            do {
-                data_ptr += col_len;
-                hdr_pos += vlen;
-                if (hdr_pos >= hdr_len)
-                    return NULL;
-                col_type_or_len = util::read_vint32(rec + hdr_pos, &vlen);
-                col_len = derive_data_len(col_type_or_len);
-                col_type = derive_col_type(col_type_or_len);
-            } while (which_col--);
-            return data_ptr;
+            const uint8_t *hdr1 = rec1;
+            const uint8_t *data1 = rec1 + util::read_vint32(hdr1, &vlen);
+            hdr1 += vlen;
+            const uint8_t *hdr2 = rec2;
+            const uint8_t *data2 = rec2 + util::read_vint32(hdr2, &vlen);
+            hdr2 += vlen;
+            const uint8_t *col_type_ptr = pk_col_types.data();
+            for (int i = 0; i < pk_count; i++) {
+                int col_type = *col_type_ptr++;
+                int cmp = 0;
+                int col_len1, col_len2;
+                if (col_type < 10 && *hdr1 == col_type && *hdr2 == col_type) {
+                    hdr1++;
+                    hdr2++;
+                    col_len1 = col_len2 = col_data_lens[col_type];
+                    switch (col_type) {
+                        case SQLT_TYPE_INT8:
+                            cmp = (int8_t) *data1 - (int8_t) *data2;
+                            break;
+                        case SQLT_TYPE_INT16:
+                            cmp = (int16_t) util::read_uint16(data1) - (int16_t) util::read_uint16(data2);
+                            break;
+                        case SQLT_TYPE_INT24: {
+                            int32_t i1 = util::read_int24(data1);
+                            int32_t i2 = util::read_int24(data2);
+                            cmp = (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+                            }
+                            break;
+                        case SQLT_TYPE_INT32: {
+                            int32_t i1 = util::read_uint32(data1);
+                            int32_t i2 = util::read_uint32(data2);
+                            cmp = (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+                            }
+                            break;
+                        case SQLT_TYPE_INT48: {
+                            int64_t i1 = util::read_int48(data1);
+                            int64_t i2 = util::read_int48(data2);
+                            cmp = (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+                            }
+                            break;
+                        case SQLT_TYPE_INT64: {
+                            int64_t i1 = util::read_uint64(data1);
+                            int64_t i2 = util::read_uint64(data2);
+                            cmp = (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+                            }
+                            break;
+                        case SQLT_TYPE_REAL: {
+                            double d1 = util::read_double(data1);
+                            double d2 = util::read_double(data2);
+                            cmp = (d1 < d2 ? -1 : (d1 > d2 ? 1 : 0));
+                            }
+                            break;
+                    }
+                } else {
+                    int col_type1, col_type2;
+                    decode_serial_type(util::read_vint32(hdr1, &vlen), col_len1, col_type1);
+                    hdr1 += vlen;
+                    decode_serial_type(util::read_vint32(hdr2, &vlen), col_len2, col_type2);
+                    hdr2 += vlen;
+                    if (col_type >= SQLT_TYPE_BLOB && col_type1 >= SQLT_TYPE_BLOB && col_type2 >= SQLT_TYPE_BLOB)
+                        cmp = util::compare(data1, col_len1, data2, col_len2);
+                    else
+                        cmp = compare_col(data1, col_len1, col_type1, data2, col_len2, col_type2);
+                }
+                if (cmp != 0)
+                    return cmp;
+                data1 += col_len1;
+                data2 += col_len2;
+            }
+            return 0;
         }
 
         int compare_keys(const uint8_t *rec1, int rec1_len, const uint8_t *rec2, int rec2_len) {
+            if (!pk_col_types.empty())
+                return compare_keys_by_plan(rec1, rec2);
             int8_t vlen;
             const uint8_t *ptr1 = rec1;
             int hdr1_len = util::read_vint32(ptr1, &vlen);
@@ -525,6 +521,28 @@ class sqlite : public bplus_tree_handler<sqlite> {
             X = ((U-12)*64/255)-23;
             M = ((U-12)*32/255)-23;
             master_block = NULL;
+            wal = NULL;
+        }
+
+        // Opens a table or index b-tree rooted at given page of a cache
+        // shared with other trees of the same file (see sqlite_db.h)
+        // Page 0 is not written here, it is maintained by the owner of the cache
+        sqlite(int total_col_count, int pk_col_count,
+                const std::string& col_names, const std::string& tbl_name,
+                int block_sz, lru_cache *shared_cache, int root_page_num, bool is_new)
+                : column_count (total_col_count), pk_count (pk_col_count),
+                    column_names (col_names), table_name (tbl_name),
+                    bplus_tree_handler<sqlite>(block_sz, block_sz, shared_cache, root_page_num) {
+            U = leaf_block_size - page_resv_bytes;
+            X = ((U-12)*64/255)-23;
+            M = ((U-12)*32/255)-23;
+            master_block = NULL;
+            wal = NULL;
+            if (is_new) {
+                init_bt_idx_leaf(root_block);
+                set_block_changed(root_block, leaf_block_size, true);
+            }
+            set_current_block_root();
         }
 
         ~sqlite() {
@@ -533,7 +551,82 @@ class sqlite : public bplus_tree_handler<sqlite> {
         void init_derived() {
         }
 
+        // Fixes types of primary key columns for the life of the table,
+        // typically the same types given to make_new_rec().
+        // Key comparisons then follow a plan formed here instead of
+        // deriving and converting types of both records for each column.
+        // Should be set before the first insert and every time the file is opened
+        void set_pk_col_types(const uint8_t types[]) {
+            pk_col_types.clear();
+            if (types == NULL)
+                return;
+            for (int i = 0; i < pk_count; i++) {
+                uint8_t col_type = types[i];
+                if (col_type == SQLT_TYPE_NULL || col_type == SQLT_TYPE_INT0 || col_type == SQLT_TYPE_INT1)
+                    col_type = SQLT_TYPE_INT8; // not expected in keys, compared generically
+                pk_col_types.push_back(col_type);
+            }
+        }
+
+        // Writes changes through a WAL file (see sqlite_wal.h) from here on,
+        // so that sqlite3 connections can read the file while inserts go on.
+        // Changes are visible to them from each commit() and are copied to
+        // the main file once the WAL reaches auto_ckpt_frames pages.
+        int enable_wal(int auto_ckpt_frames = WAL_DEFAULT_AUTO_CKPT) {
+            if (cache_size <= 0 || master_block == NULL || wal != NULL)
+                return SQLT_RES_ERR;
+            // Readers use WAL only if file format versions are 2
+            master_block[18] = 2;
+            master_block[19] = 2;
+            cache->write_page(master_block, 0, leaf_block_size);
+            try {
+                wal = new sqlite_wal(cache->filename, leaf_block_size, auto_ckpt_frames);
+            } catch (int err) {
+                std::cout << "Could not open WAL: " << err << std::endl;
+                return SQLT_RES_ERR;
+            }
+            cache->set_page_io(wal_read_page, wal_write_page, wal);
+            if (wal->was_recovered()) {
+                // Left by an earlier writer and copied to main file just now
+                if (cache->read_page(master_block, 0, leaf_block_size) != leaf_block_size
+                        || cache->read_page(root_block, leaf_block_size, leaf_block_size) != leaf_block_size)
+                    return SQLT_RES_READ_ERR;
+                if (cache->file_page_count < wal->get_page_count())
+                    cache->file_page_count = wal->get_page_count();
+            }
+            return SQLT_RES_OK;
+        }
+
+        // Writes all changed pages and page 0 to the WAL as one transaction
+        // Readers see the inserts made so far once this returns
+        int commit() {
+            if (wal == NULL)
+                return SQLT_RES_ERR;
+            try {
+                cache->flush_all();
+                uint32_t file_size_in_pages = cache->file_page_count;
+                util::write_uint32(master_block + 28, file_size_in_pages);
+                wal->commit(1, master_block, file_size_in_pages);
+            } catch (int err) {
+                return SQLT_RES_WRITE_ERR;
+            }
+            return SQLT_RES_OK;
+        }
+
+        // Writes changed pages to the file so it can be read directly,
+        // as by sqlite_cursor. Not for WAL mode, use commit() instead
+        void flush() {
+            cache->flush_all();
+        }
+
         void cleanup() {
+            if (wal != NULL) {
+                commit();
+                wal->checkpoint();
+                cache->set_page_io(NULL, NULL, NULL);
+                delete wal;
+                wal = NULL;
+            }
             if (cache_size > 0 && master_block != NULL) {
                 uint32_t file_size_in_pages = cache->file_page_count;
                 util::write_uint32(master_block + 28, file_size_in_pages);
@@ -543,6 +636,159 @@ class sqlite : public bplus_tree_handler<sqlite> {
                 free(master_block);
         }
 
+        // Forms CREATE TABLE or CREATE INDEX script for given entry
+        std::string form_create_script(const sqlite_master_entry& entry) {
+            std::string script;
+            if (entry.type == "index") {
+                script = "CREATE INDEX ";
+                script += entry.name;
+                script += " ON ";
+                script += entry.tbl_name;
+                script += " (";
+                script += entry.col_names;
+                script += ")";
+                return script;
+            }
+            int pk_end_pos = 0;
+            for (int i = 0, comma_count = 0; i < entry.col_names.length(); i++) {
+                if (entry.col_names[i] == ',')
+                    comma_count++;
+                if (comma_count == entry.pk_col_count) {
+                    pk_end_pos = i;
+                    break;
+                }
+            }
+            if (pk_end_pos == 0)
+                pk_end_pos = entry.col_names.length();
+            script = "CREATE TABLE ";
+            script += entry.name;
+            script += " (";
+            script += entry.col_names;
+            script += ", PRIMARY KEY (";
+            script.append(entry.col_names, 0, pk_end_pos);
+            script += ")) WITHOUT ROWID";
+            return script;
+        }
+
+        // Writes sqlite_master with one record per given table or index
+        int write_page0(const std::vector<sqlite_master_entry>& entries) {
+
+            int block_size = leaf_block_size;
+            if (block_size % 512 || block_size < 512 || block_size > 65536)
+                throw SQLT_RES_INV_PAGE_SZ;
+
+            master_block = (uint8_t *) malloc(block_size);
+            current_block = master_block;
+
+            // 100 uint8_t header - refer https://www.sqlite.org/fileformat.html
+            memcpy(current_block, "SQLite format 3\0", 16);
+            util::write_uint16(current_block + 16, block_size == 65536 ? 1 : (uint16_t) block_size);
+            current_block[18] = 1;
+            current_block[19] = 1;
+            current_block[20] = page_resv_bytes;
+            current_block[21] = 64;
+            current_block[22] = 32;
+            current_block[23] = 32;
+            //write_uint32(current_block + 24, 0);
+            //write_uint32(current_block + 28, 0);
+            //write_uint32(current_block + 32, 0);
+            //write_uint32(current_block + 36, 0);
+            //write_uint32(current_block + 40, 0);
+            memset(current_block + 24, '\0', 20); // Set to zero, above 5
+            util::write_uint32(current_block + 28, entries.size() + 1); // TODO: Update during finalize
+            util::write_uint32(current_block + 44, 4);
+            //write_uint16(current_block + 48, 0);
+            //write_uint16(current_block + 52, 0);
+            memset(current_block + 48, '\0', 8); // Set to zero, above 2
+            util::write_uint32(current_block + 56, 1);
+            // User version initially 0, set to table leaf count
+            // used to locate last leaf page for binary search
+            // and move to last page.
+            util::write_uint32(current_block + 60, 0);
+            util::write_uint32(current_block + 64, 0);
+            // App ID - set to 0xA5xxxxxx where A5 is signature
+            // till it is implemented
+            util::write_uint32(current_block + 68, 0xA5000000);
+            memset(current_block + 72, '\0', 20); // reserved space
+            util::write_uint32(current_block + 92, 105);
+            util::write_uint32(current_block + 96, 3016000);
+            memset(current_block + 100, '\0', block_size - 100); // Set remaining page to zero
+
+            // master table b-tree
+            init_bt_tbl_leaf(current_block + 100);
+            blk_hdr_len = 8;
+
+            // write table and index script records
+            // sqlite_master is kept to page 0, so no overflow pages
+            for (int i = 0; i < entries.size(); i++) {
+                const sqlite_master_entry& entry = entries[i];
+                std::string script = form_create_script(entry);
+                // 2 byte ptr, 3 byte rec/hdr vlen, 2 byte rowid, 6 byte hdr len, 4 byte uint32 root
+                if (script.length() + entry.type.length() + entry.name.length() + entry.tbl_name.length()
+                        + 2 + 3 + 2 + 6 + 4 > U - 35)
+                    return SQLT_RES_TOO_LONG;
+                int32_t root_page_no = entry.root_page;
+                const void *master_rec_values[] = {entry.type.c_str(), entry.name.c_str(),
+                        entry.tbl_name.c_str(), &root_page_no, script.c_str()};
+                const size_t master_rec_col_lens[] = {entry.type.length(), entry.name.length(),
+                        entry.tbl_name.length(), sizeof(root_page_no), script.length()};
+                const uint8_t master_rec_col_types[] = {SQLT_TYPE_TEXT, SQLT_TYPE_TEXT, SQLT_TYPE_TEXT, SQLT_TYPE_INT32, SQLT_TYPE_TEXT};
+                int res = write_new_rec(i, i + 1, 5, master_rec_values, master_rec_col_lens, master_rec_col_types);
+                if (res == SQLT_RES_NO_SPACE)
+                    return SQLT_RES_TOO_LONG;
+                if (res < 0)
+                   return res;
+            }
+
+            cache->write_page(master_block, 0, block_size);
+
+            return SQLT_RES_OK;
+
+        }
+
+        // Reads sqlite_master from page 0 and lists tables and indexes found
+        // Only type, name, tbl_name and root_page are filled
+        int read_page0(std::vector<sqlite_master_entry>& entries) {
+            if (master_block == NULL)
+                master_block = (uint8_t *) malloc(leaf_block_size);
+            if (cache->read_page(master_block, 0, leaf_block_size) != leaf_block_size)
+                return SQLT_RES_READ_ERR;
+            if (memcmp(master_block, "SQLite format 3\0", 16) != 0)
+                return SQLT_RES_INVALID_SIG;
+            uint8_t *master_hdr = master_block + 100;
+            if (master_hdr[0] != 13)
+                return SQLT_RES_MALFORMED;
+            int rec_count = util::read_uint16(master_hdr + 3);
+            for (int i = 0; i < rec_count; i++) {
+                int8_t vlen;
+                uint8_t *rec = master_block + util::read_uint16(master_hdr + 8 + i * 2);
+                util::read_vint32(rec, &vlen); // record length
+                rec += vlen;
+                util::read_vint32(rec, &vlen); // row id
+                rec += vlen;
+                sqlite_master_entry entry;
+                int col_type_or_len, col_len, col_type;
+                uint8_t *col = locate_col(0, rec, col_type_or_len, col_len, col_type);
+                if (col == NULL)
+                    return SQLT_RES_MALFORMED;
+                entry.type.assign((const char *) col, col_len);
+                col = locate_col(1, rec, col_type_or_len, col_len, col_type);
+                if (col == NULL)
+                    return SQLT_RES_MALFORMED;
+                entry.name.assign((const char *) col, col_len);
+                col = locate_col(2, rec, col_type_or_len, col_len, col_type);
+                if (col == NULL)
+                    return SQLT_RES_MALFORMED;
+                entry.tbl_name.assign((const char *) col, col_len);
+                col = locate_col(3, rec, col_type_or_len, col_len, col_type);
+                if (col == NULL)
+                    return SQLT_RES_MALFORMED;
+                entry.root_page = cvt_to_int64(col, col_type);
+                entry.pk_col_count = 0;
+                entries.push_back(entry);
+            }
+            return SQLT_RES_OK;
+        }
         inline void set_current_block_root() {
             set_current_block(root_block);
         }
@@ -1031,6 +1277,214 @@ class sqlite : public bplus_tree_handler<sqlite> {
             return write_new_rec(-1, 0, col_count, values, value_lens, types, ptr);
         }
 
+        // Returns narrowest integer type that can hold all count values
+        // The loop only finds min and max so that it can be vectorized
+        template<class V>
+        static uint8_t narrowest_int_type(const V *vals, int count) {
+            int64_t min_val = 0;
+            int64_t max_val = 0;
+            for (int i = 0; i < count; i++) {
+                min_val = vals[i] < min_val ? vals[i] : min_val;
+                max_val = vals[i] > max_val ? vals[i] : max_val;
+            }
+            if (min_val >= -128 && max_val <= 127)
+                return SQLT_TYPE_INT8;
+            if (min_val >= -32768 && max_val <= 32767)
+                return SQLT_TYPE_INT16;
+            if (min_val >= -8388608 && max_val <= 8388607)
+                return SQLT_TYPE_INT24;
+            if (min_val >= -2147483648LL && max_val <= 2147483647LL)
+                return SQLT_TYPE_INT32;
+            if (min_val >= -140737488355328LL && max_val <= 140737488355327LL)
+                return SQLT_TYPE_INT48;
+            return SQLT_TYPE_INT64;
+        }
+
+        // Writes count values of an integer column, each at data_pos of its record
+        template<class V>
+        static void write_int_col(uint8_t *buf, int data_pos[], const V *vals, int type, int count) {
+            switch (type) {
+                case SQLT_TYPE_INT8:
+                    for (int i = 0; i < count; i++)
+                        buf[data_pos[i]++] = (uint8_t) vals[i];
+                    break;
+                case SQLT_TYPE_INT16:
+                    for (int i = 0; i < count; i++) {
+                        util::write_uint16(buf + data_pos[i], (uint16_t) vals[i]);
+                        data_pos[i] += 2;
+                    }
+                    break;
+                case SQLT_TYPE_INT24:
+                    for (int i = 0; i < count; i++) {
+                        util::write_int24(buf + data_pos[i], (int32_t) vals[i]);
+                        data_pos[i] += 3;
+                    }
+                    break;
+                case SQLT_TYPE_INT32:
+                    for (int i = 0; i < count; i++) {
+                        util::write_uint32(buf + data_pos[i], (uint32_t) vals[i]);
+                        data_pos[i] += 4;
+                    }
+                    break;
+                case SQLT_TYPE_INT48:
+                    for (int i = 0; i < count; i++) {
+                        util::write_int48(buf + data_pos[i], (int64_t) vals[i]);
+                        data_pos[i] += 6;
+                    }
+                    break;
+                case SQLT_TYPE_INT64:
+                    for (int i = 0; i < count; i++) {
+                        util::write_uint64(buf + data_pos[i], (uint64_t) vals[i]);
+                        data_pos[i] += 8;
+                    }
+                    break;
+            }
+        }
+
+        // Encodes rec_count records from column arrays into buf, one after another.
+        // col_values[i] points to rec_count values of column i, an array of
+        // int8_t, int16_t, int32_t (INT24, INT32), int64_t (INT48, INT64)
+        // or double (REAL) as per types[i], or of const char * for TEXT
+        // and BLOB columns, whose lengths are in col_value_lens[i]
+        // (col_value_lens or col_value_lens[i] NULL for strlen()).
+        // Types are resolved once for the batch and each column is written
+        // in its own loop. Integer columns other than primary key are
+        // written in the narrowest type holding all values of the batch,
+        // primary key columns keep given type (see set_pk_col_types()).
+        // Length of each record is written to rec_lens. Returns total length.
+        // buf is to have get_recs_size() bytes.
+        int make_new_recs(uint8_t *buf, int rec_count, int col_count, const void *col_values[],
+                const size_t *col_value_lens[], const uint8_t types[], int rec_lens[]) {
+            if (rec_count <= 0)
+                return 0;
+            uint8_t col_types[col_count];
+            int fixed_hdr_len = 0;
+            int fixed_data_len = 0;
+            for (int i = 0; i < col_count; i++) {
+                col_types[i] = types[i];
+                if (i >= pk_count) {
+                    switch (types[i]) {
+                        case SQLT_TYPE_INT8:
+                            break;
+                        case SQLT_TYPE_INT16:
+                            col_types[i] = narrowest_int_type((const int16_t *) col_values[i], rec_count);
+                            break;
+                        case SQLT_TYPE_INT24:
+                        case SQLT_TYPE_INT32:
+                            col_types[i] = narrowest_int_type((const int32_t *) col_values[i], rec_count);
+                            break;
+                        case SQLT_TYPE_INT48:
+                        case SQLT_TYPE_INT64:
+                            col_types[i] = narrowest_int_type((const int64_t *) col_values[i], rec_count);
+                            break;
+                    }
+                }
+                if (col_types[i] < 10) {
+                    fixed_hdr_len++;
+                    fixed_data_len += col_data_lens[col_types[i]];
+                }
+            }
+            // Pass 1: record, header and data lengths from text and blob lengths
+            std::vector<int> hdr_lens(rec_count, fixed_hdr_len);
+            std::vector<int> data_pos(rec_count);
+            for (int r = 0; r < rec_count; r++)
+                rec_lens[r] = fixed_data_len;
+            for (int i = 0; i < col_count; i++) {
+                if (col_types[i] < 10)
+                    continue;
+                const char **vals = (const char **) col_values[i];
+                const size_t *lens = (col_value_lens == NULL ? NULL : col_value_lens[i]);
+                for (int r = 0; r < rec_count; r++) {
+                    int len = (lens == NULL ? strlen(vals[r]) : lens[r]);
+                    hdr_lens[r] += util::get_vlen_of_uint32(len * 2 + col_types[i]);
+                    rec_lens[r] += len;
+                }
+            }
+            // Pass 2: headers, fixed types are same for all records of the batch
+            int total_len = 0;
+            for (int r = 0; r < rec_count; r++) {
+                hdr_lens[r] += util::get_vlen_of_uint32(hdr_lens[r] + 1);
+                rec_lens[r] += hdr_lens[r];
+                uint8_t *ptr = buf + total_len;
+                ptr += util::write_vint32(ptr, hdr_lens[r]);
+                for (int i = 0; i < col_count; i++) {
+                    if (col_types[i] < 10) {
+                        *ptr++ = col_types[i];
+                    } else {
+                        const size_t *lens = (col_value_lens == NULL ? NULL : col_value_lens[i]);
+                        int len = (lens == NULL ? strlen(((const char **) col_values[i])[r]) : lens[r]);
+                        ptr += util::write_vint32(ptr, len * 2 + col_types[i]);
+                    }
+                }
+                data_pos[r] = total_len + hdr_lens[r];
+                total_len += rec_lens[r];
+            }
+            // Pass 3: data, one column at a time
+            int *pos = data_pos.data();
+            for (int i = 0; i < col_count; i++) {
+                switch (types[i]) {
+                    case SQLT_TYPE_NULL:
+                    case SQLT_TYPE_INT0:
+                    case SQLT_TYPE_INT1:
+                        break;
+                    case SQLT_TYPE_INT8:
+                        write_int_col(buf, pos, (const int8_t *) col_values[i], col_types[i], rec_count);
+                        break;
+                    case SQLT_TYPE_INT16:
+                        write_int_col(buf, pos, (const int16_t *) col_values[i], col_types[i], rec_count);
+                        break;
+                    case SQLT_TYPE_INT24:
+                    case SQLT_TYPE_INT32:
+                        write_int_col(buf, pos, (const int32_t *) col_values[i], col_types[i], rec_count);
+                        break;
+                    case SQLT_TYPE_INT48:
+                    case SQLT_TYPE_INT64:
+                        write_int_col(buf, pos, (const int64_t *) col_values[i], col_types[i], rec_count);
+                        break;
+                    case SQLT_TYPE_REAL: {
+                        // TODO: Assumes double is represented in IEEE-754 format
+                        const uint64_t *vals = (const uint64_t *) col_values[i];
+                        for (int r = 0; r < rec_count; r++) {
+                            util::write_uint64(buf + pos[r], vals[r]);
+                            pos[r] += 8;
+                        }
+                        }
+                        break;
+                    default: {
+                        const char **vals = (const char **) col_values[i];
+                        const size_t *lens = (col_value_lens == NULL ? NULL : col_value_lens[i]);
+                        for (int r = 0; r < rec_count; r++) {
+                            int len = (lens == NULL ? strlen(vals[r]) : lens[r]);
+                            memcpy(buf + pos[r], vals[r], len);
+                            pos[r] += len;
+                        }
+                        }
+                }
+            }
+            return total_len;
+        }
+
+        // Bytes needed in buf by make_new_recs() for the same arguments.
+        // Integer columns are counted at their given width, so this can
+        // be a little more than what is written once they are narrowed.
+        static int get_recs_size(int rec_count, int col_count, const void *col_values[],
+                const size_t *col_value_lens[], const uint8_t types[]) {
+            int total_len = 0;
+            for (int i = 0; i < col_count; i++) {
+                if (types[i] < 10) {
+                    total_len += rec_count * (1 + col_data_lens[types[i]]);
+                    continue;
+                }
+                const char **vals = (const char **) col_values[i];
+                const size_t *lens = (col_value_lens == NULL ? NULL : col_value_lens[i]);
+                for (int r = 0; r < rec_count; r++) {
+                    int len = (lens == NULL ? strlen(vals[r]) : lens[r]);
+                    total_len += util::get_vlen_of_uint32(len * 2 + types[i]) + len;
+                }
+            }
+            return total_len + rec_count * 5; // header length
+        }
+
         // See .h file for API description
         uint32_t derive_data_len(uint32_t col_type_or_len) {
             if (col_type_or_len >= 12) {
@@ -1053,6 +1507,25 @@ class sqlite : public bplus_tree_handler<sqlite> {
             return 0;
         }
 
+        // Gives start of data of column in record and its type
+        uint8_t *locate_col(int which_col, uint8_t *rec, int& col_type_or_len, int& col_len, int& col_type) {
+            int8_t vlen;
+            int hdr_len = util::read_vint32(rec, &vlen);
+            int hdr_pos = vlen;
+            uint8_t *data_ptr = rec + hdr_len;
+            col_len = vlen = 0;
+            do {
+                data_ptr += col_len;
+                hdr_pos += vlen;
+                if (hdr_pos >= hdr_len)
+                    return NULL;
+                col_type_or_len = util::read_vint32(rec + hdr_pos, &vlen);
+                col_len = derive_data_len(col_type_or_len);
+                col_type = derive_col_type(col_type_or_len);
+            } while (which_col--);
+            return data_ptr;
+        }
+
         int read_col(int which_col, uint8_t *rec, int rec_len, void *out) {
             int col_type_or_len, col_len, col_type;
             uint8_t *data_ptr = locate_col(which_col, rec, col_type_or_len, col_len, col_type);
@@ -1191,7 +1664,12 @@ class sqlite : public bplus_tree_handler<sqlite> {
                 uint8_t *raw_val_at = key_at + hdr_len;
                 int8_t key_len_vlen;
                 int k_len = (util::read_vint32(key_at + vlen, &key_len_vlen) - 13) / 2;
-                *p_value_len = (util::read_vint32(key_at + vlen + key_len_vlen, NULL) - 13) / 2;
+                uint32_t val_type = util::read_vint32(key_at + vlen + key_len_vlen, NULL);
+                if (val_type == 0) { // NULL, as written by logger for deleted keys
+                    *p_value_len = -1;
+                    return;
+                }
+                *p_value_len = (val_type - 13) / 2;
                 if (hdr_len + k_len <= on_bt_page) {
                     raw_val_at += k_len;
                     int val_len_on_bt = on_bt_page - k_len - hdr_len;
@@ -0,0 +1,243 @@
+#ifndef SQLITE_CURSOR_H
+#define SQLITE_CURSOR_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include "univix_util.h"
+
+// Reads records of an index or WITHOUT ROWID b-tree of a Sqlite file
+// in key order, straight from the file. Meant for files not being
+// written to, such as rotated segments of logger being merged.
+// Keys of interior pages are records too and are returned in order.
+class sqlite_cursor {
+    protected:
+        // Page being walked at each level, pos counts children and
+        // cells alternately for interior pages
+        struct cursor_level {
+            std::vector<uint8_t> block;
+            int hdr_pos;
+            int cell_count;
+            int pos;
+            bool is_leaf;
+        };
+        int fd;
+        int page_size;
+        int usable_size;
+        uint32_t root_page_no;
+        std::vector<cursor_level> levels;
+        std::string rec;
+        std::vector<uint8_t> ovfl_block;
+
+        bool push_page(uint32_t page_no) {
+            if (levels.size() >= 20)
+                return false;
+            levels.resize(levels.size() + 1);
+            cursor_level& lvl = levels.back();
+            lvl.block.resize(page_size);
+            off_t file_pos = page_size;
+            file_pos *= (page_no - 1);
+            if (page_no == 0 || pread(fd, lvl.block.data(), page_size, file_pos) != page_size) {
+                levels.pop_back();
+                return false;
+            }
+            lvl.hdr_pos = (page_no == 1 ? 100 : 0);
+            uint8_t page_type = lvl.block[lvl.hdr_pos];
+            if (page_type != 2 && page_type != 10) {
+                levels.pop_back();
+                return false;
+            }
+            lvl.is_leaf = (page_type == 10);
+            lvl.cell_count = util::read_uint16(lvl.block.data() + lvl.hdr_pos + 3);
+            lvl.pos = 0;
+            return true;
+        }
+
+        // Reads record of given cell, including any overflow pages
+        void read_cell(cursor_level& lvl, int cell_idx) {
+            const uint8_t *block = lvl.block.data();
+            int cell_pos = util::read_uint16(block + lvl.hdr_pos + (lvl.is_leaf ? 8 : 12) + cell_idx * 2);
+            if (!lvl.is_leaf)
+                cell_pos += 4;
+            // cells can be shorter than a varint of 9 bytes, such as
+            // tombstones of short keys at the end of the page, so only
+            // bytes the varint and payload take are to be on the page
+            int vint_end = cell_pos;
+            while (vint_end < usable_size && vint_end - cell_pos < 8 && (block[vint_end] & 0x80))
+                vint_end++;
+            if (vint_end >= usable_size) {
+                rec.clear();
+                return;
+            }
+            int8_t vlen;
+            uint32_t payload_len = util::read_vint32(block + cell_pos, &vlen);
+            cell_pos += vlen;
+            int U = usable_size;
+            int X = ((U - 12) * 64 / 255) - 23;
+            int M = ((U - 12) * 32 / 255) - 23;
+            int local_len = payload_len;
+            if (payload_len > X) {
+                local_len = M + ((payload_len - M) % (U - 4));
+                if (local_len > X)
+                    local_len = M;
+            }
+            if (cell_pos + local_len + (local_len < payload_len ? 4 : 0) > usable_size) {
+                rec.clear();
+                return;
+            }
+            rec.assign((const char *) block + cell_pos, local_len);
+            uint32_t ovfl_page = (local_len < payload_len ? util::read_uint32(block + cell_pos + local_len) : 0);
+            while (rec.length() < payload_len && ovfl_page) {
+                off_t file_pos = page_size;
+                file_pos *= (ovfl_page - 1);
+                if (pread(fd, ovfl_block.data(), page_size, file_pos) != page_size)
+                    break;
+                int len = payload_len - rec.length();
+                if (len > U - 4)
+                    len = U - 4;
+                rec.append((const char *) ovfl_block.data() + 4, len);
+                ovfl_page = util::read_uint32(ovfl_block.data());
+            }
+        }
+
+    public:
+        sqlite_cursor(const char *filename, uint32_t root_page = 2) {
+            page_size = usable_size = 0;
+            root_page_no = root_page;
+            fd = open(filename, O_RDONLY);
+            if (fd == -1)
+                return;
+            uint8_t file_hdr[100];
+            if (pread(fd, file_hdr, 100, 0) != 100 || memcmp(file_hdr, "SQLite format 3\0", 16) != 0)
+                return;
+            page_size = util::read_uint16(file_hdr + 16);
+            if (page_size == 1)
+                page_size = 65536;
+            usable_size = page_size - file_hdr[20];
+            ovfl_block.resize(page_size);
+            push_page(root_page);
+        }
+
+        ~sqlite_cursor() {
+            if (fd != -1)
+                close(fd);
+        }
+
+        // Moves to next record, returns false when no more
+        bool next() {
+            while (!levels.empty()) {
+                cursor_level& lvl = levels.back();
+                if (lvl.is_leaf) {
+                    if (lvl.pos < lvl.cell_count) {
+                        read_cell(lvl, lvl.pos++);
+                        return true;
+                    }
+                    levels.pop_back();
+                    continue;
+                }
+                if (lvl.pos > lvl.cell_count * 2) {
+                    levels.pop_back();
+                    continue;
+                }
+                int pos = lvl.pos++;
+                if (pos % 2) {
+                    read_cell(lvl, pos / 2);
+                    return true;
+                }
+                const uint8_t *block = lvl.block.data();
+                uint32_t child = (pos / 2 == lvl.cell_count
+                        ? util::read_uint32(block + lvl.hdr_pos + 8)
+                        : util::read_uint32(block + util::read_uint16(block + lvl.hdr_pos + 12 + (pos / 2) * 2)));
+                if (!push_page(child))
+                    return false;
+            }
+            return false;
+        }
+
+        // Positions so that next() gives the first record with key not
+        // less than given key. Returns false if file could not be read
+        bool seek(const uint8_t *key, int key_len) {
+            levels.clear();
+            if (page_size == 0 || !push_page(root_page_no))
+                return false;
+            while (true) {
+                cursor_level& lvl = levels.back();
+                int first = 0;
+                int last = lvl.cell_count;
+                while (first < last) {
+                    int middle = (first + last) >> 1;
+                    read_cell(lvl, middle);
+                    int k_len;
+                    const uint8_t *k = get_key(k_len);
+                    if (util::compare(k, k_len, key, key_len) < 0)
+                        first = middle + 1;
+                    else
+                        last = middle;
+                }
+                if (lvl.is_leaf) {
+                    lvl.pos = first;
+                    return true;
+                }
+                // cell at first comes after the child before it
+                lvl.pos = first * 2 + 1;
+                const uint8_t *block = lvl.block.data();
+                uint32_t child = (first == lvl.cell_count
+                        ? util::read_uint32(block + lvl.hdr_pos + 8)
+                        : util::read_uint32(block + util::read_uint16(block + lvl.hdr_pos + 12 + first * 2)));
+                if (!push_page(child))
+                    return false;
+            }
+        }
+
+        // Second column of current record, the value for logger.
+        // Length is -1 if NULL
+        const uint8_t *get_value(int& value_len) {
+            const uint8_t *r = (const uint8_t *) rec.data();
+            if (rec.length() < 3) {
+                value_len = 0;
+                return r;
+            }
+            int8_t vlen;
+            int hdr_len = util::read_vint32(r, &vlen);
+            int hdr_pos = vlen;
+            uint32_t key_type = util::read_vint32(r + hdr_pos, &vlen);
+            hdr_pos += vlen;
+            uint32_t value_type = (hdr_pos < hdr_len ? util::read_vint32(r + hdr_pos, &vlen) : 0);
+            int key_len = (key_type >= 12 ? (key_type - 12) / 2 : 0);
+            value_len = (value_type >= 12 ? (value_type - 12) / 2 : 0);
+            if (value_type == 0)
+                value_len = -1; // NULL, such as for tombstones of logger
+            return r + hdr_len + key_len;
+        }
+
+        // Current record in Sqlite record format
+        const uint8_t *get_rec(int& rec_len) {
+            rec_len = rec.length();
+            return (const uint8_t *) rec.data();
+        }
+
+        // First column of current record, the key for logger
+        const uint8_t *get_key(int& key_len) {
+            const uint8_t *r = (const uint8_t *) rec.data();
+            if (rec.length() < 3) {
+                key_len = 0;
+                return r;
+            }
+            int8_t vlen;
+            int hdr_len = util::read_vint32(r, &vlen);
+            uint32_t serial_type = util::read_vint32(r + vlen, &vlen);
+            key_len = (serial_type >= 12 ? (serial_type - 12) / 2 : 0);
+            return r + hdr_len;
+        }
+
+        bool is_open() {
+            return page_size > 0;
+        }
+
+};
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef SQLITE_DB_H
+#define SQLITE_DB_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#endif
+#include "sqlite.h"
+
+// Several WITHOUT ROWID tables and their secondary indexes
+// in one Sqlite file, sharing one lru_cache.
+// Tables and indexes are declared with add_table() and add_index()
+// and then open() creates them or locates them in an existing file.
+// Each gets its own root page, in the order declared.
+class sqlite_db {
+    protected:
+        int page_size;
+        int cache_size;
+        const char *filename;
+        lru_cache *cache;
+        std::vector<sqlite_master_entry> entries;
+        std::vector<sqlite *> trees;
+        // For index entries, the table entry it belongs to (-1 for tables)
+        std::vector<int> owner_table;
+        // For index entries, positions of table columns forming the index record
+        // i.e. indexed columns followed by primary key columns of the table
+        std::vector<std::vector<int> > idx_col_positions;
+        std::vector<std::vector<std::string> > col_name_lists;
+        bool is_open;
+
+        static std::vector<std::string> split_col_names(const std::string& col_names) {
+            std::vector<std::string> names;
+            std::string name;
+            for (int i = 0; i <= col_names.length(); i++) {
+                if (i == col_names.length() || col_names[i] == ',') {
+                    int start = name.find_first_not_of(' ');
+                    int end = name.find_last_not_of(' ');
+                    names.push_back(start == std::string::npos ? "" : name.substr(start, end - start + 1));
+                    name.clear();
+                } else
+                    name += col_names[i];
+            }
+            return names;
+        }
+
+        int find_entry(const std::string& name) {
+            for (int i = 0; i < entries.size(); i++) {
+                if (entries[i].name == name)
+                    return i;
+            }
+            return -1;
+        }
+
+    public:
+        sqlite_db(int page_sz, int cache_sz, const char *fname)
+                : page_size (page_sz), cache_size (cache_sz), filename (fname) {
+            cache = NULL;
+            is_open = false;
+        }
+
+        ~sqlite_db() {
+            if (!is_open)
+                return;
+            // sqlite_master is held by first tree, which updates page count on cleanup
+            trees[0]->cleanup();
+            for (std::vector<sqlite *>::iterator it = trees.begin(); it != trees.end(); it++)
+                delete *it;
+            delete cache;
+        }
+
+        // Declares a table. Primary key is formed by first pk_col_count columns
+        // Returns table id to be used with put() or SQLT_RES_ERR
+        int add_table(const std::string& tbl_name, int total_col_count,
+                    int pk_col_count, const std::string& col_names) {
+            if (is_open || find_entry(tbl_name) != -1)
+                return SQLT_RES_ERR;
+            std::vector<std::string> names = split_col_names(col_names);
+            if (names.size() != total_col_count || pk_col_count < 1 || pk_col_count > total_col_count)
+                return SQLT_RES_ERR;
+            sqlite_master_entry entry;
+            entry.type = "table";
+            entry.name = tbl_name;
+            entry.tbl_name = tbl_name;
+            entry.root_page = entries.size() + 2;
+            entry.col_names = col_names;
+            entry.pk_col_count = pk_col_count;
+            entries.push_back(entry);
+            owner_table.push_back(-1);
+            idx_col_positions.push_back(std::vector<int>());
+            col_name_lists.push_back(names);
+            return entries.size() - 1;
+        }
+
+        // Declares a secondary index on given columns of a table declared earlier
+        // The index is updated on every put() into the table
+        int add_index(const std::string& idx_name, const std::string& tbl_name,
+                    const std::string& idx_col_names) {
+            if (is_open || find_entry(idx_name) != -1)
+                return SQLT_RES_ERR;
+            int tbl_id = find_entry(tbl_name);
+            if (tbl_id == -1 || entries[tbl_id].type != "table")
+                return SQLT_RES_NOT_FOUND;
+            const std::vector<std::string>& tbl_cols = col_name_lists[tbl_id];
+            std::vector<std::string> names = split_col_names(idx_col_names);
+            std::vector<int> positions;
+            for (int i = 0; i < names.size(); i++) {
+                int j = 0;
+                while (j < tbl_cols.size() && tbl_cols[j] != names[i])
+                    j++;
+                if (j == tbl_cols.size())
+                    return SQLT_RES_NOT_FOUND;
+                positions.push_back(j);
+            }
+            // Index record of a WITHOUT ROWID table ends with
+            // the primary key columns not already indexed
+            for (int j = 0; j < entries[tbl_id].pk_col_count; j++) {
+                bool is_present = false;
+                for (int i = 0; i < positions.size(); i++)
+                    is_present |= (positions[i] == j);
+                if (!is_present)
+                    positions.push_back(j);
+            }
+            sqlite_master_entry entry;
+            entry.type = "index";
+            entry.name = idx_name;
+            entry.tbl_name = tbl_name;
+            entry.root_page = entries.size() + 2;
+            entry.col_names = idx_col_names;
+            entry.pk_col_count = positions.size();
+            entries.push_back(entry);
+            owner_table.push_back(tbl_id);
+            idx_col_positions.push_back(positions);
+            col_name_lists.push_back(names);
+            return entries.size() - 1;
+        }
+
+        // Creates the file with all declared tables and indexes
+        // or opens existing file and locates their root pages by name
+        int open() {
+            if (is_open || entries.size() == 0)
+                return SQLT_RES_ERR;
+            if (page_size % 512 || page_size < 512 || page_size > 65536)
+                return SQLT_RES_INV_PAGE_SZ;
+            int page_count = cache_size * 1024 / page_size;
+            if (page_count < 10)
+                page_count = 10;
+            cache = new lru_cache(page_size, page_count, filename, 1, util::aligned_alloc);
+            bool is_new = cache->is_empty();
+            if (!is_new) {
+                // sqlite_master is read through a tree on the first root
+                // page only to locate root pages of declared tables
+                sqlite master_reader(2, 1, "", "", page_size, cache, 1, false);
+                std::vector<sqlite_master_entry> existing;
+                int res = master_reader.read_page0(existing);
+                free(master_reader.master_block);
+                if (res != SQLT_RES_OK) {
+                    delete cache;
+                    cache = NULL;
+                    return res;
+                }
+                for (int i = 0; i < entries.size(); i++) {
+                    int j = 0;
+                    while (j < existing.size() && existing[j].name != entries[i].name)
+                        j++;
+                    if (j == existing.size() || existing[j].type != entries[i].type) {
+                        delete cache;
+                        cache = NULL;
+                        return SQLT_RES_NOT_FOUND;
+                    }
+                    entries[i].root_page = existing[j].root_page;
+                }
+            }
+            for (int i = 0; i < entries.size(); i++) {
+                const sqlite_master_entry& entry = entries[i];
+                int col_count = (entry.type == "table" ? col_name_lists[i].size() : entry.pk_col_count);
+                trees.push_back(new sqlite(col_count, entry.pk_col_count, entry.col_names,
+                        entry.name, page_size, cache, entry.root_page - 1, is_new));
+            }
+            std::vector<sqlite_master_entry> existing;
+            int res = is_new ? trees[0]->write_page0(entries) : trees[0]->read_page0(existing);
+            trees[0]->set_current_block_root();
+            is_open = true;
+            return res;
+        }
+
+        sqlite *get_tree(const std::string& name) {
+            int id = find_entry(name);
+            return (id == -1 || !is_open) ? NULL : trees[id];
+        }
+
+        sqlite *get_tree(int id) {
+            return trees[id];
+        }
+
+        // Forms record of index idx_id from given record of its table,
+        // copying serial types and data of each column as they are
+        int make_idx_rec_from(int idx_id, uint8_t *tbl_rec, uint8_t *out) {
+            const std::vector<int>& positions = idx_col_positions[idx_id];
+            sqlite *tbl = trees[owner_table[idx_id]];
+            int idx_col_count = positions.size();
+            uint32_t col_types[idx_col_count];
+            uint8_t *col_data[idx_col_count];
+            int col_lens[idx_col_count];
+            int hdr_len = 0;
+            int data_len = 0;
+            for (int j = 0; j < idx_col_count; j++) {
+                int col_type_or_len, col_type;
+                col_data[j] = tbl->locate_col(positions[j], tbl_rec, col_type_or_len, col_lens[j], col_type);
+                if (col_data[j] == NULL)
+                    return SQLT_RES_MALFORMED;
+                col_types[j] = col_type_or_len;
+                hdr_len += util::get_vlen_of_uint32(col_type_or_len);
+                data_len += col_lens[j];
+            }
+            hdr_len += util::get_vlen_of_uint32(hdr_len + 1);
+            uint8_t *ptr = out;
+            ptr += util::write_vint32(ptr, hdr_len);
+            for (int j = 0; j < idx_col_count; j++)
+                ptr += util::write_vint32(ptr, col_types[j]);
+            for (int j = 0; j < idx_col_count; j++) {
+                memcpy(ptr, col_data[j], col_lens[j]);
+                ptr += col_lens[j];
+            }
+            return ptr - out;
+        }
+
+        // Removes records of indexes of table for the row of given
+        // primary key, if there is one, as it is about to be replaced
+        int remove_idx_recs(int tbl_id, const uint8_t *rec, int rec_len) {
+            sqlite *tbl = trees[tbl_id];
+            if (!tbl->get(rec, -rec_len))
+                return SQLT_RES_OK;
+            int old_len = tbl->key_at_len;
+            std::vector<uint8_t> old_rec(old_len);
+            tbl->copy_value(old_rec.data(), &old_len);
+            std::vector<uint8_t> idx_rec(old_len + 9);
+            for (size_t i = tbl_id + 1; i < entries.size(); i++) {
+                if (owner_table[i] != tbl_id)
+                    continue;
+                int idx_rec_len = make_idx_rec_from(i, old_rec.data(), idx_rec.data());
+                if (idx_rec_len < 0)
+                    return idx_rec_len;
+                if (!trees[i]->get(idx_rec.data(), -idx_rec_len))
+                    return SQLT_RES_NOT_FOUND; // index out of step with table
+                trees[i]->remove_found_entry();
+            }
+            return SQLT_RES_OK;
+        }
+
+        // Inserts given column values into the table and
+        // corresponding records into each of its indexes. If a row
+        // of the same primary key is there, it is replaced and its
+        // index records removed first.
+        // value_lens and types are as in sqlite::make_new_rec()
+        // Returns SQLT_RES_OK or error code if a record could not be
+        // formed or indexes are not in step with the table
+        int put(int tbl_id, const void *values[],
+                const size_t value_lens[] = NULL, const uint8_t types[] = NULL) {
+            int col_count = col_name_lists[tbl_id].size();
+            int rec_size = 9 + col_count * 9;
+            for (int i = 0; i < col_count; i++) {
+                if (value_lens != NULL)
+                    rec_size += value_lens[i];
+                else if (types != NULL && types[i] < 10)
+                    rec_size += 8;
+                else
+                    rec_size += strlen((const char *) values[i]);
+            }
+            uint8_t rec[rec_size];
+            int rec_len = trees[tbl_id]->make_new_rec(rec, col_count, values, value_lens, types);
+            if (rec_len < 0)
+                return rec_len;
+            int res = remove_idx_recs(tbl_id, rec, rec_len);
+            if (res != SQLT_RES_OK)
+                return res;
+            trees[tbl_id]->put(rec, -rec_len, NULL, 0);
+            for (size_t i = tbl_id + 1; i < entries.size(); i++) {
+                if (owner_table[i] != tbl_id)
+                    continue;
+                const std::vector<int>& positions = idx_col_positions[i];
+                int idx_col_count = positions.size();
+                const void *idx_values[idx_col_count];
+                size_t idx_value_lens[idx_col_count];
+                uint8_t idx_types[idx_col_count];
+                for (int j = 0; j < idx_col_count; j++) {
+                    idx_values[j] = values[positions[j]];
+                    if (value_lens != NULL)
+                        idx_value_lens[j] = value_lens[positions[j]];
+                    if (types != NULL)
+                        idx_types[j] = types[positions[j]];
+                }
+                int idx_rec_len = trees[i]->make_new_rec(rec, idx_col_count, idx_values,
+                        value_lens == NULL ? NULL : idx_value_lens, types == NULL ? NULL : idx_types);
+                if (idx_rec_len < 0)
+                    return idx_rec_len;
+                // old records were removed, so one found means the
+                // index had a record of no row of the table
+                if (trees[i]->put(rec, -idx_rec_len, NULL, 0))
+                    return SQLT_RES_ERR;
+            }
+            return SQLT_RES_OK;
+        }
+
+        int get_table_id(const std::string& tbl_name) {
+            int id = find_entry(tbl_name);
+            return (id == -1 || entries[id].type != "table") ? SQLT_RES_NOT_FOUND : id;
+        }
+
+        cache_stats get_cache_stats() {
+            return cache->get_cache_stats();
+        }
+
+};
+
+#endif
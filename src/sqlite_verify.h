@@ -0,0 +1,627 @@
+#ifndef SQLITE_VERIFY_H
+#define SQLITE_VERIFY_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sqlite.h"
+
+// Checks b-trees of a Sqlite file without going through Sqlite,
+// so that large files are verified faster than by pragma integrity_check.
+// Trees are walked level by level, pages of a level split across threads.
+// Checks key order within pages and against parent keys, cell bounds,
+// free space accounting, overflow chains and pages used twice or never.
+// Also reports per level fill factor and fragmentation, overflow pages
+// and how many leaves are physically next to the previous leaf in key order.
+
+#define VERIFY_MAX_ERRORS 100
+
+typedef struct {
+    long page_count;
+    long cell_count;
+    long used_bytes; // header, cell pointers and cells
+    long free_bytes; // unallocated, freeblocks and fragments
+    long frag_bytes; // freeblocks and fragments only
+} sqlite_level_stats;
+
+typedef struct {
+    std::string name;
+    uint32_t root_page;
+    bool is_index; // including WITHOUT ROWID tables
+    std::vector<sqlite_level_stats> levels; // root level first
+    long entry_count;
+    long overflow_pages;
+    long leaf_count;
+    long contiguous_leaves; // at page next to previous leaf in key order
+} sqlite_tree_report;
+
+class sqlite_verifier {
+    protected:
+        // Page to be verified and the key range given by its parent
+        struct page_ref {
+            uint32_t page_no;
+            bool has_lower;
+            bool has_upper;
+            std::string lower;
+            std::string upper;
+            int64_t lower_rowid;
+            int64_t upper_rowid;
+        };
+        // Outcome of verifying part of a level by one thread
+        struct slice_result {
+            std::vector<page_ref> children;
+            std::vector<uint32_t> leaves;
+            std::vector<std::string> records;
+            std::vector<std::string> errors;
+            sqlite_level_stats stats;
+            long entry_count;
+            long overflow_pages;
+            long interior_count;
+        };
+        const char *filename;
+        int fd;
+        int thread_count;
+        int page_size;
+        int usable_size;
+        uint32_t page_count;
+        std::atomic<uint8_t> *page_refs;
+
+        static uint64_t read_varint(const uint8_t *ptr, int& vlen) {
+            uint64_t ret = 0;
+            for (vlen = 1; vlen < 9; vlen++) {
+                ret = (ret << 7) | (*ptr & 0x7F);
+                if ((*ptr++ & 0x80) == 0)
+                    return ret;
+            }
+            return (ret << 8) | *ptr;
+        }
+
+        static int64_t read_int_col(const uint8_t *ptr, uint32_t serial_type) {
+            switch (serial_type) {
+                case 1:
+                    return (int8_t) ptr[0];
+                case 2:
+                    return (int16_t) util::read_uint16(ptr);
+                case 3:
+                    return ((int32_t) ((ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8))) >> 8;
+                case 4:
+                    return (int32_t) util::read_uint32(ptr);
+                case 5:
+                    return ((int64_t) util::read_uint48(ptr) << 16) >> 16;
+                case 6:
+                    return (int64_t) util::read_uint64(ptr);
+                case 9:
+                    return 1;
+            }
+            return 0;
+        }
+
+        static int serial_type_rank(uint32_t serial_type) {
+            if (serial_type == 0)
+                return 0;
+            if (serial_type < 12)
+                return 1;
+            return (serial_type % 2 ? 2 : 3);
+        }
+
+        static int serial_type_len(uint32_t serial_type) {
+            return serial_type >= 12 ? (serial_type - 12) / 2 : col_data_lens[serial_type];
+        }
+
+        // Compares records as Sqlite would with BINARY collation
+        // i.e. NULL < numbers < text < blob
+        static int compare_records(const std::string& rec1, const std::string& rec2) {
+            const uint8_t *r1 = (const uint8_t *) rec1.data();
+            const uint8_t *r2 = (const uint8_t *) rec2.data();
+            int vlen;
+            int hdr_len1 = read_varint(r1, vlen);
+            int hdr_pos1 = vlen;
+            int hdr_len2 = read_varint(r2, vlen);
+            int hdr_pos2 = vlen;
+            int data_pos1 = hdr_len1;
+            int data_pos2 = hdr_len2;
+            while (hdr_pos1 < hdr_len1 && hdr_pos2 < hdr_len2) {
+                uint32_t type1 = read_varint(r1 + hdr_pos1, vlen);
+                hdr_pos1 += vlen;
+                uint32_t type2 = read_varint(r2 + hdr_pos2, vlen);
+                hdr_pos2 += vlen;
+                int len1 = serial_type_len(type1);
+                int len2 = serial_type_len(type2);
+                if (data_pos1 + len1 > (int) rec1.length() || data_pos2 + len2 > (int) rec2.length())
+                    return rec1.compare(rec2);
+                int rank1 = serial_type_rank(type1);
+                int rank2 = serial_type_rank(type2);
+                if (rank1 != rank2)
+                    return rank1 < rank2 ? -1 : 1;
+                int cmp = 0;
+                if (rank1 == 1) {
+                    if (type1 == 7 || type2 == 7) {
+                        double d1 = (type1 == 7 ? util::read_double(r1 + data_pos1) : read_int_col(r1 + data_pos1, type1));
+                        double d2 = (type2 == 7 ? util::read_double(r2 + data_pos2) : read_int_col(r2 + data_pos2, type2));
+                        cmp = (d1 < d2 ? -1 : (d1 > d2 ? 1 : 0));
+                    } else {
+                        int64_t i1 = read_int_col(r1 + data_pos1, type1);
+                        int64_t i2 = read_int_col(r2 + data_pos2, type2);
+                        cmp = (i1 < i2 ? -1 : (i1 > i2 ? 1 : 0));
+                    }
+                } else if (rank1 > 1) {
+                    cmp = memcmp(r1 + data_pos1, r2 + data_pos2, len1 < len2 ? len1 : len2);
+                    if (cmp == 0)
+                        cmp = len1 - len2;
+                }
+                if (cmp != 0)
+                    return cmp < 0 ? -1 : 1;
+                data_pos1 += len1;
+                data_pos2 += len2;
+            }
+            return 0;
+        }
+
+        // Payload kept on the page itself, see https://www.sqlite.org/fileformat.html#cellformat
+        int local_payload_len(uint32_t payload_len, bool is_table_leaf) {
+            int U = usable_size;
+            int X = is_table_leaf ? U - 35 : ((U - 12) * 64 / 255) - 23;
+            if (payload_len <= (uint32_t) X)
+                return payload_len;
+            int M = ((U - 12) * 32 / 255) - 23;
+            int K = M + ((payload_len - M) % (U - 4));
+            return K <= X ? K : M;
+        }
+
+        void add_error(slice_result& res, uint32_t page_no, const char *msg, long val = -1) {
+            if (res.errors.size() >= VERIFY_MAX_ERRORS)
+                return;
+            char err[200];
+            if (val == -1)
+                snprintf(err, sizeof(err), "Page %u: %s", page_no, msg);
+            else
+                snprintf(err, sizeof(err), "Page %u: %s %ld", page_no, msg, val);
+            res.errors.push_back(err);
+        }
+
+        bool read_page(uint32_t page_no, uint8_t *buf) {
+            off_t file_pos = page_size;
+            file_pos *= (page_no - 1);
+            return pread(fd, buf, page_size, file_pos) == page_size;
+        }
+
+        // Marks page as used, returns false if out of range or used already
+        bool claim_page(uint32_t page_no, uint32_t referrer, slice_result& res) {
+            if (page_no < 1 || page_no > page_count) {
+                add_error(res, referrer, "refers to page out of range", page_no);
+                return false;
+            }
+            if (page_refs[page_no - 1].exchange(1)) {
+                add_error(res, referrer, "refers to page already used", page_no);
+                return false;
+            }
+            return true;
+        }
+
+        // Follows overflow chain of a cell, appending payload to rec if given
+        void read_overflow(uint32_t page_no, uint32_t referrer, int remaining,
+                    std::string *rec, uint8_t *buf, slice_result& res) {
+            while (remaining > 0) {
+                if (page_no == 0) {
+                    add_error(res, referrer, "overflow chain short by bytes", remaining);
+                    return;
+                }
+                if (!claim_page(page_no, referrer, res))
+                    return;
+                if (!read_page(page_no, buf)) {
+                    add_error(res, page_no, "could not read overflow page");
+                    return;
+                }
+                res.overflow_pages++;
+                int len = remaining < usable_size - 4 ? remaining : usable_size - 4;
+                if (rec != NULL)
+                    rec->append((const char *) buf + 4, len);
+                remaining -= len;
+                referrer = page_no;
+                page_no = util::read_uint32(buf);
+            }
+            if (page_no != 0)
+                add_error(res, referrer, "overflow chain longer than payload, next", page_no);
+        }
+
+        bool is_in_range(const page_ref& ref, bool is_index, const std::string& key, int64_t rowid) {
+            if (is_index) {
+                if (ref.has_lower && compare_records(key, ref.lower) <= 0)
+                    return false;
+                if (ref.has_upper && compare_records(key, ref.upper) >= 0)
+                    return false;
+            } else {
+                if (ref.has_lower && rowid <= ref.lower_rowid)
+                    return false;
+                if (ref.has_upper && rowid > ref.upper_rowid)
+                    return false;
+            }
+            return true;
+        }
+
+        void verify_page(const page_ref& ref, bool is_index, bool collect_records,
+                    uint8_t *buf, uint8_t *ovfl_buf, slice_result& res) {
+            uint32_t page_no = ref.page_no;
+            if (!read_page(page_no, buf)) {
+                add_error(res, page_no, "could not be read");
+                return;
+            }
+            int hdr_pos = (page_no == 1 ? 100 : 0);
+            uint8_t *hdr = buf + hdr_pos;
+            uint8_t page_type = hdr[0];
+            bool is_leaf = (page_type == 10 || page_type == 13);
+            if (is_index ? (page_type != 2 && page_type != 10) : (page_type != 5 && page_type != 13)) {
+                add_error(res, page_no, "unexpected page type", page_type);
+                return;
+            }
+            int cell_count = util::read_uint16(hdr + 3);
+            int content_start = util::read_uint16(hdr + 5);
+            if (content_start == 0)
+                content_start = 65536;
+            int ptr_end = hdr_pos + (is_leaf ? 8 : 12) + cell_count * 2;
+            if (ptr_end > content_start || content_start > usable_size) {
+                add_error(res, page_no, "cell content area out of bounds", content_start);
+                return;
+            }
+            std::vector<std::pair<int, int> > cell_extents;
+            std::string prev_key;
+            int64_t prev_rowid = 0;
+            long cell_bytes = 0;
+            for (int i = 0; i < cell_count; i++) {
+                int cell_pos = util::read_uint16(hdr + (is_leaf ? 8 : 12) + i * 2);
+                if (cell_pos < content_start || cell_pos >= usable_size) {
+                    add_error(res, page_no, "cell pointer out of bounds, cell", i);
+                    return;
+                }
+                int pos = cell_pos;
+                int vlen;
+                uint32_t child = 0;
+                if (!is_leaf) {
+                    child = util::read_uint32(buf + pos);
+                    pos += 4;
+                }
+                std::string key;
+                int64_t rowid = 0;
+                if (page_type == 5) {
+                    rowid = (int64_t) read_varint(buf + pos, vlen);
+                    pos += vlen;
+                } else {
+                    uint32_t payload_len = read_varint(buf + pos, vlen);
+                    pos += vlen;
+                    if (page_type == 13) {
+                        rowid = (int64_t) read_varint(buf + pos, vlen);
+                        pos += vlen;
+                    }
+                    int local_len = local_payload_len(payload_len, page_type == 13);
+                    if (pos + local_len + ((uint32_t) local_len < payload_len ? 4 : 0) > usable_size) {
+                        add_error(res, page_no, "cell extends beyond page, cell", i);
+                        return;
+                    }
+                    std::string *rec = (is_index || collect_records) ? &key : NULL;
+                    if (rec != NULL)
+                        key.assign((const char *) buf + pos, local_len);
+                    pos += local_len;
+                    if ((uint32_t) local_len < payload_len) {
+                        read_overflow(util::read_uint32(buf + pos), page_no,
+                                payload_len - local_len, rec, ovfl_buf, res);
+                        pos += 4;
+                    }
+                }
+                cell_extents.push_back(std::make_pair(cell_pos, pos));
+                cell_bytes += (pos - cell_pos);
+                if (i > 0 && (is_index ? compare_records(prev_key, key) >= 0 : prev_rowid >= rowid))
+                    add_error(res, page_no, "key out of order, cell", i);
+                if (!is_in_range(ref, is_index, key, rowid))
+                    add_error(res, page_no, "key outside range of parent, cell", i);
+                // keys of interior pages of index trees are entries too
+                if (is_leaf || is_index)
+                    res.entry_count++;
+                if (is_leaf) {
+                    if (collect_records)
+                        res.records.push_back(key);
+                } else if (claim_page(child, page_no, res)) {
+                    page_ref child_ref = ref;
+                    child_ref.page_no = child;
+                    if (i > 0) {
+                        child_ref.has_lower = true;
+                        child_ref.lower = prev_key;
+                        child_ref.lower_rowid = prev_rowid;
+                    }
+                    child_ref.has_upper = true;
+                    child_ref.upper = key;
+                    child_ref.upper_rowid = rowid;
+                    res.children.push_back(child_ref);
+                }
+                prev_key.swap(key);
+                prev_rowid = rowid;
+            }
+            if (is_leaf)
+                res.leaves.push_back(page_no);
+            else {
+                res.interior_count++;
+                uint32_t right_child = util::read_uint32(hdr + 8);
+                if (claim_page(right_child, page_no, res)) {
+                    page_ref child_ref = ref;
+                    child_ref.page_no = right_child;
+                    if (cell_count > 0) {
+                        child_ref.has_lower = true;
+                        child_ref.lower = prev_key;
+                        child_ref.lower_rowid = prev_rowid;
+                    }
+                    res.children.push_back(child_ref);
+                }
+            }
+            std::sort(cell_extents.begin(), cell_extents.end());
+            for (size_t i = 1; i < cell_extents.size(); i++) {
+                if (cell_extents[i].first < cell_extents[i - 1].second) {
+                    add_error(res, page_no, "cells overlap at", cell_extents[i].first);
+                    break;
+                }
+            }
+            long freeblock_bytes = 0;
+            int freeblock = util::read_uint16(hdr + 1);
+            int prev_end = content_start;
+            // each is at least 4 bytes and after the end of the one
+            // before, so a corrupt chain cannot go round forever
+            while (freeblock) {
+                if (freeblock < prev_end || freeblock + 4 > usable_size) {
+                    add_error(res, page_no, "freeblock out of bounds", freeblock);
+                    break;
+                }
+                int size = util::read_uint16(buf + freeblock + 2);
+                if (size < 4 || freeblock + size > usable_size) {
+                    add_error(res, page_no, "freeblock size out of bounds", size);
+                    break;
+                }
+                freeblock_bytes += size;
+                prev_end = freeblock + size + 1;
+                freeblock = util::read_uint16(buf + freeblock);
+            }
+            long frag_bytes = freeblock_bytes + hdr[7];
+            if (cell_bytes + frag_bytes != usable_size - content_start)
+                add_error(res, page_no, "cell content area not accounted for, bytes",
+                        usable_size - content_start - cell_bytes - frag_bytes);
+            long free_bytes = content_start - ptr_end + frag_bytes;
+            res.stats.page_count++;
+            res.stats.cell_count += cell_count;
+            res.stats.used_bytes += (usable_size - hdr_pos - free_bytes);
+            res.stats.free_bytes += free_bytes;
+            res.stats.frag_bytes += frag_bytes;
+        }
+
+        void verify_slice(const std::vector<page_ref> *level, int start, int end,
+                    bool is_index, bool collect_records, slice_result *res) {
+            uint8_t *buf = (uint8_t *) malloc(page_size * 2);
+            for (int i = start; i < end; i++)
+                verify_page((*level)[i], is_index, collect_records, buf, buf + page_size, *res);
+            free(buf);
+        }
+
+        // Verifies tree at given root, its levels in turn
+        // with pages of each level split among threads
+        void verify_tree(sqlite_tree_report& report, std::vector<std::string> *records = NULL) {
+            report.levels.clear();
+            report.entry_count = report.overflow_pages = 0;
+            report.leaf_count = report.contiguous_leaves = 0;
+            uint8_t type_buf[page_size];
+            if (!read_page(report.root_page, type_buf)) {
+                errors.push_back("Could not read root page of " + report.name);
+                return;
+            }
+            uint8_t root_type = type_buf[report.root_page == 1 ? 100 : 0];
+            report.is_index = (root_type == 2 || root_type == 10);
+            std::vector<page_ref> level(1);
+            level[0].page_no = report.root_page;
+            level[0].has_lower = level[0].has_upper = false;
+            level[0].lower_rowid = level[0].upper_rowid = 0;
+            slice_result root_claim;
+            if (!claim_page(report.root_page, 0, root_claim)) {
+                errors.push_back("Root page of " + report.name + " used elsewhere");
+                return;
+            }
+            uint32_t prev_leaf = 0;
+            while (!level.empty()) {
+                int slice_count = thread_count;
+                if (slice_count > (int) level.size())
+                    slice_count = level.size();
+                std::vector<slice_result> results(slice_count);
+                std::vector<std::thread> threads;
+                for (int i = 0; i < slice_count; i++) {
+                    memset(&results[i].stats, '\0', sizeof(sqlite_level_stats));
+                    results[i].entry_count = results[i].overflow_pages = results[i].interior_count = 0;
+                    int start = level.size() * i / slice_count;
+                    int end = level.size() * (i + 1) / slice_count;
+                    if (slice_count == 1)
+                        verify_slice(&level, start, end, report.is_index, records != NULL, &results[i]);
+                    else
+                        threads.push_back(std::thread(&sqlite_verifier::verify_slice, this, &level,
+                                start, end, report.is_index, records != NULL, &results[i]));
+                }
+                for (size_t i = 0; i < threads.size(); i++)
+                    threads[i].join();
+                sqlite_level_stats stats;
+                memset(&stats, '\0', sizeof(stats));
+                std::vector<page_ref> next_level;
+                long interior_count = 0;
+                long leaf_count = 0;
+                for (int i = 0; i < slice_count; i++) {
+                    slice_result& res = results[i];
+                    stats.page_count += res.stats.page_count;
+                    stats.cell_count += res.stats.cell_count;
+                    stats.used_bytes += res.stats.used_bytes;
+                    stats.free_bytes += res.stats.free_bytes;
+                    stats.frag_bytes += res.stats.frag_bytes;
+                    report.entry_count += res.entry_count;
+                    report.overflow_pages += res.overflow_pages;
+                    interior_count += res.interior_count;
+                    leaf_count += res.leaves.size();
+                    next_level.insert(next_level.end(), res.children.begin(), res.children.end());
+                    for (size_t j = 0; j < res.leaves.size(); j++) {
+                        if (prev_leaf != 0 && res.leaves[j] == prev_leaf + 1)
+                            report.contiguous_leaves++;
+                        prev_leaf = res.leaves[j];
+                    }
+                    if (records != NULL)
+                        records->insert(records->end(), res.records.begin(), res.records.end());
+                    for (size_t j = 0; j < res.errors.size() && errors.size() < VERIFY_MAX_ERRORS; j++)
+                        errors.push_back(res.errors[j]);
+                }
+                if (interior_count > 0 && leaf_count > 0)
+                    errors.push_back("Leaves at different depths in " + report.name);
+                report.leaf_count += leaf_count;
+                report.levels.push_back(stats);
+                level.swap(next_level);
+            }
+        }
+
+        // Locates value of given column in a record
+        static const uint8_t *locate_col(const std::string& rec, int col, uint32_t& serial_type) {
+            const uint8_t *r = (const uint8_t *) rec.data();
+            int vlen;
+            int hdr_len = read_varint(r, vlen);
+            int hdr_pos = vlen;
+            int data_pos = hdr_len;
+            for (int i = 0; hdr_pos < hdr_len; i++) {
+                serial_type = read_varint(r + hdr_pos, vlen);
+                hdr_pos += vlen;
+                if (data_pos + serial_type_len(serial_type) > (int) rec.length())
+                    return NULL;
+                if (i == col)
+                    return r + data_pos;
+                data_pos += serial_type_len(serial_type);
+            }
+            return NULL;
+        }
+
+        void claim_freelist(uint32_t trunk, uint32_t free_count) {
+            slice_result res;
+            uint8_t buf[page_size];
+            uint32_t claimed = 0;
+            while (trunk && claim_page(trunk, 1, res) && read_page(trunk, buf)) {
+                claimed++;
+                uint32_t leaf_count = util::read_uint32(buf + 4);
+                for (uint32_t i = 0; i < leaf_count && i < (uint32_t) (usable_size / 4) - 2; i++)
+                    claimed += claim_page(util::read_uint32(buf + 8 + i * 4), trunk, res);
+                trunk = util::read_uint32(buf);
+            }
+            if (claimed != free_count)
+                add_error(res, 1, "freelist page count differs, found", claimed);
+            errors.insert(errors.end(), res.errors.begin(), res.errors.end());
+        }
+
+    public:
+        std::vector<std::string> errors;
+        std::vector<sqlite_tree_report> trees;
+        long unused_pages;
+
+        sqlite_verifier(const char *fname, int threads = 0) : filename (fname) {
+            thread_count = threads;
+            if (thread_count < 1)
+                thread_count = std::thread::hardware_concurrency();
+            if (thread_count < 1)
+                thread_count = 1;
+            fd = -1;
+            page_refs = NULL;
+            unused_pages = 0;
+        }
+
+        ~sqlite_verifier() {
+            if (fd != -1)
+                close(fd);
+            delete [] page_refs;
+        }
+
+        // Verifies all trees listed in sqlite_master
+        // Returns number of errors found or SQLT_RES_* if file
+        // could not be read
+        int verify() {
+            errors.clear();
+            trees.clear();
+            fd = open(filename, O_RDONLY);
+            if (fd == -1)
+                return SQLT_RES_READ_ERR;
+            uint8_t file_hdr[100];
+            if (pread(fd, file_hdr, 100, 0) != 100)
+                return SQLT_RES_READ_ERR;
+            if (memcmp(file_hdr, "SQLite format 3\0", 16) != 0)
+                return SQLT_RES_INVALID_SIG;
+            page_size = util::read_uint16(file_hdr + 16);
+            if (page_size == 1)
+                page_size = 65536;
+            usable_size = page_size - file_hdr[20];
+            struct stat file_stat;
+            fstat(fd, &file_stat);
+            page_count = file_stat.st_size / page_size;
+            delete [] page_refs;
+            page_refs = new std::atomic<uint8_t>[page_count];
+            for (uint32_t i = 0; i < page_count; i++)
+                page_refs[i] = 0;
+            // Lock-byte page is never used
+            if (page_count > 1073741824UL / page_size)
+                page_refs[1073741824UL / page_size] = 1;
+            sqlite_tree_report master;
+            master.name = "sqlite_master";
+            master.root_page = 1;
+            std::vector<std::string> master_recs;
+            verify_tree(master, &master_recs);
+            trees.push_back(master);
+            for (size_t i = 0; i < master_recs.size(); i++) {
+                uint32_t serial_type;
+                const uint8_t *name_col = locate_col(master_recs[i], 1, serial_type);
+                if (name_col == NULL || serial_type < 13)
+                    continue;
+                sqlite_tree_report report;
+                report.name.assign((const char *) name_col, serial_type_len(serial_type));
+                const uint8_t *root_col = locate_col(master_recs[i], 3, serial_type);
+                if (root_col == NULL || serial_type < 1 || serial_type > 6)
+                    continue; // views and triggers have no root page
+                report.root_page = read_int_col(root_col, serial_type);
+                verify_tree(report);
+                trees.push_back(report);
+            }
+            claim_freelist(util::read_uint32(file_hdr + 32), util::read_uint32(file_hdr + 36));
+            unused_pages = 0;
+            for (uint32_t i = 0; i < page_count; i++) {
+                if (page_refs[i] == 0) {
+                    if (unused_pages++ < 10 && errors.size() < VERIFY_MAX_ERRORS) {
+                        char err[50];
+                        snprintf(err, sizeof(err), "Page %u is never used", i + 1);
+                        errors.push_back(err);
+                    }
+                }
+            }
+            return errors.size();
+        }
+
+        void print_report() {
+            for (size_t i = 0; i < trees.size(); i++) {
+                sqlite_tree_report& tree = trees[i];
+                std::cout << (tree.is_index ? "Index " : "Table ") << tree.name << ", root: " << tree.root_page
+                     << ", entries: " << tree.entry_count << ", overflow pages: " << tree.overflow_pages << std::endl;
+                for (size_t j = 0; j < tree.levels.size(); j++) {
+                    sqlite_level_stats& lvl = tree.levels[j];
+                    long total = lvl.used_bytes + lvl.free_bytes;
+                    std::cout << "  Level " << j << ": pages: " << lvl.page_count << ", cells: " << lvl.cell_count
+                         << ", fill: " << (total ? lvl.used_bytes * 100 / total : 0) << "%"
+                         << ", fragmented bytes: " << lvl.frag_bytes << std::endl;
+                }
+                if (tree.leaf_count > 1)
+                    std::cout << "  Leaves contiguous: " << tree.contiguous_leaves * 100 / (tree.leaf_count - 1) << "%" << std::endl;
+            }
+            std::cout << "Pages: " << page_count << ", never used: " << unused_pages << std::endl;
+            for (size_t i = 0; i < errors.size(); i++)
+                std::cout << errors[i] << std::endl;
+        }
+
+};
+
+#endif
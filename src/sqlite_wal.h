@@ -0,0 +1,469 @@
+#ifndef SQLITE_WAL_H
+#define SQLITE_WAL_H
+#ifndef ARDUINO
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#endif
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "univix_util.h"
+
+// Write-ahead log in the format of Sqlite WAL mode
+// see https://www.sqlite.org/fileformat.html#the_write_ahead_log
+// and https://www.sqlite.org/walformat.html
+// Changed pages are appended to <db>-wal and the wal-index in <db>-shm
+// is kept up to date on each commit, so that sqlite3 connections of
+// other processes read the last committed state while writing continues.
+// The writer holds the WAL write and checkpoint locks all along,
+// so other connections can only read.
+// Page numbers here are 1 based as in Sqlite.
+
+#define WAL_MAGIC 0x377f0683 // checksums over big-endian words
+#define WAL_VERSION 3007000
+#define WAL_HDR_SIZE 32
+#define WAL_FRAME_HDR_SIZE 24
+#define WAL_NREADER 5
+#define WAL_READMARK_NOT_USED 0xffffffff
+#define WAL_SHM_REGION_SIZE 32768
+#define WAL_SHM_HDR_SIZE 136
+#define WAL_HASH_NPAGE 4096
+#define WAL_HASH_NPAGE_ONE (WAL_HASH_NPAGE - WAL_SHM_HDR_SIZE / 4)
+#define WAL_HASH_NSLOT 8192
+#define WAL_HASH_MULTIPLIER 383
+#define WAL_LOCK_OFFSET 120
+#define WAL_WRITE_LOCK 0
+#define WAL_CKPT_LOCK 1
+#define WAL_READ_LOCK(i) (3 + (i))
+#define WAL_DMS_LOCK 128
+// Range locked by each Sqlite connection of the unix vfs holding the
+// main file shared. Holding it keeps a closing reader from deleting the WAL.
+#define WAL_DB_SHARED_FIRST 0x40000002
+#define WAL_DB_SHARED_SIZE 510
+#define WAL_DEFAULT_AUTO_CKPT 1000
+
+// wal-index header, kept twice at start of <db>-shm in native byte order
+typedef struct {
+    uint32_t version;
+    uint32_t unused;
+    uint32_t change;
+    uint8_t is_init;
+    uint8_t is_big_end_cksum;
+    uint16_t page_size;
+    uint32_t mx_frame;
+    uint32_t page_count;
+    uint32_t frame_cksum[2];
+    uint8_t salt[8];
+    uint32_t cksum[2];
+} wal_index_hdr;
+
+// Checkpoint information following the two wal-index headers
+typedef struct {
+    uint32_t backfill;
+    uint32_t read_mark[WAL_NREADER];
+    uint8_t lock[8];
+    uint32_t backfill_attempted;
+    uint32_t not_used;
+} wal_ckpt_info;
+
+class sqlite_wal {
+    protected:
+        int page_size;
+        std::string wal_name;
+        std::string shm_name;
+        int db_fd;
+        int wal_fd;
+        int shm_fd;
+        uint32_t frame_count; // including frames not yet committed
+        uint32_t ckpt_seq;
+        uint8_t salt[8];
+        uint32_t frame_cksum[2];
+        wal_index_hdr hdr;
+        std::vector<uint8_t *> shm_regions;
+        // Latest frame of each page written to the WAL
+        std::unordered_map<uint32_t, uint32_t> page_frames;
+        uint8_t *frame_buf;
+        bool is_recovered;
+
+        // Sqlite WAL checksum, see walChecksumBytes() of Sqlite
+        static void calc_cksum(bool is_big_endian, const uint8_t *data, int len, uint32_t *cksum) {
+            uint32_t s1 = cksum[0];
+            uint32_t s2 = cksum[1];
+            for (int i = 0; i < len; i += 8) {
+                uint32_t x1, x2;
+                if (is_big_endian) {
+                    x1 = util::read_uint32(data + i);
+                    x2 = util::read_uint32(data + i + 4);
+                } else {
+                    memcpy(&x1, data + i, 4);
+                    memcpy(&x2, data + i + 4, 4);
+                }
+                s1 += x1 + s2;
+                s2 += x2 + s1;
+            }
+            cksum[0] = s1;
+            cksum[1] = s2;
+        }
+
+        // Non-blocking posix lock, same as used by Sqlite unix vfs
+        static bool lock_range(int fd, off_t start, off_t len, short type) {
+            struct flock lk;
+            memset(&lk, '\0', sizeof(lk));
+            lk.l_type = type;
+            lk.l_whence = SEEK_SET;
+            lk.l_start = start;
+            lk.l_len = len;
+            return fcntl(fd, F_SETLK, &lk) == 0;
+        }
+
+        bool shm_lock(int lock_idx, int count, short type) {
+            return lock_range(shm_fd, WAL_LOCK_OFFSET + lock_idx, count, type);
+        }
+
+        uint8_t *shm_region(int region) {
+            while (shm_regions.size() <= (size_t) region) {
+                off_t region_end = WAL_SHM_REGION_SIZE;
+                region_end *= (shm_regions.size() + 1);
+                struct stat shm_stat;
+                if (fstat(shm_fd, &shm_stat) || (shm_stat.st_size < region_end
+                        && ftruncate(shm_fd, region_end)))
+                    throw errno;
+                void *map = mmap(NULL, WAL_SHM_REGION_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, shm_fd, region_end - WAL_SHM_REGION_SIZE);
+                if (map == MAP_FAILED)
+                    throw errno;
+                shm_regions.push_back((uint8_t *) map);
+            }
+            return shm_regions[region];
+        }
+
+        wal_ckpt_info *ckpt_info() {
+            return (wal_ckpt_info *) (shm_region(0) + 2 * sizeof(wal_index_hdr));
+        }
+
+        // Records page of given frame in the hash table of its shm region
+        // as Sqlite readers locate pages in the WAL through these
+        void index_append(uint32_t frame, uint32_t page_no) {
+            int region = 0;
+            uint32_t zero_frame = 0;
+            uint8_t *page_nos = shm_region(0) + WAL_SHM_HDR_SIZE;
+            if (frame > WAL_HASH_NPAGE_ONE) {
+                region = (frame - WAL_HASH_NPAGE_ONE - 1) / WAL_HASH_NPAGE + 1;
+                zero_frame = WAL_HASH_NPAGE_ONE + (region - 1) * WAL_HASH_NPAGE;
+                page_nos = shm_region(region);
+            }
+            uint16_t *hash = (uint16_t *) (shm_region(region) + WAL_HASH_NPAGE * 4);
+            uint32_t idx = frame - zero_frame;
+            if (idx == 1) // first frame of region, entries of earlier WAL are stale
+                memset(page_nos, '\0', (uint8_t *) (hash + WAL_HASH_NSLOT) - page_nos);
+            int key = (page_no * WAL_HASH_MULTIPLIER) & (WAL_HASH_NSLOT - 1);
+            while (hash[key])
+                key = (key + 1) & (WAL_HASH_NSLOT - 1);
+            memcpy(page_nos + (idx - 1) * 4, &page_no, 4);
+            hash[key] = idx;
+        }
+
+        // Second copy is written first, readers retry when copies differ
+        void write_index_hdr() {
+            hdr.change++;
+            hdr.cksum[0] = hdr.cksum[1] = 0;
+            calc_cksum(false, (uint8_t *) &hdr, offsetof(wal_index_hdr, cksum), hdr.cksum);
+            wal_index_hdr *shm_hdr = (wal_index_hdr *) shm_region(0);
+            memcpy(shm_hdr + 1, &hdr, sizeof(hdr));
+            __sync_synchronize();
+            memcpy(shm_hdr, &hdr, sizeof(hdr));
+            __sync_synchronize();
+        }
+
+        // Starts a new WAL over the old one with new salts
+        // so that frames of the old one are not valid anymore
+        void restart_log() {
+            ckpt_seq++;
+            uint32_t salt1 = util::read_uint32(salt) + 1;
+            util::write_uint32(salt, salt1);
+            util::write_uint32(salt + 4, (uint32_t) rand() ^ (uint32_t) time(NULL));
+            uint8_t wal_hdr[WAL_HDR_SIZE];
+            util::write_uint32(wal_hdr, WAL_MAGIC);
+            util::write_uint32(wal_hdr + 4, WAL_VERSION);
+            util::write_uint32(wal_hdr + 8, page_size);
+            util::write_uint32(wal_hdr + 12, ckpt_seq);
+            memcpy(wal_hdr + 16, salt, 8);
+            frame_cksum[0] = frame_cksum[1] = 0;
+            calc_cksum(true, wal_hdr, 24, frame_cksum);
+            util::write_uint32(wal_hdr + 24, frame_cksum[0]);
+            util::write_uint32(wal_hdr + 28, frame_cksum[1]);
+            if (ftruncate(wal_fd, 0) || pwrite(wal_fd, wal_hdr, WAL_HDR_SIZE, 0) != WAL_HDR_SIZE)
+                throw EIO;
+            fdatasync(wal_fd);
+            frame_count = 0;
+            page_frames.clear();
+            hdr.mx_frame = 0;
+            memcpy(hdr.salt, salt, 8);
+            memcpy(hdr.frame_cksum, frame_cksum, 8);
+            write_index_hdr();
+            wal_ckpt_info *info = ckpt_info();
+            info->backfill = 0;
+            info->backfill_attempted = 0;
+            info->read_mark[0] = 0;
+            info->read_mark[1] = 0;
+            for (int i = 2; i < WAL_NREADER; i++)
+                info->read_mark[i] = WAL_READMARK_NOT_USED;
+            __sync_synchronize();
+        }
+
+        off_t frame_pos(uint32_t frame) {
+            off_t pos = WAL_FRAME_HDR_SIZE + page_size;
+            pos *= (frame - 1);
+            return pos + WAL_HDR_SIZE;
+        }
+
+        void write_frame(uint32_t page_no, const uint8_t *data, uint32_t db_size) {
+            util::write_uint32(frame_buf, page_no);
+            util::write_uint32(frame_buf + 4, db_size);
+            memcpy(frame_buf + 8, salt, 8);
+            calc_cksum(true, frame_buf, 8, frame_cksum);
+            calc_cksum(true, data, page_size, frame_cksum);
+            util::write_uint32(frame_buf + 16, frame_cksum[0]);
+            util::write_uint32(frame_buf + 20, frame_cksum[1]);
+            memcpy(frame_buf + WAL_FRAME_HDR_SIZE, data, page_size);
+            frame_count++;
+            int frame_size = WAL_FRAME_HDR_SIZE + page_size;
+            if (pwrite(wal_fd, frame_buf, frame_size, frame_pos(frame_count)) != frame_size)
+                throw EIO;
+            page_frames[page_no] = frame_count;
+            index_append(frame_count, page_no);
+        }
+
+        // Copies latest version of each page in the WAL to the main file
+        bool backfill(uint32_t db_size) {
+            for (std::unordered_map<uint32_t, uint32_t>::iterator it = page_frames.begin();
+                    it != page_frames.end(); it++) {
+                if (it->first > db_size)
+                    continue;
+                off_t db_pos = page_size;
+                db_pos *= (it->first - 1);
+                if (pread(wal_fd, frame_buf, page_size, frame_pos(it->second) + WAL_FRAME_HDR_SIZE) != page_size
+                        || pwrite(db_fd, frame_buf, page_size, db_pos) != page_size)
+                    return false;
+            }
+            off_t db_len = page_size;
+            db_len *= db_size;
+            struct stat db_stat;
+            if (fstat(db_fd, &db_stat) == 0 && db_stat.st_size > db_len)
+                ftruncate(db_fd, db_len);
+            return fsync(db_fd) == 0;
+        }
+
+        // Reads back frames of a WAL left by an earlier writer that did
+        // not finish, up to its last commit, so that they get checkpointed
+        void recover() {
+            struct stat wal_stat;
+            uint8_t wal_hdr[WAL_HDR_SIZE];
+            if (fstat(wal_fd, &wal_stat) || wal_stat.st_size < WAL_HDR_SIZE
+                    || pread(wal_fd, wal_hdr, WAL_HDR_SIZE, 0) != WAL_HDR_SIZE)
+                return;
+            uint32_t magic = util::read_uint32(wal_hdr);
+            if ((magic & 0xFFFFFFFE) != (WAL_MAGIC & 0xFFFFFFFE)
+                    || util::read_uint32(wal_hdr + 8) != (uint32_t) page_size)
+                return;
+            bool is_big_endian = (magic & 1);
+            uint32_t cksum[2] = {0, 0};
+            calc_cksum(is_big_endian, wal_hdr, 24, cksum);
+            if (cksum[0] != util::read_uint32(wal_hdr + 24) || cksum[1] != util::read_uint32(wal_hdr + 28))
+                return;
+            ckpt_seq = util::read_uint32(wal_hdr + 12);
+            memcpy(salt, wal_hdr + 16, 8);
+            std::unordered_map<uint32_t, uint32_t> frames;
+            uint32_t frame = 0;
+            uint32_t db_size = 0;
+            while (frame_pos(frame + 2) <= wal_stat.st_size) {
+                if (pread(wal_fd, frame_buf, WAL_FRAME_HDR_SIZE + page_size, frame_pos(frame + 1))
+                        != WAL_FRAME_HDR_SIZE + page_size || memcmp(frame_buf + 8, salt, 8))
+                    break;
+                calc_cksum(is_big_endian, frame_buf, 8, cksum);
+                calc_cksum(is_big_endian, frame_buf + WAL_FRAME_HDR_SIZE, page_size, cksum);
+                if (cksum[0] != util::read_uint32(frame_buf + 16) || cksum[1] != util::read_uint32(frame_buf + 20))
+                    break;
+                frame++;
+                frames[util::read_uint32(frame_buf)] = frame;
+                if (util::read_uint32(frame_buf + 4)) {
+                    db_size = util::read_uint32(frame_buf + 4);
+                    for (std::unordered_map<uint32_t, uint32_t>::iterator it = frames.begin(); it != frames.end(); it++)
+                        page_frames[it->first] = it->second;
+                    frames.clear();
+                }
+            }
+            if (db_size == 0)
+                return;
+            if (!backfill(db_size))
+                throw EIO;
+            hdr.page_count = db_size;
+            is_recovered = true;
+            std::cout << "WAL recovered pages: " << page_frames.size() << std::endl;
+        }
+
+    public:
+        int auto_ckpt_frames;
+
+        sqlite_wal(const char *db_filename, int pg_size, int auto_ckpt = WAL_DEFAULT_AUTO_CKPT) {
+            page_size = pg_size;
+            auto_ckpt_frames = auto_ckpt;
+            wal_name = db_filename;
+            wal_name += "-wal";
+            shm_name = db_filename;
+            shm_name += "-shm";
+            frame_count = 0;
+            ckpt_seq = 0;
+            is_recovered = false;
+            memset(salt, '\0', 8);
+            memset(&hdr, '\0', sizeof(hdr));
+            frame_buf = (uint8_t *) malloc(WAL_FRAME_HDR_SIZE + page_size);
+            db_fd = open(db_filename, O_RDWR);
+            if (db_fd == -1)
+                throw errno;
+            wal_fd = open(wal_name.c_str(), O_RDWR | O_CREAT, 0644);
+            if (wal_fd == -1)
+                throw errno;
+            shm_fd = open(shm_name.c_str(), O_RDWR | O_CREAT, 0644);
+            if (shm_fd == -1)
+                throw errno;
+            // First one to open the shm initializes it, as in Sqlite
+            if (shm_lock(WAL_DMS_LOCK - WAL_LOCK_OFFSET, 1, F_WRLCK)) {
+                if (ftruncate(shm_fd, 0))
+                    throw errno;
+            }
+            if (!shm_lock(WAL_DMS_LOCK - WAL_LOCK_OFFSET, 1, F_RDLCK)
+                    || !shm_lock(WAL_WRITE_LOCK, 2, F_WRLCK)
+                    || !lock_range(db_fd, WAL_DB_SHARED_FIRST, WAL_DB_SHARED_SIZE, F_RDLCK))
+                throw EBUSY;
+            // Readers of an existing WAL would lose their snapshot
+            if (!shm_lock(WAL_READ_LOCK(0), WAL_NREADER, F_WRLCK))
+                throw EBUSY;
+            struct stat db_stat;
+            if (fstat(db_fd, &db_stat))
+                throw errno;
+            hdr.page_count = db_stat.st_size / page_size;
+            recover();
+            hdr.version = WAL_VERSION;
+            hdr.is_init = 1;
+            hdr.is_big_end_cksum = (WAL_MAGIC & 1);
+            hdr.page_size = (page_size & 0xff00) | (page_size >> 16);
+            restart_log();
+            shm_lock(WAL_READ_LOCK(0), WAL_NREADER, F_UNLCK);
+        }
+
+        ~sqlite_wal() {
+            for (size_t i = 0; i < shm_regions.size(); i++)
+                munmap(shm_regions[i], WAL_SHM_REGION_SIZE);
+            // Like last Sqlite connection, removes the WAL
+            // if no other connection has the file open
+            lock_range(db_fd, WAL_DB_SHARED_FIRST, WAL_DB_SHARED_SIZE, F_UNLCK);
+            if (frame_count == 0 && lock_range(db_fd, WAL_DB_SHARED_FIRST, WAL_DB_SHARED_SIZE, F_WRLCK)) {
+                unlink(wal_name.c_str());
+                unlink(shm_name.c_str());
+            }
+            close(shm_fd);
+            close(wal_fd);
+            close(db_fd);
+            free(frame_buf);
+        }
+
+        // Appends a page that is not visible to readers until commit()
+        void write_page(uint32_t page_no, const uint8_t *data) {
+            write_frame(page_no, data, 0);
+        }
+
+        // Appends last page of a transaction and makes all pages
+        // written so far visible to readers. db_size is the
+        // file size in pages after the transaction.
+        void commit(uint32_t page_no, const uint8_t *data, uint32_t db_size) {
+            write_frame(page_no, data, db_size);
+            if (fdatasync(wal_fd))
+                throw EIO;
+            hdr.mx_frame = frame_count;
+            hdr.page_count = db_size;
+            memcpy(hdr.frame_cksum, frame_cksum, 8);
+            write_index_hdr();
+            if (frame_count >= (uint32_t) auto_ckpt_frames)
+                checkpoint();
+        }
+
+        // Reads latest version of page, from the WAL if written there
+        int read_page(uint32_t page_no, uint8_t *block) {
+            std::unordered_map<uint32_t, uint32_t>::iterator it = page_frames.find(page_no);
+            if (it != page_frames.end())
+                return pread(wal_fd, block, page_size, frame_pos(it->second) + WAL_FRAME_HDR_SIZE);
+            off_t db_pos = page_size;
+            db_pos *= (page_no - 1);
+            return pread(db_fd, block, page_size, db_pos);
+        }
+
+        // Copies committed pages to the main file and starts the WAL over.
+        // Done only when no reader is on a snapshot older than last commit
+        // and no frames are pending commit, else tried again on next commit.
+        // Returns true if the WAL was emptied
+        bool checkpoint() {
+            if (frame_count == 0)
+                return true;
+            if (frame_count != hdr.mx_frame)
+                return false;
+            wal_ckpt_info *info = ckpt_info();
+            for (int i = 1; i < WAL_NREADER; i++) {
+                uint32_t read_mark = info->read_mark[i];
+                if (read_mark >= hdr.mx_frame)
+                    continue;
+                if (!shm_lock(WAL_READ_LOCK(i), 1, F_WRLCK))
+                    return false;
+                info->read_mark[i] = (i == 1 ? hdr.mx_frame : WAL_READMARK_NOT_USED);
+                shm_lock(WAL_READ_LOCK(i), 1, F_UNLCK);
+            }
+            if (info->backfill < hdr.mx_frame) {
+                // Readers on lock 0 read only the main file
+                if (!shm_lock(WAL_READ_LOCK(0), 1, F_WRLCK))
+                    return false;
+                bool is_done = backfill(hdr.page_count);
+                if (is_done) {
+                    info->backfill = hdr.mx_frame;
+                    info->backfill_attempted = hdr.mx_frame;
+                    __sync_synchronize();
+                }
+                shm_lock(WAL_READ_LOCK(0), 1, F_UNLCK);
+                if (!is_done)
+                    throw EIO;
+            }
+            // Readers still on the WAL keep it from being restarted
+            if (!shm_lock(WAL_READ_LOCK(1), WAL_NREADER - 1, F_WRLCK))
+                return false;
+            restart_log();
+            shm_lock(WAL_READ_LOCK(1), WAL_NREADER - 1, F_UNLCK);
+            return true;
+        }
+
+        bool was_recovered() {
+            return is_recovered;
+        }
+
+        uint32_t get_page_count() {
+            return hdr.page_count;
+        }
+
+        uint32_t get_frame_count() {
+            return frame_count;
+        }
+
+        int get_page_size() {
+            return page_size;
+        }
+
+};
+
+#endif
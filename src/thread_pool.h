@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#ifndef ARDUINO
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#endif
+
+// Small fixed set of worker threads for running a few short tasks
+// side by side and waiting for all of them, such as probing more
+// than one index at a time. Tasks are numbered 0 to task_count - 1.
+class thread_pool {
+    protected:
+        std::vector<std::thread> workers;
+        std::mutex pool_mutex;
+        std::condition_variable work_cv;
+        std::condition_variable done_cv;
+        std::function<void(int)> task_fn;
+        int task_count;
+        int next_task;
+        int pending_count;
+        long batch_no;
+        bool to_stop;
+
+        void worker_loop() {
+            long last_batch_no = 0;
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            while (true) {
+                work_cv.wait(lock, [&] { return to_stop || (batch_no != last_batch_no && next_task < task_count); });
+                if (to_stop)
+                    return;
+                last_batch_no = batch_no;
+                while (next_task < task_count) {
+                    int task_no = next_task++;
+                    lock.unlock();
+                    task_fn(task_no);
+                    lock.lock();
+                    if (--pending_count == 0)
+                        done_cv.notify_all();
+                }
+            }
+        }
+
+    public:
+        thread_pool(int thread_count) {
+            task_count = next_task = pending_count = 0;
+            batch_no = 0;
+            to_stop = false;
+            for (int i = 0; i < thread_count; i++)
+                workers.push_back(std::thread(&thread_pool::worker_loop, this));
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                to_stop = true;
+            }
+            work_cv.notify_all();
+            for (size_t i = 0; i < workers.size(); i++)
+                workers[i].join();
+        }
+
+        // Runs fn(0) .. fn(count - 1) and returns when all are done
+        // The calling thread takes tasks too, so it never just waits
+        void run_all(int count, std::function<void(int)> fn) {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            task_fn = fn;
+            task_count = count;
+            next_task = 0;
+            pending_count = count;
+            batch_no++;
+            work_cv.notify_all();
+            while (next_task < task_count) {
+                int task_no = next_task++;
+                lock.unlock();
+                task_fn(task_no);
+                lock.lock();
+                pending_count--;
+            }
+            done_cv.wait(lock, [&] { return pending_count == 0; });
+        }
+
+        int size() {
+            return workers.size();
+        }
+
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef TIER_MERGER_H
+#define TIER_MERGER_H
+#ifndef ARDUINO
+#include <string>
+#include <vector>
+#include <set>
+#include <queue>
+#include <algorithm>
+#endif
+#include "univix_util.h"
+#include "sqlite_cursor.h"
+
+// One source of key, value pairs in key order for tier_merger
+class tier_cursor {
+    public:
+        virtual ~tier_cursor() {}
+        // Moves to next entry, returns false when no more
+        virtual bool next() = 0;
+        // Positions so that next() gives first key not less than given
+        virtual void seek(const uint8_t *key, int key_len) = 0;
+        virtual const uint8_t *get_key(int& key_len) = 0;
+        virtual const uint8_t *get_value(int& value_len) = 0;
+};
+
+// Entries copied out of an in-memory tree, each laid out as
+// key length, key, value length and value and sorted by key.
+// If empty values are tombstones, as in idx0 of logger, they are
+// given as length -1.
+class buf_tier_cursor : public tier_cursor {
+    protected:
+        std::string buf;
+        std::vector<int> entry_pos;
+        bool is_empty_deleted;
+        int cur;
+
+        struct entry_key_less {
+            const uint8_t *buf;
+            entry_key_less(const uint8_t *b) : buf (b) {}
+            bool operator()(int pos1, int pos2) const {
+                return util::compare(buf + pos1 + 1, buf[pos1], buf + pos2 + 1, buf[pos2]) < 0;
+            }
+        };
+
+    public:
+        buf_tier_cursor(bool is_empty_tombstone = false) {
+            is_empty_deleted = is_empty_tombstone;
+            cur = -1;
+        }
+
+        // Entry as laid out in idx0 blocks
+        void add(const uint8_t *entry) {
+            entry_pos.push_back(buf.length());
+            buf.append((const char *) entry, entry[0] + entry[entry[0] + 1] + 2);
+        }
+
+        // To be called once all entries are added
+        void sort() {
+            std::sort(entry_pos.begin(), entry_pos.end(), entry_key_less((const uint8_t *) buf.data()));
+            cur = -1;
+        }
+
+        bool next() {
+            if (cur < (int) entry_pos.size())
+                cur++;
+            return cur < (int) entry_pos.size();
+        }
+
+        void seek(const uint8_t *key, int key_len) {
+            const uint8_t *b = (const uint8_t *) buf.data();
+            int first = 0;
+            int last = entry_pos.size();
+            while (first < last) {
+                int middle = (first + last) >> 1;
+                const uint8_t *e = b + entry_pos[middle];
+                if (util::compare(e + 1, e[0], key, key_len) < 0)
+                    first = middle + 1;
+                else
+                    last = middle;
+            }
+            cur = first - 1;
+        }
+
+        const uint8_t *get_key(int& key_len) {
+            const uint8_t *e = (const uint8_t *) buf.data() + entry_pos[cur];
+            key_len = e[0];
+            return e + 1;
+        }
+
+        const uint8_t *get_value(int& value_len) {
+            const uint8_t *e = (const uint8_t *) buf.data() + entry_pos[cur];
+            value_len = e[e[0] + 1];
+            if (is_empty_deleted && value_len == 0)
+                value_len = -1;
+            return e + e[0] + 2;
+        }
+
+        int size() {
+            return entry_pos.size();
+        }
+
+};
+
+// Reads a Sqlite file written by logger, with key and value columns.
+// Keys in skip_keys are left out, as they are removed but still in file.
+class sqlite_tier_cursor : public tier_cursor {
+    protected:
+        sqlite_cursor cursor;
+        std::set<std::string> skip_keys;
+
+        bool is_skipped() {
+            if (skip_keys.empty())
+                return false;
+            int key_len;
+            const uint8_t *key = cursor.get_key(key_len);
+            return skip_keys.count(std::string((const char *) key, key_len)) > 0;
+        }
+
+    public:
+        sqlite_tier_cursor(const char *filename) : cursor(filename) {
+        }
+
+        void set_skip_keys(const std::set<std::string>& keys) {
+            skip_keys = keys;
+        }
+
+        bool next() {
+            while (cursor.next()) {
+                if (!is_skipped())
+                    return true;
+            }
+            return false;
+        }
+
+        void seek(const uint8_t *key, int key_len) {
+            cursor.seek(key, key_len);
+        }
+
+        const uint8_t *get_key(int& key_len) {
+            return cursor.get_key(key_len);
+        }
+
+        const uint8_t *get_value(int& value_len) {
+            return cursor.get_value(value_len);
+        }
+
+        // Whole record as stored, for copying to another Sqlite file
+        const uint8_t *get_rec(int& rec_len) {
+            return cursor.get_rec(rec_len);
+        }
+
+};
+
+// Merges cursors of more than one tier into one sequence in key order.
+// Cursors are given newest tier first and when a key is in more than
+// one tier, only the entry of the newest is returned.
+// Range is from start key (inclusive) to end key (exclusive), set
+// with set_range(). Both are open if not set.
+class tier_merger {
+    protected:
+        std::vector<tier_cursor *> cursors;
+        std::vector<std::string> cur_keys;
+        std::string end_key;
+        bool has_end_key;
+        bool to_skip_deleted;
+        bool is_started;
+        int cur_tier;
+
+        // Top of heap is least key, newest tier among equal keys
+        struct heap_greater {
+            std::vector<std::string> *keys;
+            heap_greater(std::vector<std::string> *k) : keys (k) {}
+            bool operator()(int tier1, int tier2) const {
+                int cmp = util::compare((const uint8_t *) (*keys)[tier1].data(), (*keys)[tier1].length(),
+                            (const uint8_t *) (*keys)[tier2].data(), (*keys)[tier2].length());
+                return cmp == 0 ? tier1 > tier2 : cmp > 0;
+            }
+        };
+        std::priority_queue<int, std::vector<int>, heap_greater> heap;
+
+        void advance(int tier) {
+            if (cursors[tier]->next()) {
+                int key_len;
+                const uint8_t *key = cursors[tier]->get_key(key_len);
+                cur_keys[tier].assign((const char *) key, key_len);
+                heap.push(tier);
+            }
+        }
+
+    public:
+        tier_merger() : heap(heap_greater(&cur_keys)) {
+            has_end_key = false;
+            to_skip_deleted = false;
+            is_started = false;
+            cur_tier = -1;
+        }
+
+        ~tier_merger() {
+            for (size_t i = 0; i < cursors.size(); i++)
+                delete cursors[i];
+        }
+
+        // Takes ownership of cursor. To be added newest first,
+        // before the first call to next() or seek()
+        void add_cursor(tier_cursor *cursor) {
+            cursors.push_back(cursor);
+            cur_keys.push_back(std::string());
+        }
+
+        // Either of the keys can be NULL for no bound
+        void set_range(const uint8_t *start_key, int start_len, const uint8_t *end, int end_len) {
+            has_end_key = (end != NULL);
+            if (has_end_key)
+                end_key.assign((const char *) end, end_len);
+            if (start_key != NULL)
+                seek(start_key, start_len);
+        }
+
+        // Deleted keys have value length -1 and hide older values.
+        // They are returned too unless asked to skip.
+        void set_skip_deleted(bool to_skip) {
+            to_skip_deleted = to_skip;
+        }
+
+        // Positions so that next() gives first key not less than given
+        void seek(const uint8_t *key, int key_len) {
+            heap = std::priority_queue<int, std::vector<int>, heap_greater>(heap_greater(&cur_keys));
+            for (size_t i = 0; i < cursors.size(); i++) {
+                cursors[i]->seek(key, key_len);
+                advance(i);
+            }
+            is_started = true;
+            cur_tier = -1;
+        }
+
+        // Moves to next key, returns false when no more
+        bool next() {
+            if (!is_started) {
+                for (size_t i = 0; i < cursors.size(); i++)
+                    advance(i);
+                is_started = true;
+            } else if (cur_tier >= 0)
+                advance(cur_tier);
+            while (true) {
+                cur_tier = -1;
+                if (heap.empty())
+                    return false;
+                cur_tier = heap.top();
+                heap.pop();
+                // older copies of the same key are passed over
+                while (!heap.empty() && cur_keys[heap.top()] == cur_keys[cur_tier]) {
+                    int tier = heap.top();
+                    heap.pop();
+                    advance(tier);
+                }
+                if (!to_skip_deleted)
+                    break;
+                int value_len;
+                cursors[cur_tier]->get_value(value_len);
+                if (value_len >= 0)
+                    break;
+                advance(cur_tier);
+            }
+            if (has_end_key && util::compare((const uint8_t *) cur_keys[cur_tier].data(), cur_keys[cur_tier].length(),
+                    (const uint8_t *) end_key.data(), end_key.length()) >= 0) {
+                heap = std::priority_queue<int, std::vector<int>, heap_greater>(heap_greater(&cur_keys));
+                cur_tier = -1;
+                return false;
+            }
+            return true;
+        }
+
+        const uint8_t *get_key(int& key_len) {
+            key_len = cur_keys[cur_tier].length();
+            return (const uint8_t *) cur_keys[cur_tier].data();
+        }
+
+        const uint8_t *get_value(int& value_len) {
+            return cursors[cur_tier]->get_value(value_len);
+        }
+
+        // Tier the current entry is from, in the order added
+        int get_tier() {
+            return cur_tier;
+        }
+
+        tier_cursor *get_cursor() {
+            return cursors[cur_tier];
+        }
+
+};
+
+#endif
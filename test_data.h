@@ -0,0 +1,300 @@
+#ifndef TEST_DATA_H
+#define TEST_DATA_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Generated records for test_lobster and bench_lobster, each laid
+// out as key length (vint), key, 0, value length (vint), value, 0
+
+// Returns how many bytes the given integer will
+// occupy if stored as a variable integer
+int8_t get_vlen_of_uint32(uint32_t vint) {
+    return vint > ((1 << 28) - 1) ? 5
+        : (vint > ((1 << 21) - 1) ? 4 
+        : (vint > ((1 << 14) - 1) ? 3
+        : (vint > ((1 << 7) - 1) ? 2 : 1)));
+}
+
+int write_vint32(uint8_t *ptr, uint32_t vint) {
+    int len = get_vlen_of_uint32(vint);
+    for (int i = len - 1; i > 0; i--)
+        *ptr++ = 0x80 + ((vint >> (7 * i)) & 0x7F);
+    *ptr = vint & 0x7F;
+    return len;
+}
+
+uint32_t read_vint32(const uint8_t *ptr, int8_t *vlen) {
+    uint32_t ret = 0;
+    int8_t len = 5; // read max 5 bytes
+    do {
+        ret <<= 7;
+        ret += *ptr & 0x7F;
+        len--;
+    } while ((*ptr++ & 0x80) == 0x80 && len);
+    if (vlen)
+        *vlen = 5 - len;
+    return ret;
+}
+
+#define CS_PRINTABLE 1
+#define CS_ALPHA_ONLY 2
+#define CS_NUMBER_ONLY 3
+#define CS_ONE_PER_OCTET 4
+#define CS_255_RANDOM 5
+#define CS_255_DENSE 6
+#define MIN_KEY_LEN 12
+
+// Which keys are put, as record numbers from 0 to NUM_ENTRIES - 1
+// whose keys are made the same way each time they are picked, except
+// for KD_UNIFORM which makes each key afresh at random
+#define KD_UNIFORM 0
+#define KD_ZIPFIAN 1    // a few records very often, as in YCSB
+#define KD_HOTSPOT 2    // HOTSPOT_OP_PCT of picks from HOTSPOT_KEY_PCT of records
+#define KD_LATEST 3     // new records and those put lately more often
+#define KD_SEQUENTIAL 4 // keys in ascending order, off by up to SEQ_JITTER
+#define ZIPF_THETA 0.99
+#define HOTSPOT_KEY_PCT 20
+#define HOTSPOT_OP_PCT 80
+// Percent of picks of KD_LATEST that are new records
+#define LATEST_NEW_PCT 50
+#define SEQ_JITTER 64
+
+// splitmix64, so that data made from a seed is the same everywhere
+struct data_rng {
+    uint64_t state;
+    data_rng(uint64_t seed) : state(seed) {
+    }
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    // From 0 to less than 1
+    double next_double() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+};
+
+// Picks record numbers by one of the KD_* distributions. Zipfian
+// picks are as per Gray et al, "Quickly generating billion-record
+// synthetic databases", with record 0 the most frequent
+class key_picker {
+    protected:
+        int dist;
+        long key_count;
+        double zipf_alpha;
+        double zipf_eta;
+        double zipf_zetan;
+
+        static double zeta(long n, double theta) {
+            double sum = 0;
+            for (long i = 1; i <= n; i++)
+                sum += 1 / pow(i, theta);
+            return sum;
+        }
+
+        long next_zipf(data_rng& rng) {
+            double u = rng.next_double();
+            double uz = u * zipf_zetan;
+            if (uz < 1)
+                return 0;
+            if (uz < 1 + pow(0.5, ZIPF_THETA))
+                return 1;
+            long n = (long) (key_count * pow(zipf_eta * u - zipf_eta + 1, zipf_alpha));
+            return n < key_count ? n : key_count - 1;
+        }
+
+    public:
+        key_picker(int key_dist, long count) {
+            dist = key_dist;
+            key_count = count > 2 ? count : 2;
+            zipf_alpha = zipf_eta = zipf_zetan = 0;
+            if (dist == KD_ZIPFIAN || dist == KD_LATEST) {
+                zipf_zetan = zeta(key_count, ZIPF_THETA);
+                zipf_alpha = 1 / (1 - ZIPF_THETA);
+                zipf_eta = (1 - pow(2.0 / key_count, 1 - ZIPF_THETA)) / (1 - zeta(2, ZIPF_THETA) / zipf_zetan);
+            }
+        }
+
+        // newest is the number of records put so far, or the position
+        // in sequence for KD_SEQUENTIAL
+        long next(data_rng& rng, long newest) {
+            switch (dist) {
+                case KD_ZIPFIAN:
+                    return next_zipf(rng);
+                case KD_HOTSPOT: {
+                    long hot_count = key_count * HOTSPOT_KEY_PCT / 100 + 1;
+                    if ((long) (rng.next() % 100) < HOTSPOT_OP_PCT)
+                        return rng.next() % hot_count;
+                    return hot_count + rng.next() % (key_count - hot_count > 0 ? key_count - hot_count : 1);
+                }
+                case KD_LATEST: {
+                    if (newest <= 0 || (long) (rng.next() % 100) < LATEST_NEW_PCT)
+                        return newest;
+                    long n = newest - 1 - next_zipf(rng);
+                    return n < 0 ? 0 : n;
+                }
+                case KD_SEQUENTIAL: {
+                    long n = newest + (long) (rng.next() % (2 * SEQ_JITTER + 1)) - SEQ_JITTER;
+                    return n < 0 ? 0 : n;
+                }
+            }
+            return rng.next() % key_count;
+        }
+
+        // As next(), but only among the count records put so far,
+        // for reads. KD_LATEST picks by zipf back from the newest.
+        long next_existing(data_rng& rng, long count) {
+            long n = (dist == KD_LATEST ? count - 1 - next_zipf(rng) : next(rng, count));
+            return n < 0 ? 0 : (n < count ? n : count - 1);
+        }
+};
+
+// Makes NUM_ENTRIES records of keys picked as per KEY_DIST, the same
+// for the same seed
+int64_t prepare_data(uint8_t **data_buf_ptr, int64_t data_sz, int KEY_LEN, int VALUE_LEN, int NUM_ENTRIES,
+        int CHAR_SET, bool KEY_VALUE_VAR_LEN, int KEY_DIST, uint64_t seed) {
+    char k[KEY_LEN + 21];
+    char v[VALUE_LEN + 1];
+    int k_len = KEY_LEN;
+    int v_len = VALUE_LEN;
+    int seq_width = KEY_LEN;
+    uint8_t *data_buf = *data_buf_ptr;
+    int64_t ret = 0;
+    data_rng rng(seed);
+    key_picker picker(KEY_DIST, NUM_ENTRIES);
+    for (unsigned long l = 0; l < NUM_ENTRIES; l++) {
+
+        unsigned long r = (KEY_DIST == KD_UNIFORM ? l : picker.next(rng, l));
+        // keys of picked records are made from a generator of their own
+        data_rng key_rng(seed ^ (r * 0xd1342543de82ef95ULL));
+        data_rng& krng = (KEY_DIST == KD_UNIFORM ? rng : key_rng);
+        if (KEY_DIST == KD_SEQUENTIAL) {
+            KEY_LEN = sprintf(k, "%0*lu", seq_width, r);
+        } else if (CHAR_SET == CS_PRINTABLE) {
+            for (int i = 0; i < KEY_LEN; i++)
+                k[i] = 32 + (krng.next() % 95);
+            k[KEY_LEN] = 0;
+        } else if (CHAR_SET == CS_ALPHA_ONLY) {
+            for (int i = 0; i < KEY_LEN; i++)
+                k[i] = 97 + (krng.next() % 26);
+            k[KEY_LEN] = 0;
+        } else if (CHAR_SET == CS_NUMBER_ONLY) {
+            for (int i = 0; i < KEY_LEN; i++)
+                k[i] = 48 + (krng.next() % 10);
+            k[KEY_LEN] = 0;
+        } else if (CHAR_SET == CS_ONE_PER_OCTET) {
+            for (int i = 0; i < KEY_LEN; i++)
+                k[i] = ((krng.next() % 32) << 3) | 0x07;
+            k[KEY_LEN] = 0;
+        } else if (CHAR_SET == CS_255_RANDOM) {
+            for (int i = 0; i < KEY_LEN; i++)
+                k[i] = (krng.next() % 255);
+            k[KEY_LEN] = 0;
+            for (int i = 0; i < KEY_LEN; i++) {
+                if (k[i] == 0)
+                    k[i] = i + 1;
+            }
+        } else if (CHAR_SET == CS_255_DENSE) {
+            KEY_LEN = 4;
+            k[0] = (r >> 24) & 0xFF;
+            k[1] = (r >> 16) & 0xFF;
+            k[2] = (r >> 8) & 0xFF;
+            k[3] = (r & 0xFF);
+            if (k[0] == 0)
+                k[0]++;
+            if (k[1] == 0)
+                k[1]++;
+            if (k[2] == 0)
+                k[2]++;
+            if (k[3] == 0)
+                k[3]++;
+            k[4] = 0;
+        }
+        //cout << "Value: ";
+        for (int i = 0; i < VALUE_LEN; i++) {
+            v[VALUE_LEN - i - 1] = k[i % KEY_LEN];
+            //cout << (char) k[i];
+        }
+        //cout << endl;
+        v[VALUE_LEN] = 0;
+        //itoa(rand(), v, 10);
+        //itoa(rand(), v + strlen(v), 10);
+        //itoa(rand(), v + strlen(v), 10);
+        k_len = KEY_LEN;
+        v_len = VALUE_LEN;
+        if (KEY_VALUE_VAR_LEN) {
+            // sequential keys keep their length to stay in order
+            if (KEY_DIST != KD_SEQUENTIAL) {
+                k_len = (krng.next() % KEY_LEN) + 1;
+                if (k_len < MIN_KEY_LEN)
+                    k_len = MIN_KEY_LEN;
+                k[k_len] = 0;
+            }
+            v_len = (rng.next() % VALUE_LEN) + 1;
+            v[v_len] = 0;
+        }
+        // if (l == 0)
+        //     printf("key: %.*s, value: %.*s\n", KEY_LEN, k, VALUE_LEN, v);
+        if (ret + k_len + v_len + 1000 > data_sz) {
+          data_sz += (32 * 1024 * 1024);
+          //printf("New data size: %d\n", data_sz / 1024 / 1024);
+          data_buf = (uint8_t *) realloc(data_buf, data_sz);
+          *data_buf_ptr = data_buf;
+        }
+        ret += write_vint32(data_buf + ret, k_len);
+        memcpy(data_buf + ret, k, k_len);
+        ret += k_len;
+        data_buf[ret++] = 0;
+        ret += write_vint32(data_buf + ret, v_len);
+        memcpy(data_buf + ret, v, v_len);
+        ret += v_len;
+        data_buf[ret++] = 0;
+
+    }
+    return ret;
+}
+
+// Makes NUM_ENTRIES records of keys made at random
+int64_t prepare_data(uint8_t **data_buf_ptr, int64_t data_sz, int KEY_LEN, int VALUE_LEN, int NUM_ENTRIES, int CHAR_SET, bool KEY_VALUE_VAR_LEN) {
+    return prepare_data(data_buf_ptr, data_sz, KEY_LEN, VALUE_LEN, NUM_ENTRIES, CHAR_SET, KEY_VALUE_VAR_LEN, KD_UNIFORM, time(NULL));
+}
+
+// Ops of a recorded trace, each laid out as op (1 byte), key length
+// (1), value length (4, little endian) and key
+#define TRACE_OP_PUT 'P'
+#define TRACE_OP_GET 'G'
+#define TRACE_OP_DEL 'D'
+#define TRACE_HDR_SIZE 6
+
+struct trace_entry {
+    uint8_t op;
+    uint8_t key_len;
+    uint32_t value_len;
+    uint8_t key[256];
+};
+
+// Reads next op of trace, false at end or if cut short
+bool read_trace_entry(FILE *fp, trace_entry& entry) {
+    uint8_t hdr[TRACE_HDR_SIZE];
+    if (fread(hdr, 1, TRACE_HDR_SIZE, fp) != TRACE_HDR_SIZE)
+        return false;
+    entry.op = hdr[0];
+    entry.key_len = hdr[1];
+    entry.value_len = hdr[2] | (hdr[3] << 8) | (hdr[4] << 16) | ((uint32_t) hdr[5] << 24);
+    return fread(entry.key, 1, entry.key_len, fp) == entry.key_len;
+}
+
+bool write_trace_entry(FILE *fp, uint8_t op, const uint8_t *key, uint8_t key_len, uint32_t value_len) {
+    uint8_t hdr[TRACE_HDR_SIZE] = {op, key_len, (uint8_t) value_len, (uint8_t) (value_len >> 8),
+            (uint8_t) (value_len >> 16), (uint8_t) (value_len >> 24)};
+    return fwrite(hdr, 1, TRACE_HDR_SIZE, fp) == TRACE_HDR_SIZE && fwrite(key, 1, key_len, fp) == key_len;
+}
+
+#endif
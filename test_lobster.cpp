@@ -27,13 +27,21 @@
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <time.h>
 #include <fstream>
 #include <string>
+#include <thread>
 #include <sstream>
 #include <vector>
 
 #include "lobster.h"
+#include "logger.h"
+#include "sharded_logger.h"
+#include "sqlite_db.h"
+#include "sqlite_verify.h"
+#include "test_data.h"
 
 using namespace std;
 
@@ -177,132 +185,6 @@ int read_db(int argc, char *argv[]) {
   return SQLT_RES_OK;
 }
 
-// Returns how many bytes the given integer will
-// occupy if stored as a variable integer
-int8_t get_vlen_of_uint32(uint32_t vint) {
-    return vint > ((1 << 28) - 1) ? 5
-        : (vint > ((1 << 21) - 1) ? 4 
-        : (vint > ((1 << 14) - 1) ? 3
-        : (vint > ((1 << 7) - 1) ? 2 : 1)));
-}
-
-int write_vint32(uint8_t *ptr, uint32_t vint) {
-    int len = get_vlen_of_uint32(vint);
-    for (int i = len - 1; i > 0; i--)
-        *ptr++ = 0x80 + ((vint >> (7 * i)) & 0x7F);
-    *ptr = vint & 0x7F;
-    return len;
-}
-
-uint32_t read_vint32(const uint8_t *ptr, int8_t *vlen) {
-    uint32_t ret = 0;
-    int8_t len = 5; // read max 5 bytes
-    do {
-        ret <<= 7;
-        ret += *ptr & 0x7F;
-        len--;
-    } while ((*ptr++ & 0x80) == 0x80 && len);
-    if (vlen)
-        *vlen = 5 - len;
-    return ret;
-}
-
-#define CS_PRINTABLE 1
-#define CS_ALPHA_ONLY 2
-#define CS_NUMBER_ONLY 3
-#define CS_ONE_PER_OCTET 4
-#define CS_255_RANDOM 5
-#define CS_255_DENSE 6
-#define MIN_KEY_LEN 12
-int64_t prepare_data(uint8_t **data_buf_ptr, int64_t data_sz, int KEY_LEN, int VALUE_LEN, int NUM_ENTRIES, int CHAR_SET, bool KEY_VALUE_VAR_LEN) {
-    char k[KEY_LEN + 1];
-    char v[VALUE_LEN + 1];
-    int k_len = KEY_LEN;
-    int v_len = VALUE_LEN;
-    uint8_t *data_buf = *data_buf_ptr;
-    int64_t ret = 0;
-    srand(time(NULL));
-    for (unsigned long l = 0; l < NUM_ENTRIES; l++) {
-
-        if (CHAR_SET == CS_PRINTABLE) {
-            for (int i = 0; i < KEY_LEN; i++)
-                k[i] = 32 + (rand() % 95);
-            k[KEY_LEN] = 0;
-        } else if (CHAR_SET == CS_ALPHA_ONLY) {
-            for (int i = 0; i < KEY_LEN; i++)
-                k[i] = 97 + (rand() % 26);
-            k[KEY_LEN] = 0;
-        } else if (CHAR_SET == CS_NUMBER_ONLY) {
-            for (int i = 0; i < KEY_LEN; i++)
-                k[i] = 48 + (rand() % 10);
-            k[KEY_LEN] = 0;
-        } else if (CHAR_SET == CS_ONE_PER_OCTET) {
-            for (int i = 0; i < KEY_LEN; i++)
-                k[i] = ((rand() % 32) << 3) | 0x07;
-            k[KEY_LEN] = 0;
-        } else if (CHAR_SET == CS_255_RANDOM) {
-            for (int i = 0; i < KEY_LEN; i++)
-                k[i] = (rand() % 255);
-            k[KEY_LEN] = 0;
-            for (int i = 0; i < KEY_LEN; i++) {
-                if (k[i] == 0)
-                    k[i] = i + 1;
-            }
-        } else if (CHAR_SET == CS_255_DENSE) {
-            KEY_LEN = 4;
-            k[0] = (l >> 24) & 0xFF;
-            k[1] = (l >> 16) & 0xFF;
-            k[2] = (l >> 8) & 0xFF;
-            k[3] = (l & 0xFF);
-            if (k[0] == 0)
-                k[0]++;
-            if (k[1] == 0)
-                k[1]++;
-            if (k[2] == 0)
-                k[2]++;
-            if (k[3] == 0)
-                k[3]++;
-            k[4] = 0;
-        }
-        //cout << "Value: ";
-        for (int i = 0; i < VALUE_LEN; i++) {
-            v[VALUE_LEN - i - 1] = k[i % KEY_LEN];
-            //cout << (char) k[i];
-        }
-        //cout << endl;
-        v[VALUE_LEN] = 0;
-        //itoa(rand(), v, 10);
-        //itoa(rand(), v + strlen(v), 10);
-        //itoa(rand(), v + strlen(v), 10);
-        if (KEY_VALUE_VAR_LEN) {
-            k_len = (rand() % KEY_LEN) + 1;
-            v_len = (rand() % VALUE_LEN) + 1;
-            if (k_len < MIN_KEY_LEN)
-                k_len = MIN_KEY_LEN;
-            k[k_len] = 0;
-            v[v_len] = 0;
-        }
-        // if (l == 0)
-        //     printf("key: %.*s, value: %.*s\n", KEY_LEN, k, VALUE_LEN, v);
-        ret += write_vint32(data_buf + ret, k_len);
-        memcpy(data_buf + ret, k, k_len);
-        ret += k_len;
-        data_buf[ret++] = 0;
-        ret += write_vint32(data_buf + ret, v_len);
-        memcpy(data_buf + ret, v, v_len);
-        ret += v_len;
-        data_buf[ret++] = 0;
-        if (ret + KEY_LEN + VALUE_LEN + 1000 < data_sz) {
-          data_sz += (32 * 1024 * 1024);
-          //printf("New data size: %d\n", data_sz / 1024 / 1024);
-          data_buf = (uint8_t *) realloc(data_buf, data_sz);
-          *data_buf_ptr = data_buf;
-        }
-
-    }
-    return ret;
-}
-
 void check_value(const uint8_t key[], int key_len, const uint8_t val[], int val_len,
       const uint8_t returned_value[], int returned_len, int& cmp) {
       int d = util::compare(val, val_len, returned_value, returned_len);
@@ -323,6 +205,18 @@ bool run_cmd(char cmd[]) {
   return true;
 }
 
+// Verifies b-trees of file in-process and prints space utilization
+bool verify_file(const char *filename) {
+  sqlite_verifier verifier(filename);
+  int res = verifier.verify();
+  verifier.print_report();
+  if (res != 0) {
+    cout << "FAILED: verifying " << filename << endl;
+    return false;
+  }
+  return true;
+}
+
 const string census_col_names = "cum_prop100k, rank, name, year, count, prop100k, pctwhite, pctblack, pctapi, pctaian, pct2prace, pcthispanic";
 const uint8_t census_col_types[] = {SQLT_TYPE_REAL, SQLT_TYPE_INT32, SQLT_TYPE_TEXT, SQLT_TYPE_INT32, SQLT_TYPE_INT32, SQLT_TYPE_REAL,
                                SQLT_TYPE_REAL, SQLT_TYPE_REAL, SQLT_TYPE_REAL, SQLT_TYPE_REAL, SQLT_TYPE_REAL, SQLT_TYPE_REAL};
@@ -331,6 +225,7 @@ bool test_census(int page_size, int cache_size, const char *filename) {
 
   remove(filename);
   sqlite_index_blaster *sqib = new sqlite_index_blaster(12, 3, census_col_names, "surnames", page_size, cache_size, filename);
+  sqib->set_pk_col_types(census_col_types);
   ifstream file("sample_data/census.txt");
   if (file.is_open()) {
       string line;
@@ -441,6 +336,7 @@ bool test_babynames(int page_size, int cache_size, const char *filename) {
   remove(filename);
   sqlite_index_blaster *sqib = new sqlite_index_blaster(7, 3, baby_col_names,
                                   "gendered_names", page_size, cache_size, filename);
+  sqib->set_pk_col_types(baby_col_types);
   ifstream file("sample_data/babynames.txt");
   if (file.is_open()) {
       string line;
@@ -580,6 +476,8 @@ bool test_random_data(long start_count, int cache_size) {
     bool ret = test_random_data(page_size, start_count, cache_size, filename);
     if (!ret)
       return false;
+    if (!verify_file(filename))
+      return false;
     char cmd[100];
     sprintf(cmd, "sqlite3 %s \"pragma integrity_check\"", filename);
     return run_cmd(cmd);
@@ -587,6 +485,1051 @@ bool test_random_data(long start_count, int cache_size) {
   return true;
 }
 
+bool test_multi_table(int page_size, long count, int cache_size, const char *filename) {
+  remove(filename);
+  int KEY_LEN = 20;
+  int VALUE_LEN = 40;
+  int64_t data_alloc_sz = 64 * 1024 * 1024;
+  uint8_t *data_buf = (uint8_t *) malloc(data_alloc_sz);
+  int64_t data_sz = prepare_data(&data_buf, data_alloc_sz, KEY_LEN, VALUE_LEN, count, CS_ALPHA_ONLY, true);
+  cout << "Testing multi table, page size: " << page_size << ", count: " << count << endl;
+  {
+    sqlite_db db(page_size, cache_size, filename);
+    int kv_id = db.add_table("kv", 2, 1, const_kv);
+    db.add_index("kv_value", "kv", "value");
+    int vk_id = db.add_table("vk", 2, 1, "value, key");
+    if (db.open() != SQLT_RES_OK) {
+      free(data_buf);
+      return false;
+    }
+    for (int64_t pos = 0; pos < data_sz; pos++) {
+      int8_t vlen;
+      uint32_t key_len = read_vint32(data_buf + pos, &vlen);
+      pos += vlen;
+      uint32_t value_len = read_vint32(data_buf + pos + key_len + 1, &vlen);
+      const void *values[] = {data_buf + pos, data_buf + pos + key_len + vlen + 1};
+      const size_t kv_lens[] = {key_len, value_len};
+      const size_t vk_lens[] = {value_len, key_len};
+      const void *vk_values[] = {values[1], values[0]};
+      db.put(kv_id, values, kv_lens);
+      db.put(vk_id, vk_values, vk_lens);
+      pos += key_len + value_len + vlen + 1;
+    }
+  }
+  free(data_buf);
+  if (!verify_file(filename))
+    return false;
+  char cmd[200];
+  sprintf(cmd, "sqlite3 %s \"pragma integrity_check\"", filename);
+  if (!run_cmd(cmd))
+    return false;
+  sprintf(cmd, "sqlite3 %s \"select count(*) from kv indexed by kv_value where value > ''\"", filename);
+  return run_cmd(cmd);
+}
+
+// Makes a file of one table and corrupts the first page with room
+// between cell pointers and content: how 0 puts a freeblock of size 0
+// there pointing to itself, how 1 points first cell past end of page.
+// Verifier is to find errors and return.
+bool test_verify_corrupt(int page_size, int how, const char *filename) {
+  remove(filename);
+  {
+    sqlite_db db(page_size, 1024, filename);
+    int kv_id = db.add_table("kv", 2, 1, const_kv);
+    if (db.open() != SQLT_RES_OK) {
+      cout << "FAILED: creating " << filename << endl;
+      return false;
+    }
+    for (int i = 0; i < 5000; i++) {
+      char key[20];
+      char val[40];
+      size_t lens[] = {(size_t) sprintf(key, "key%07d", i), (size_t) sprintf(val, "value of key %07d", i)};
+      const void *values[] = {key, val};
+      db.put(kv_id, values, lens);
+    }
+  }
+  FILE *fp = fopen(filename, "r+b");
+  if (fp == NULL) {
+    cout << "FAILED: opening " << filename << endl;
+    return false;
+  }
+  uint8_t page[page_size];
+  bool is_corrupted = false;
+  for (long page_no = 2; !is_corrupted && fseek(fp, (page_no - 1) * page_size, SEEK_SET) == 0
+          && fread(page, 1, page_size, fp) == page_size; page_no++) {
+    bool is_leaf = (page[0] == 10 || page[0] == 13);
+    if (!is_leaf && page[0] != 2 && page[0] != 5)
+      continue;
+    int ptr_pos = (is_leaf ? 8 : 12);
+    int ptr_end = ptr_pos + util::read_uint16(page + 3) * 2;
+    int content_start = util::read_uint16(page + 5);
+    if (how == 0) {
+      if (content_start - ptr_end < 4)
+        continue;
+      content_start -= 4;
+      util::write_uint16(page + 5, content_start);
+      util::write_uint16(page + 1, content_start);
+      util::write_uint16(page + content_start, content_start);
+      util::write_uint16(page + content_start + 2, 0);
+    } else
+      util::write_uint16(page + ptr_pos, page_size);
+    is_corrupted = (fseek(fp, (page_no - 1) * page_size, SEEK_SET) == 0
+          && fwrite(page, 1, page_size, fp) == page_size);
+  }
+  fclose(fp);
+  if (!is_corrupted) {
+    cout << "FAILED: no page to corrupt in " << filename << endl;
+    return false;
+  }
+  sqlite_verifier verifier(filename);
+  int res = verifier.verify();
+  verifier.print_report();
+  if (res <= 0) {
+    cout << "FAILED: corrupt " << filename << " verified with no errors" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Reads integer column of record as written in its serial type
+int64_t read_int_col(sqlite& sq, uint8_t *rec, int col, int& col_type) {
+  int col_type_or_len, col_len;
+  uint8_t *data = sq.locate_col(col, rec, col_type_or_len, col_len, col_type);
+  if (data == NULL)
+    return 0;
+  int8_t v8;
+  int16_t v16;
+  int32_t v32;
+  int64_t v64;
+  switch (col_type) {
+    case SQLT_TYPE_INT8:
+      sq.read_col(col, rec, 0, &v8);
+      return v8;
+    case SQLT_TYPE_INT16:
+      sq.read_col(col, rec, 0, &v16);
+      return v16;
+    case SQLT_TYPE_INT24:
+    case SQLT_TYPE_INT32:
+      sq.read_col(col, rec, 0, &v32);
+      return v32;
+  }
+  sq.read_col(col, rec, 0, &v64);
+  return v64;
+}
+
+struct int_width_case {
+  int64_t val;
+  uint8_t type; // narrowest serial type holding val
+};
+
+const int_width_case int_width_cases[] = {
+  {0, SQLT_TYPE_INT8}, {127, SQLT_TYPE_INT8}, {128, SQLT_TYPE_INT16},
+  {-128, SQLT_TYPE_INT8}, {-129, SQLT_TYPE_INT16},
+  {32767, SQLT_TYPE_INT16}, {32768, SQLT_TYPE_INT24},
+  {-32768, SQLT_TYPE_INT16}, {-32769, SQLT_TYPE_INT24},
+  {8388607, SQLT_TYPE_INT24}, {8388608, SQLT_TYPE_INT32},
+  {-8388608, SQLT_TYPE_INT24}, {-8388609, SQLT_TYPE_INT32},
+  {2147483647LL, SQLT_TYPE_INT32}, {2147483648LL, SQLT_TYPE_INT48},
+  {-2147483648LL, SQLT_TYPE_INT32}, {-2147483649LL, SQLT_TYPE_INT48},
+  {140737488355327LL, SQLT_TYPE_INT48}, {140737488355328LL, SQLT_TYPE_INT64},
+  {-140737488355328LL, SQLT_TYPE_INT48}, {-140737488355329LL, SQLT_TYPE_INT64},
+  {INT64_MAX, SQLT_TYPE_INT64}, {INT64_MIN, SQLT_TYPE_INT64}
+};
+
+// Encodes batches with make_new_recs() whose integer columns are at
+// each width boundary and reads every column back
+bool test_make_new_recs(const char *filename) {
+  remove(filename);
+  cout << "Testing make_new_recs" << endl;
+  const uint8_t types[] = {SQLT_TYPE_TEXT, SQLT_TYPE_INT16, SQLT_TYPE_INT32, SQLT_TYPE_INT64, SQLT_TYPE_REAL, SQLT_TYPE_TEXT};
+  const int64_t col_mins[] = {0, INT16_MIN, INT32_MIN, INT64_MIN};
+  const int64_t col_maxs[] = {0, INT16_MAX, INT32_MAX, INT64_MAX};
+  sqlite sq(6, 1, "id, c16, c32, c64, r, t", "recs", 4096, 4096, 64, filename);
+  const int rec_count = 3;
+  bool ret = true;
+  for (size_t c = 0; c < sizeof(int_width_cases) / sizeof(int_width_cases[0]) && ret; c++) {
+    const int_width_case& wc = int_width_cases[c];
+    char ids[rec_count][10];
+    const char *id_ptrs[rec_count];
+    int16_t c16[rec_count];
+    int32_t c32[rec_count];
+    int64_t c64[rec_count];
+    double r[rec_count];
+    const char *t[rec_count] = {"", "some text", "more text, longer than the rest"};
+    for (int i = 0; i < rec_count; i++) {
+      sprintf(ids[i], "id%d", i);
+      id_ptrs[i] = ids[i];
+      // other records hold 0, so the batch narrows as per val
+      int64_t val = (i == 1 ? wc.val : 0);
+      c16[i] = (val >= col_mins[1] && val <= col_maxs[1] ? val : 0);
+      c32[i] = (val >= col_mins[2] && val <= col_maxs[2] ? val : 0);
+      c64[i] = val;
+      r[i] = val / 3.0;
+    }
+    const void *col_values[] = {id_ptrs, c16, c32, c64, r, t};
+    int buf_size = sqlite::get_recs_size(rec_count, 6, col_values, NULL, types);
+    uint8_t buf[buf_size];
+    int rec_lens[rec_count];
+    int total_len = sq.make_new_recs(buf, rec_count, 6, col_values, NULL, types, rec_lens);
+    if (total_len > buf_size) {
+      cout << "FAILED: records of " << total_len << " bytes, sized " << buf_size << endl;
+      return false;
+    }
+    uint8_t *rec = buf;
+    for (int i = 0; i < rec_count && ret; i++) {
+      for (int col = 1; col <= 3 && ret; col++) {
+        int64_t val = (col == 1 ? c16[i] : (col == 2 ? c32[i] : c64[i]));
+        int64_t col_val = (col == 1 ? c16[1] : (col == 2 ? c32[1] : c64[1]));
+        uint8_t expected_type = (col_val == wc.val ? wc.type : SQLT_TYPE_INT8);
+        int col_type;
+        int64_t read_val = read_int_col(sq, rec, col, col_type);
+        if (read_val != val || col_type != expected_type) {
+          cout << "FAILED: column " << col << " of " << wc.val << " read as " << read_val
+               << ", type " << col_type << " for " << (int) expected_type << endl;
+          ret = false;
+        }
+      }
+      char text[50];
+      double read_r;
+      int text_len = sq.read_col(5, rec, rec_lens[i], text);
+      sq.read_col(4, rec, rec_lens[i], &read_r);
+      if (ret && (read_r != r[i] || text_len != (int) strlen(t[i]) || memcmp(text, t[i], text_len))) {
+        cout << "FAILED: real or text of record " << i << " for " << wc.val << endl;
+        ret = false;
+      }
+      rec += rec_lens[i];
+    }
+    if (rec != buf + total_len) {
+      cout << "FAILED: record lengths do not add up for " << wc.val << endl;
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+// Checks whether index has the record of given column value and key
+bool check_idx_rec(sqlite *idx, const char *col_val, const char *key, bool is_expected) {
+  const void *values[] = {col_val, key};
+  uint8_t rec[strlen(col_val) + strlen(key) + 20];
+  int rec_len = idx->make_new_rec(rec, 2, values);
+  if (idx->get(rec, -rec_len) == is_expected)
+    return true;
+  cout << "FAILED: index " << (is_expected ? "missing " : "has stale ") << col_val << ", " << key << endl;
+  return false;
+}
+
+// Puts rows again with changed values and checks that each index
+// has records of new values only
+bool test_index_update(int page_size, long count, int cache_size, const char *filename) {
+  remove(filename);
+  cout << "Testing index update, page size: " << page_size << ", count: " << count << endl;
+  bool ret = true;
+  {
+    sqlite_db db(page_size, cache_size, filename);
+    int tbl_id = db.add_table("kvv", 3, 1, "key, val1, val2");
+    db.add_index("kvv_val1", "kvv", "val1");
+    db.add_index("kvv_val2", "kvv", "val2");
+    if (db.open() != SQLT_RES_OK)
+      return false;
+    for (int version = 0; version < 2 && ret; version++) {
+      for (long i = 0; i < count && ret; i++) {
+        // second time only every other row is changed
+        if (version == 1 && i % 2)
+          continue;
+        char key[20], val1[30], val2[30];
+        sprintf(key, "k%08ld", i);
+        sprintf(val1, "a%d_%ld", version, i);
+        sprintf(val2, "b%d_%ld", version, count - i);
+        const void *values[] = {key, val1, val2};
+        ret = (db.put(tbl_id, values) == SQLT_RES_OK);
+      }
+    }
+    for (long i = 0; i < count && ret; i++) {
+      char key[20], val[30];
+      int version = (i % 2 ? 0 : 1);
+      sprintf(key, "k%08ld", i);
+      sprintf(val, "a%d_%ld", version, i);
+      ret = check_idx_rec(db.get_tree("kvv_val1"), val, key, true);
+      sprintf(val, "b%d_%ld", version, count - i);
+      ret = ret && check_idx_rec(db.get_tree("kvv_val2"), val, key, true);
+      if (ret && version == 1) {
+        sprintf(val, "a0_%ld", i);
+        ret = check_idx_rec(db.get_tree("kvv_val1"), val, key, false);
+        sprintf(val, "b0_%ld", count - i);
+        ret = ret && check_idx_rec(db.get_tree("kvv_val2"), val, key, false);
+      }
+    }
+  }
+  if (!ret || !verify_file(filename))
+    return false;
+  char cmd[200];
+  sprintf(cmd, "sqlite3 %s \"pragma integrity_check\"", filename);
+  return run_cmd(cmd);
+}
+
+bool test_wal_readers(int page_size, long count, int cache_size, const char *filename) {
+  remove(filename);
+  int KEY_LEN = 20;
+  int VALUE_LEN = 40;
+  int64_t data_alloc_sz = 64 * 1024 * 1024;
+  uint8_t *data_buf = (uint8_t *) malloc(data_alloc_sz);
+  int64_t data_sz = prepare_data(&data_buf, data_alloc_sz, KEY_LEN, VALUE_LEN, count, CS_ALPHA_ONLY, true);
+  cout << "Testing WAL readers, page size: " << page_size << ", count: " << count << endl;
+  char cmd[200];
+  sprintf(cmd, "sqlite3 %s \"pragma integrity_check; select count(*) from kv\"", filename);
+  bool ret = true;
+  {
+    sqlite sq(2, 1, const_kv, "kv", page_size, page_size, cache_size, filename);
+    if (sq.enable_wal() != SQLT_RES_OK) {
+      free(data_buf);
+      return false;
+    }
+    long ctr = 0;
+    uint8_t rec[KEY_LEN + VALUE_LEN + 20];
+    for (int64_t pos = 0; pos < data_sz && ret; pos++) {
+      int8_t vlen;
+      uint32_t key_len = read_vint32(data_buf + pos, &vlen);
+      pos += vlen;
+      uint32_t value_len = read_vint32(data_buf + pos + key_len + 1, &vlen);
+      const void *values[] = {data_buf + pos, data_buf + pos + key_len + vlen + 1};
+      const size_t value_lens[] = {key_len, value_len};
+      int rec_len = sq.make_new_rec(rec, 2, values, value_lens);
+      sq.put(rec, -rec_len, NULL, 0);
+      pos += key_len + value_len + vlen + 1;
+      // readers check each committed snapshot while inserts go on
+      if (++ctr % (count / 4) == 0)
+        ret = (sq.commit() == SQLT_RES_OK && run_cmd(cmd));
+    }
+    sq.cleanup();
+  }
+  free(data_buf);
+  return ret && run_cmd(cmd);
+}
+
+// Removes files of logger of given name, along with rotated segments,
+// whose numbers can have gaps left by merges and expiry
+void remove_logger_files(const char *fname) {
+  const char *suffixes[] = {".ix0", ".ix0.fmt", ".ix1", ".ix1.blm", ".ix1.tim", ".ix2", ".ix2.blm", ".wal"};
+  for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    remove((string(fname) + suffixes[i]).c_str());
+  for (int seg_no = 1; seg_no <= 100; seg_no++) {
+    string seg_name = string(fname) + ".ix1." + to_string(seg_no);
+    remove(seg_name.c_str());
+    remove((seg_name + ".blm").c_str());
+    remove((seg_name + ".tim").c_str());
+  }
+}
+
+void make_logger_kv(long i, int version, char *key, char *val) {
+  sprintf(key, "k%010ld", i);
+  sprintf(val, "v%d_%010ld_of_about_forty_bytes", version, i);
+}
+
+// Puts keys into a tree of small blocks with find_slot() and
+// put_at_slot() as logger does for idx0, making space whenever the
+// key goes to a full leaf. Odd keys go in after even ones, so that
+// many land right where the leaf is split. Each key is checked just
+// after the split and all of them at the end.
+bool test_slot_split(long count, const char *filename) {
+  remove(filename);
+  cout << "Testing put at slot across splits, count: " << count << endl;
+  basix idx(512, 512, 64, filename);
+  long split_count = 0;
+  for (int odd = 0; odd < 2; odd++) {
+    for (long i = odd; i < count; i += 2) {
+      char key[20], val[50];
+      make_logger_kv(i, 0, key, val);
+      bpt_slot slot;
+      bool is_found = idx.find_slot((const uint8_t *) key, strlen(key), &slot);
+      idx.set_value((const uint8_t *) val, strlen(val));
+      if (idx.is_full(is_found ? slot.search_result : ~slot.search_result)) {
+        idx.make_space();
+        idx.refind_slot(&slot);
+        split_count++;
+      }
+      if (!idx.put_at_slot(&slot, (const uint8_t *) val, strlen(val)))
+        idx.put((const uint8_t *) key, strlen(key), (const uint8_t *) val, strlen(val));
+      int val_len = sizeof(val);
+      if (!idx.get((const uint8_t *) key, strlen(key), &val_len, (uint8_t *) val)) {
+        cout << "FAILED: " << key << " not found after put" << endl;
+        return false;
+      }
+    }
+  }
+  for (long i = 0; i < count; i++) {
+    char key[20], expected[50];
+    uint8_t val[50];
+    make_logger_kv(i, 0, key, expected);
+    int val_len = sizeof(val);
+    if (!idx.get((const uint8_t *) key, strlen(key), &val_len, val)
+          || val_len != (int) strlen(expected) || memcmp(val, expected, val_len)) {
+      cout << "FAILED: " << key << " not as put" << endl;
+      return false;
+    }
+  }
+  if (split_count == 0) {
+    cout << "FAILED: no leaf was split" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Adds count keys to a filter sized for far fewer, so that it grows
+// by many parts, and checks that all are found and that keys not
+// added are found no more often than about the rate given. The same
+// is to hold once exported and imported again.
+bool test_blocked_bloom(long count, double rate, const char *filename) {
+  remove(filename);
+  cout << "Testing blocked bloom, count: " << count << ", rate: " << rate << endl;
+  blocked_bloom bf;
+  bf.init(1000, rate);
+  char key[20], val[50];
+  for (long i = 0; i < count; i++) {
+    make_logger_kv(i, 0, key, val);
+    bf.add_uint8_str((const uint8_t *) key, strlen(key));
+  }
+  if (bf.get_count() != count || !bf.bf_export(filename)) {
+    cout << "FAILED: bloom count " << bf.get_count() << " or export" << endl;
+    return false;
+  }
+  blocked_bloom imported;
+  if (!imported.import(filename) || imported.get_count() != count) {
+    cout << "FAILED: bloom import" << endl;
+    return false;
+  }
+  blocked_bloom *filters[] = {&bf, &imported};
+  long positives[2] = {0, 0};
+  for (int f = 0; f < 2; f++) {
+    for (long i = 0; i < count; i++) {
+      make_logger_kv(i, 0, key, val);
+      if (filters[f]->check_uint8_str((const uint8_t *) key, strlen(key)) == BLOOM_FAILURE) {
+        cout << "FAILED: bloom lost " << key << endl;
+        return false;
+      }
+      make_logger_kv(count + i, 0, key, val);
+      if (filters[f]->check_uint8_str((const uint8_t *) key, strlen(key)) != BLOOM_FAILURE)
+        positives[f]++;
+    }
+  }
+  bf.stats();
+  cout << "False positive rate: " << (double) positives[0] / count << endl;
+  if (positives[0] != positives[1] || positives[0] > count * rate * 2) {
+    cout << "FAILED: bloom false positives " << positives[0] << " and imported " << positives[1] << endl;
+    return false;
+  }
+  return true;
+}
+
+// Checks that key i has value of given version, or none if version < 0
+bool check_logger_get(logger& lgr, long i, int version) {
+  char key[20], expected[50], val[50];
+  make_logger_kv(i, version < 0 ? 0 : version, key, expected);
+  int val_len = sizeof(val);
+  bool is_found = lgr.get(key, strlen(key), &val_len, val);
+  // with no room for the value, only whether it is there is known
+  int no_len = 0;
+  bool is_there = lgr.get(key, strlen(key), &no_len, NULL);
+  if (version < 0) {
+    if (!is_found && !is_there)
+      return true;
+    cout << "FAILED: deleted " << key << " found" << endl;
+    return false;
+  }
+  if (is_found && is_there && val_len == (int) strlen(expected) && memcmp(val, expected, val_len) == 0)
+    return true;
+  cout << "FAILED: " << key << (is_found && is_there ? " has other value" : " not found") << endl;
+  return false;
+}
+
+// Puts key i and deletes it right after if to_del, checking that
+// del() finds it only the first time
+bool put_del_logger_kv(logger& lgr, long i, bool to_put, bool to_del) {
+  char key[20], val[50];
+  make_logger_kv(i, 0, key, val);
+  if (to_put) {
+    lgr.put(key, strlen(key), val, strlen(val));
+    // every tenth key is seen twice, for it to go to hot tier
+    if (i % 10 == 0)
+      lgr.put(key, strlen(key), val, strlen(val));
+  }
+  if (to_del && (!lgr.del(key, strlen(key)) || lgr.del(key, strlen(key)))) {
+    cout << "FAILED: delete of " << key << " not as per its presence" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Fills a result_cache of room for about count entries and checks
+// that it stays within its budget and that CLOCK keeps an entry found
+// since the hand last passed over one that was not
+bool test_result_cache(int count) {
+  cout << "Testing result cache, count: " << count << endl;
+  char key[20], val[50];
+  make_logger_kv(0, 0, key, val);
+  long entry_bytes;
+  {
+    result_cache one(1L << 20);
+    one.add(key_hash::of((const uint8_t *) key, strlen(key)), (const uint8_t *) key, strlen(key), (const uint8_t *) val, strlen(val));
+    entry_bytes = one.get_bytes_used();
+  }
+  result_cache cache(entry_bytes * count);
+  for (long i = 0; i <= count; i++) {
+    make_logger_kv(i, 0, key, val);
+    cache.add(key_hash::of((const uint8_t *) key, strlen(key)), (const uint8_t *) key, strlen(key), (const uint8_t *) val, strlen(val));
+    if (i == count - 1) {
+      // first is found before the one past room is added
+      make_logger_kv(0, 0, key, val);
+      int val_len = sizeof(val);
+      if (!cache.get(key_hash::of((const uint8_t *) key, strlen(key)), (const uint8_t *) key, strlen(key), &val_len, (uint8_t *) val)) {
+        cout << "FAILED: result cache lost key within budget" << endl;
+        return false;
+      }
+    }
+  }
+  bool is_kept[2];
+  for (long i = 0; i < 2; i++) {
+    make_logger_kv(i, 0, key, val);
+    int val_len = sizeof(val);
+    is_kept[i] = cache.get(key_hash::of((const uint8_t *) key, strlen(key)), (const uint8_t *) key, strlen(key), &val_len, (uint8_t *) val);
+  }
+  if (cache.get_bytes_used() > entry_bytes * count || !is_kept[0] || is_kept[1]) {
+    cout << "FAILED: result cache of " << cache.get_bytes_used() << " bytes for " << entry_bytes * count
+         << " kept first: " << is_kept[0] << ", second: " << is_kept[1] << endl;
+    return false;
+  }
+  cache.clear();
+  if (cache.size() != 0 || cache.get_bytes_used() != 0) {
+    cout << "FAILED: result cache not empty after clear" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Gets every seventh key twice with a result cache too small for all
+// of them, so that values come from it and are let go, then puts again
+// or deletes them and checks that gets see the change
+bool test_logger_result_cache(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger result cache, count: " << count << endl;
+  logger lgr(fname, 1);
+  lgr.set_result_cache(1L << 20);
+  for (long i = 0; i < count; i++)
+    put_del_logger_kv(lgr, i, true, false);
+  bool ret = true;
+  for (int round = 0; round < 2; round++) {
+    for (long i = 0; i < count && ret; i += 7)
+      ret = check_logger_get(lgr, i, 0);
+  }
+  if (ret && lgr.get_metrics().result_cache_hits == 0) {
+    cout << "FAILED: no get found in result cache" << endl;
+    return false;
+  }
+  for (long i = 0; i < count && ret; i += 7) {
+    char key[20], val[50];
+    make_logger_kv(i, 1, key, val);
+    if (i % 2)
+      lgr.put(key, strlen(key), val, strlen(val));
+    else
+      lgr.del(key, strlen(key));
+  }
+  for (long i = 0; i < count && ret; i += 7)
+    ret = check_logger_get(lgr, i, i % 2 ? 1 : -1);
+  return ret;
+}
+
+// Deletes keys of first half once their values are down in idx1 or
+// hot tier and those of second half while in idx0. Putting the second
+// half sends tombstones of the first through frozen entries to idx1.
+bool test_logger_del(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger delete, count: " << count << endl;
+  bool ret = true;
+  for (int pass = 0; pass < 2 && ret; pass++) {
+    // second pass checks the same after reopening
+    logger lgr(fname, 1);
+    for (long i = 0; i < count && pass == 0 && ret; i++)
+      ret = put_del_logger_kv(lgr, i, true, false);
+    for (long i = 0; i < count && pass == 0 && ret; i += 4)
+      ret = put_del_logger_kv(lgr, i, false, true);
+    for (long i = count; i < count * 2 && pass == 0 && ret; i++)
+      ret = put_del_logger_kv(lgr, i, true, i % 4 == 1);
+    for (long i = 0; i < count * 2 && ret; i++)
+      ret = check_logger_get(lgr, i, i % 4 == (i < count ? 0 : 1) ? -1 : 0);
+  }
+  return ret;
+}
+
+// Version of key i put by test_logger_iterate, -1 if deleted
+int iterate_test_version(long i) {
+  return i % 5 == 2 ? -1 : (i % 3 == 0 ? 1 : 0);
+}
+
+// Checks that iterating from key start till key end gives each key
+// not deleted once, in order, with its latest value
+bool check_logger_iterate(logger& lgr, long start, long end, long count) {
+  char start_key[20], end_key[20], key[20], val[50];
+  make_logger_kv(start, 0, start_key, val);
+  make_logger_kv(end, 0, end_key, val);
+  tier_merger *it = lgr.iterate(start < 0 ? NULL : (const uint8_t *) start_key, strlen(start_key),
+                                end > count ? NULL : (const uint8_t *) end_key, strlen(end_key));
+  long i = (start < 0 ? 0 : start);
+  bool ret = true;
+  while (ret && it->next()) {
+    while (iterate_test_version(i) < 0)
+      i++;
+    make_logger_kv(i, iterate_test_version(i), key, val);
+    int key_len, val_len;
+    const uint8_t *k = it->get_key(key_len);
+    const uint8_t *v = it->get_value(val_len);
+    if (i >= end || key_len != (int) strlen(key) || memcmp(k, key, key_len)
+          || val_len != (int) strlen(val) || memcmp(v, val, val_len)) {
+      cout << "FAILED: iterate gave " << string((const char *) k, key_len) << " for " << key << endl;
+      ret = false;
+    }
+    i++;
+  }
+  delete it;
+  while (i < count && iterate_test_version(i) < 0)
+    i++;
+  if (ret && i < (end > count ? count : end)) {
+    cout << "FAILED: iterate ended before key " << i << endl;
+    ret = false;
+  }
+  return ret;
+}
+
+// Puts keys, puts every third of them again and deletes every fifth,
+// so that newest value or tombstone of a key is in idx0 while older
+// ones are in idx1 or hot tier, and iterates over all and over ranges
+bool test_logger_iterate(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger iterate, count: " << count << endl;
+  logger lgr(fname, 1);
+  for (int version = 0; version < 2; version++) {
+    for (long i = 0; i < count; i++) {
+      if (version == 1 && i % 3)
+        continue;
+      char key[20], val[50];
+      make_logger_kv(i, version, key, val);
+      lgr.put(key, strlen(key), val, strlen(val));
+    }
+  }
+  for (long i = 2; i < count; i += 5) {
+    char key[20], val[50];
+    make_logger_kv(i, 0, key, val);
+    lgr.del(key, strlen(key));
+  }
+  return check_logger_iterate(lgr, -1, count + 1, count)
+      && check_logger_iterate(lgr, count / 3, count / 2, count)
+      // bounds on deleted keys and an empty range
+      && check_logger_iterate(lgr, 2, 7, count)
+      && check_logger_iterate(lgr, 12, 12, count);
+}
+
+// A child process puts and deletes keys and exits once they are
+// in the WAL, without closing the logger. Reopening is to replay
+// them, passing over a torn record left at the end.
+bool test_logger_wal_replay(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger WAL replay, count: " << count << endl;
+  pid_t pid = fork();
+  if (pid == 0) {
+    logger *lgr = new logger(fname, 1);
+    for (long i = 0; i < count; i++) {
+      if (!put_del_logger_kv(*lgr, i, true, i % 7 == 3))
+        _exit(1);
+    }
+    lgr->sync_wal();
+    _exit(0);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status)) {
+    cout << "FAILED: logger process did not finish" << endl;
+    return false;
+  }
+  FILE *wal_fp = fopen((string(fname) + ".wal").c_str(), "ab");
+  if (wal_fp == NULL)
+    return false;
+  fwrite("\x01\x02\x03\x04\x05", 1, 5, wal_fp);
+  fclose(wal_fp);
+  logger lgr(fname, 1);
+  bool ret = true;
+  for (long i = 0; i < count && ret; i++)
+    ret = check_logger_get(lgr, i, i % 7 == 3 ? -1 : 0);
+  return ret;
+}
+
+// Version of key i put by test_logger_segments, -1 if deleted
+int segment_test_version(long i, long count) {
+  if (i >= count / 3)
+    return 0;
+  return i % 10 == 0 ? 1 : (i % 10 == 5 ? -1 : 0);
+}
+
+// Puts enough keys for idx1 to rotate twice at 1 million entries each,
+// then puts again or deletes some keys of the oldest segment and puts
+// more for those to be drained. Gets are to give the newest value while
+// segments are merged in background and after reopening. With probe
+// threads, keys in more than one segment are probed side by side and
+// the newest hit is to win.
+bool test_logger_segments(long count, long more_count, const char *fname, int probe_threads = 0) {
+  remove_logger_files(fname);
+  cout << "Testing logger segments, count: " << count << ", probe threads: " << probe_threads << endl;
+  // 1 million entries in idx1 before it rotates, 64mb for idx0
+  size_t cache_size_mb = (1 << 8) | 4;
+  bool ret = true;
+  for (int pass = 0; pass < 2 && ret; pass++) {
+    // second pass checks the same after reopening
+    logger lgr(fname, cache_size_mb);
+    lgr.set_probe_threads(probe_threads);
+    for (long i = 0; i < count && pass == 0; i++) {
+      char key[20], val[50];
+      make_logger_kv(i, 0, key, val);
+      lgr.put(key, strlen(key), val, strlen(val));
+    }
+    for (long i = 0; i < count / 3 && pass == 0; i += 5) {
+      char key[20], val[50];
+      make_logger_kv(i, 1, key, val);
+      if (segment_test_version(i, count) > 0)
+        lgr.put(key, strlen(key), val, strlen(val));
+      else
+        lgr.del(key, strlen(key));
+    }
+    for (long i = count; i < count + more_count && pass == 0; i++) {
+      char key[20], val[50];
+      make_logger_kv(i, 0, key, val);
+      lgr.put(key, strlen(key), val, strlen(val));
+    }
+    if (pass == 0 && lgr.get_metrics().rotations < 2) {
+      cout << "FAILED: idx1 rotated only " << lgr.get_metrics().rotations << " times" << endl;
+      return false;
+    }
+    for (long i = 0; i < count + more_count && ret; i++)
+      ret = check_logger_get(lgr, i, segment_test_version(i, count));
+    if (ret && probe_threads > 0 && lgr.get_metrics().parallel_probes == 0) {
+      cout << "FAILED: no segments probed side by side" << endl;
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+// Has idx1 rotate every second and segments expire 10 seconds after
+// last drained into. Keys put first go to the oldest segments and
+// those put 5 seconds after they are rotated to newer ones. Once the
+// oldest expires, some of the first keys are gone, though got into
+// the result cache before, and none has another value. Reopened with no retention, newer segments are to be found
+// past the gap left and all later keys are there.
+bool test_logger_retention(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger retention, count: " << count << endl;
+  // 16mb for idx0 as with 1, with cache for segments for idx1 to rotate
+  size_t cache_size_mb = (1 << 24) | (1 << 16) | (250 << 8) | 1;
+  {
+    logger lgr(fname, cache_size_mb);
+    lgr.set_retention(1, 10, 1);
+    // values of first keys are kept, to be let go on expiry
+    lgr.set_result_cache(64L << 20);
+    for (long i = 0; i < count * 2; i++) {
+      if (i == count) {
+        for (int wait = 0; wait < 100 && lgr.get_metrics().rotations == 0; wait++)
+          usleep(100000);
+        for (long j = 0; j < count; j++) {
+          if (!check_logger_get(lgr, j, 0))
+            return false;
+        }
+        sleep(5);
+      }
+      char key[20], val[50];
+      make_logger_kv(i, 0, key, val);
+      lgr.put(key, strlen(key), val, strlen(val));
+    }
+    for (int wait = 0; wait < 300 && lgr.get_metrics().expired_segments == 0; wait++)
+      usleep(100000);
+    if (lgr.get_metrics().rotations < 2 || lgr.get_metrics().expired_segments == 0) {
+      cout << "FAILED: idx1 rotated " << lgr.get_metrics().rotations << " times, "
+           << lgr.get_metrics().expired_segments << " segments expired" << endl;
+      return false;
+    }
+    long gone_count = 0;
+    for (long i = 0; i < count; i++) {
+      char key[20], expected[50], val[50];
+      make_logger_kv(i, 0, key, expected);
+      int val_len = sizeof(val);
+      if (!lgr.get(key, strlen(key), &val_len, val))
+        gone_count++;
+      else if (val_len != (int) strlen(expected) || memcmp(val, expected, val_len)) {
+        cout << "FAILED: " << key << " has other value after expiry" << endl;
+        return false;
+      }
+    }
+    if (gone_count == 0) {
+      cout << "FAILED: no key gone with expired segment" << endl;
+      return false;
+    }
+  }
+  logger lgr(fname, cache_size_mb);
+  bool ret = true;
+  for (long i = count; i < count * 2 && ret; i++)
+    ret = check_logger_get(lgr, i, 0);
+  return ret;
+}
+
+long total_pages(const vector<int>& sizes) {
+  long total = 0;
+  for (size_t i = 0; i < sizes.size(); i++)
+    total += sizes[i];
+  return total;
+}
+
+// Keys put twice go to a hot tier with a small cache, so random gets
+// on them hit pages evicted lately and the tier should take pages from
+// idx1. After idx1 rotates twice, pages are over budget and should be
+// given back as gets go on.
+bool test_logger_tune(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger cache tuning, count: " << count << endl;
+  size_t cache_size_mb = (1 << 24) | (1 << 16) | (250 << 8) | 1;
+  logger_tier_config tier2 = {".ix2", BUCKET_BLOCK_SIZE, 256, 2, 1000000L, 0.005};
+  logger lgr(fname, cache_size_mb, vector<logger_tier_config>(1, tier2));
+  lgr.set_tune_interval(4096);
+  for (long i = 0; i < count; i++) {
+    char key[20], val[50];
+    make_logger_kv(i, 0, key, val);
+    lgr.put(key, strlen(key), val, strlen(val));
+    lgr.put(key, strlen(key), val, strlen(val));
+  }
+  vector<int> start = lgr.get_cache_sizes();
+  vector<int> sizes = start;
+  data_rng rng(17);
+  for (int round = 0; round < 200 && sizes[0] <= start[0]; round++) {
+    for (int i = 0; i < 4096; i++) {
+      if (!check_logger_get(lgr, rng.next() % count, 0))
+        return false;
+    }
+    sizes = lgr.get_cache_sizes();
+  }
+  if (sizes[0] <= start[0] || sizes[1] >= start[1] || total_pages(sizes) > lgr.get_cache_budget()) {
+    cout << "FAILED: hot tier cache " << start[0] << " -> " << sizes[0] << ", idx1 cache "
+         << start[1] << " -> " << sizes[1] << ", budget " << lgr.get_cache_budget() << endl;
+    return false;
+  }
+  lgr.set_retention(1, 0, 1);
+  for (long i = count; i < count * 3; i++) {
+    if (i == count * 2) {
+      for (int wait = 0; wait < 100 && lgr.get_metrics().rotations == 0; wait++)
+        usleep(100000);
+    }
+    char key[20], val[50];
+    make_logger_kv(i, 0, key, val);
+    lgr.put(key, strlen(key), val, strlen(val));
+  }
+  for (int wait = 0; wait < 100 && lgr.get_metrics().rotations < 2; wait++)
+    usleep(100000);
+  if (lgr.get_metrics().rotations < 2) {
+    cout << "FAILED: idx1 rotated " << lgr.get_metrics().rotations << " times" << endl;
+    return false;
+  }
+  sizes = lgr.get_cache_sizes();
+  for (int round = 0; round < 500 && total_pages(sizes) > lgr.get_cache_budget(); round++) {
+    for (int i = 0; i < 4096; i++) {
+      if (!check_logger_get(lgr, rng.next() % (count * 3), 0))
+        return false;
+    }
+    sizes = lgr.get_cache_sizes();
+  }
+  if (total_pages(sizes) > lgr.get_cache_budget()) {
+    cout << "FAILED: " << total_pages(sizes) << " cache pages over budget of "
+         << lgr.get_cache_budget() << " after rotation" << endl;
+    return false;
+  }
+  return true;
+}
+
+// Keys are put twice, the second time with another value of the same
+// length, so that many are drained into idx1 over an older record.
+// Each entry drained should descend idx1 once.
+bool test_logger_drain_descents(long count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger drain descents, count: " << count << endl;
+  logger lgr(fname, 1, vector<logger_tier_config>());
+  for (int version = 0; version < 2; version++) {
+    for (long i = 0; i < count; i++) {
+      char key[20], val[50];
+      make_logger_kv(i, version, key, val);
+      lgr.put(key, strlen(key), val, strlen(val));
+    }
+  }
+  lgr.wait_for_drain();
+  long entries = lgr.get_metrics().frozen_entries;
+  long descents = lgr.get_metrics().drain_descents;
+  cout << "Drained " << entries << " entries in " << descents << " descents, "
+       << lgr.get_metrics().tier_pages_read << " tier pages read" << endl;
+  if (entries == 0 || descents != entries) {
+    cout << "FAILED: " << descents << " descents for " << entries << " entries drained" << endl;
+    return false;
+  }
+  bool ret = true;
+  for (long i = 0; i < count && ret; i++)
+    ret = check_logger_get(lgr, i, 1);
+  return ret;
+}
+
+// Key i as 3 bytes and a value of 1 byte, so that records and
+// tombstones in idx1 and segments take less than 9 bytes
+void make_short_kv(long i, int version, uint8_t *key, uint8_t *val) {
+  key[0] = (uint8_t) (i >> 16);
+  key[1] = (uint8_t) (i >> 8);
+  key[2] = (uint8_t) i;
+  val[0] = 'a' + version;
+}
+
+// Version of key i put by test_logger_short_keys, -1 if deleted
+int short_key_version(long i, long count) {
+  if (i >= count / 3)
+    return 0;
+  return i % 7 == 3 ? -1 : (i % 7 == 5 ? 1 : 0);
+}
+
+bool check_short_get(logger& lgr, long i, int version) {
+  uint8_t key[3], expected[1], val[10];
+  make_short_kv(i, version < 0 ? 0 : version, key, expected);
+  int val_len = sizeof(val);
+  bool is_found = lgr.get(key, 3, &val_len, val);
+  if (version < 0 ? !is_found : (is_found && val_len == 1 && val[0] == expected[0]))
+    return true;
+  cout << "FAILED: short key " << i << (is_found ? " has other value" : " not found") << endl;
+  return false;
+}
+
+// Checks that iterate gives each short key not deleted once, in order
+bool check_short_iterate(logger& lgr, long total, long count) {
+  tier_merger *it = lgr.iterate();
+  long i = 0;
+  bool ret = true;
+  while (ret && it->next()) {
+    while (i < total && short_key_version(i, count) < 0)
+      i++;
+    uint8_t key[3], val[1];
+    make_short_kv(i, short_key_version(i, count), key, val);
+    int key_len, val_len;
+    const uint8_t *k = it->get_key(key_len);
+    const uint8_t *v = it->get_value(val_len);
+    if (i >= total || key_len != 3 || memcmp(k, key, 3) || val_len != 1 || v[0] != val[0]) {
+      cout << "FAILED: iterate gave key of length " << key_len << " for short key " << i << endl;
+      ret = false;
+    }
+    i++;
+  }
+  delete it;
+  while (i < total && short_key_version(i, count) < 0)
+    i++;
+  if (ret && i < total) {
+    cout << "FAILED: iterate of short keys ended before key " << i << endl;
+    ret = false;
+  }
+  return ret;
+}
+
+// As test_logger_segments, with keys and values short enough that
+// the first cell put in a page, at its end, is under 9 bytes. Some
+// keys of the oldest segment are deleted or put again and drained to
+// a newer segment, which is merged with it once both are rotated.
+// Iterate and gets are to see no deleted key and the newest values.
+bool test_logger_short_keys(long count, long more_count, const char *fname) {
+  remove_logger_files(fname);
+  cout << "Testing logger short keys, count: " << count << endl;
+  size_t cache_size_mb = (1 << 8) | 4;
+  bool ret = true;
+  for (int pass = 0; pass < 2 && ret; pass++) {
+    logger lgr(fname, cache_size_mb);
+    uint8_t key[3], val[1];
+    for (long i = 0; i < count && pass == 0; i++) {
+      make_short_kv(i, 0, key, val);
+      lgr.put(key, 3, val, 1);
+    }
+    for (long i = 0; i < count / 3 && pass == 0; i++) {
+      int version = short_key_version(i, count);
+      make_short_kv(i, version < 0 ? 0 : version, key, val);
+      if (version > 0)
+        lgr.put(key, 3, val, 1);
+      else if (version < 0)
+        lgr.del(key, 3);
+    }
+    for (long i = count; i < count + more_count && pass == 0; i++) {
+      make_short_kv(i, 0, key, val);
+      lgr.put(key, 3, val, 1);
+    }
+    if (pass == 0) {
+      // merge is made in background once two segments are rotated
+      for (int wait = 0; wait < 600 && lgr.get_metrics().merges == 0; wait++)
+        usleep(100000);
+      if (lgr.get_metrics().rotations < 2 || lgr.get_metrics().merges == 0) {
+        cout << "FAILED: segments of short keys rotated " << lgr.get_metrics().rotations
+             << " times, merged " << lgr.get_metrics().merges << " times" << endl;
+        return false;
+      }
+    }
+    ret = check_short_iterate(lgr, count + more_count, count);
+    for (long i = 0; i < count + more_count && ret; i++)
+      ret = check_short_get(lgr, i, short_key_version(i, count));
+  }
+  return ret;
+}
+
+// Removes files of each shard of sharded_logger of given name
+void remove_sharded_logger_files(const char *fname, int shard_count) {
+  for (int i = 0; i < shard_count; i++)
+    remove_logger_files((string(fname) + ".s" + to_string(i)).c_str());
+}
+
+// Checks that key i has value of given version in sharded_logger
+bool check_sharded_get(sharded_logger& lgr, long i, int version) {
+  char key[20], expected[50], val[50];
+  make_logger_kv(i, version, key, expected);
+  int val_len = sizeof(val);
+  if (lgr.get(key, strlen(key), &val_len, val)
+        && val_len == (int) strlen(expected) && memcmp(val, expected, val_len) == 0)
+    return true;
+  cout << "FAILED: " << key << " not as put to sharded logger" << endl;
+  return false;
+}
+
+// Threads put keys of their own range into sharded_logger side by
+// side, every other key twice, getting each back right after. All
+// keys are checked once threads are done and after reopening.
+bool test_sharded_logger(int thread_count, long count, const char *fname) {
+  const int shard_count = 4;
+  remove_sharded_logger_files(fname, shard_count);
+  cout << "Testing sharded logger, threads: " << thread_count << ", count: " << count << endl;
+  bool ret = true;
+  for (int pass = 0; pass < 2 && ret; pass++) {
+    // second pass checks the same after reopening
+    sharded_logger lgr(fname, 1, shard_count);
+    vector<char> is_thread_ok(thread_count, 1);
+    vector<thread> threads;
+    for (int t = 0; t < thread_count && pass == 0; t++) {
+      threads.push_back(thread([&lgr, &is_thread_ok, t, count]() {
+        for (long i = t * count; i < (t + 1) * count && is_thread_ok[t]; i++) {
+          for (int version = 0; version <= (i % 2 ? 0 : 1); version++) {
+            char key[20], val[50];
+            make_logger_kv(i, version, key, val);
+            lgr.put(key, strlen(key), val, strlen(val));
+            is_thread_ok[t] = check_sharded_get(lgr, i, version);
+          }
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+      threads[t].join();
+      ret = ret && is_thread_ok[t];
+    }
+    for (long i = 0; i < thread_count * count && ret; i++)
+      ret = check_sharded_get(lgr, i, i % 2 ? 0 : 1);
+  }
+  return ret;
+}
+
 int main(int argc, char *argv[]) {
 
   if (argc == 8 && strcmp(argv[1], "-c") == 0) {
@@ -606,8 +1549,33 @@ int main(int argc, char *argv[]) {
       //if (test_random_data(1400000, 64 * 1024)) {
         if (test_babynames()) {
           if (test_census()) {
-            cout << "All tests ok" << endl;
-            ret = 0;
+            if (test_multi_table(4096, 100000, 1024, "multi_table.db")) {
+              if (test_wal_readers(4096, 100000, 1024, "wal_readers.db")) {
+                if (test_index_update(4096, 20000, 1024, "index_update.db")) {
+                  if (test_make_new_recs("make_new_recs.db")) {
+                    if (test_verify_corrupt(4096, 0, "verify_corrupt.db")
+                          && test_verify_corrupt(4096, 1, "verify_corrupt.db")
+                          && test_blocked_bloom(1000000, 0.01, "blocked_bloom.blm")
+                          && test_slot_split(20000, "slot_split.ix0")
+                          && test_result_cache(1000)
+                          && test_logger_del(300000, "logger_del")
+                          && test_logger_iterate(300000, "logger_iterate")
+                          && test_logger_wal_replay(50000, "logger_wal")
+                          && test_logger_segments(2000000, 1500000, "logger_seg")
+                          && test_logger_segments(2000000, 1500000, "logger_seg_probe", 4)
+                          && test_logger_short_keys(3000000, 1500000, "logger_short")
+                          && test_logger_retention(300000, "logger_retention")
+                          && test_logger_tune(300000, "logger_tune")
+                          && test_logger_drain_descents(300000, "logger_descents")
+                          && test_logger_result_cache(300000, "logger_results")
+                          && test_sharded_logger(4, 100000, "logger_sharded")) {
+                      cout << "All tests ok" << endl;
+                      ret = 0;
+                    }
+                  }
+                }
+              }
+            }
           }
         }
       //}